@@ -7,24 +7,205 @@
 #ifndef FFMPEG_PLUS_PLUS_BASE
 #define FFMPEG_PLUS_PLUS_BASE
 
-#include <memory>
+#include <cstdarg>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
-struct AVClass;
+#include "FFPPHandle.h"
+#include "util/FFPPArgs.h"
+#include "util/FFPPArgSchema.h"
+
+extern "C" {
+#include <libavutil/log.h>
+#include <libavutil/opt.h>
+}
 
 namespace FFPP
 {
 	/// <summary>
-	/// FFPPBase is a wrapper for the AVClass struct used by FFmpeg.
+	/// ObjectTraits names the kind of an FFmpeg struct for metrics and
+	/// resolves its AVClass without an instance.
 	/// </summary>
+	template <typename T> struct ObjectTraits;
+
+	template <> struct ObjectTraits<AVCodecContext> {
+		static constexpr std::string_view kind = "codec";
+		static const AVClass* av_class() noexcept { return avcodec_get_class(); }
+	};
+
+	template <> struct ObjectTraits<AVFormatContext> {
+		static constexpr std::string_view kind = "format";
+		static const AVClass* av_class() noexcept { return avformat_get_class(); }
+	};
+
+	template <> struct ObjectTraits<AVFilterGraph> {
+		static constexpr std::string_view kind = "filtergraph";
+		static const AVClass* av_class() noexcept {
+			// libavfilter has no getter for the graph class, a throwaway graph provides it.
+			static const AVClass* const cls = [] {
+				AVFilterGraph* graph = avfilter_graph_alloc();
+				const AVClass* graph_class = graph ? graph->av_class : nullptr;
+				avfilter_graph_free(&graph);
+				return graph_class;
+			}();
+			return cls;
+		}
+	};
+
+	template <> struct ObjectTraits<SwsContext> {
+		static constexpr std::string_view kind = "scaler";
+		static const AVClass* av_class() noexcept { return sws_get_class(); }
+	};
+
+	template <> struct ObjectTraits<SwrContext> {
+		static constexpr std::string_view kind = "resampler";
+		static const AVClass* av_class() noexcept { return swr_get_class(); }
+	};
+
+	template <> struct ObjectTraits<AVBSFContext> {
+		static constexpr std::string_view kind = "bsf";
+		static const AVClass* av_class() noexcept { return av_bsf_get_class(); }
+	};
+
+	/// <summary>
+	/// Tags attached to metrics recorded for a wrapped object.
+	/// </summary>
+	struct MetricTags {
+		std::string_view kind;  // e.g. "codec"
+		const char* name;       // AVClass item name, e.g. "libx264"
+	};
+
+	/// <summary>
+	/// FFPPBase is the CRTP base of every wrapper around an AVClass enabled
+	/// FFmpeg struct T. Derived provides T* native() const. All services are
+	/// resolved at compile time: there are no virtual functions and the base
+	/// adds no data, so a wrapper is as large as what Derived stores.
+	/// </summary>
+	template <typename Derived, typename T>
 	class FFPPBase {
 	public:
-		FFPPBase(AVClass* base);
+		typedef T native_type;
+
+		T* get() const noexcept {
+			return static_cast<const Derived*>(this)->native();
+		}
+
+		T* operator->() const noexcept { return get(); }
+
+		/// <summary>
+		/// AVClass of the wrapped object, null while there is none.
+		/// </summary>
+		const AVClass* av_class() const noexcept {
+			const T* obj = get();
+			return obj ? *reinterpret_cast<const AVClass* const*>(obj) : nullptr;
+		}
+
+		/// <summary>
+		/// Option schema of T. Every struct type wrapped here has a single
+		/// AVClass, resolved through ObjectTraits, so the schema is available
+		/// before the object exists and the lookup is done once per type.
+		/// </summary>
+		static const FFPPArgSchema& schema() {
+			static const FFPPArgSchema& instance = FFPPArgSchema::get(ObjectTraits<T>::av_class());
+			return instance;
+		}
+
+		FFPPArgs args() const {
+			return FFPPArgs(get());
+		}
+
+		std::optional<FFPPArgSchema::Index> option_index(std::string_view name) const {
+			return schema().find(name);
+		}
+
+		/// <summary>
+		/// Reads a scalar option directly from its offset.
+		/// </summary>
+		template <typename V>
+		V option(FFPPArgSchema::Index i) const {
+			static_assert(std::is_arithmetic_v<V> || std::is_enum_v<V>, "Only scalar options can be read by offset");
+			V value;
+			std::memcpy(&value, reinterpret_cast<const uint8_t*>(get()) + schema().offset(i), sizeof(V));
+			return value;
+		}
+
+		/// <summary>
+		/// Writes a scalar option directly to its offset, bypassing range checks.
+		/// </summary>
+		template <typename V>
+		void set_option(FFPPArgSchema::Index i, V value) const {
+			static_assert(std::is_arithmetic_v<V> || std::is_enum_v<V>, "Only scalar options can be written by offset");
+			std::memcpy(reinterpret_cast<uint8_t*>(get()) + schema().offset(i), &value, sizeof(V));
+		}
+
+		int set_option(const char* name, const char* value, int search_flags = AV_OPT_SEARCH_CHILDREN) const {
+			return av_opt_set(get(), name, value, search_flags);
+		}
+
+		/// <summary>
+		/// Logs through av_log() with this object as context, so the message
+		/// carries the class name of the object.
+		/// </summary>
+		void log(int level, const char* fmt, ...) const {
+			va_list vl;
+			va_start(vl, fmt);
+			av_vlog(get(), level, fmt, vl);
+			va_end(vl);
+		}
+
+		MetricTags metric_tags() const {
+			const AVClass* cls = av_class();
+			return { ObjectTraits<T>::kind, cls && cls->item_name ? cls->item_name(get()) : "" };
+		}
+
+	protected:
+		FFPPBase() = default;
 		~FFPPBase() = default;
+	};
+
+	/// <summary>
+	/// Owning wrapper holding its FFmpeg object in an FFPP::Handle.
+	/// </summary>
+	template <typename T, typename Deleter>
+	class Object : public FFPPBase<Object<T, Deleter>, T> {
+	public:
+		Object() = default;
+		explicit Object(Handle<T, Deleter> handle) noexcept : m_handle(std::move(handle)) {}
+
+		T* native() const noexcept { return m_handle.get(); }
+		Handle<T, Deleter>& handle() noexcept { return m_handle; }
+		explicit operator bool() const noexcept { return static_cast<bool>(m_handle); }
+
+	private:
+		Handle<T, Deleter> m_handle;
+	};
+
+	/// <summary>
+	/// Non-owning wrapper for objects owned elsewhere.
+	/// </summary>
+	template <typename T>
+	class ObjectRef : public FFPPBase<ObjectRef<T>, T> {
+	public:
+		explicit ObjectRef(T* ptr) noexcept : m_ptr(ptr) {}
+
+		T* native() const noexcept { return m_ptr; }
 
-		AVClass* get() const;
 	private:
-		std::unique_ptr<AVClass> m_base = nullptr;
+		T* m_ptr = nullptr;
 	};
+
+	typedef Object<AVCodecContext, CodecContextDeleter> CodecContext;
+	typedef Object<AVFormatContext, FormatInputDeleter> InputFormatContext;
+	typedef Object<AVFormatContext, FormatOutputDeleter> OutputFormatContext;
+	typedef Object<AVFilterGraph, FilterGraphDeleter> FilterGraphContext;
+	typedef Object<SwsContext, SwsContextDeleter> ScaleContext;
+	typedef Object<SwrContext, SwrContextDeleter> ResampleContext;
+
+	static_assert(sizeof(CodecContext) == sizeof(AVCodecContext*));
+	static_assert(sizeof(ObjectRef<AVCodecContext>) == sizeof(AVCodecContext*));
 }
 
 #endif
\ No newline at end of file
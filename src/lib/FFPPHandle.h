@@ -0,0 +1,349 @@
+/*
+ * FFPPHandle.h
+ *
+ * Move-only owning handles for FFmpeg objects.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_HANDLE
+#define FFMPEG_PLUS_PLUS_HANDLE
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
+#include <libavfilter/avfilter.h>
+#include <libavformat/avformat.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+namespace FFPP {
+
+	/// <summary>
+	/// Handle owns a single FFmpeg object and releases it through Deleter.
+	/// The deleter has to be stateless, so a handle is exactly pointer sized
+	/// and compiles down to the plain C calls.
+	/// </summary>
+	template <typename T, typename Deleter>
+	class Handle {
+		static_assert(std::is_empty_v<Deleter>, "Handle requires a stateless deleter");
+
+	public:
+		typedef T element_type;
+		typedef Deleter deleter_type;
+
+		constexpr Handle() noexcept = default;
+		constexpr Handle(std::nullptr_t) noexcept {}
+		explicit Handle(T* ptr) noexcept : m_ptr(ptr) {}
+
+		Handle(Handle&& other) noexcept : m_ptr(other.release()) {}
+		Handle& operator=(Handle&& other) noexcept {
+			reset(other.release());
+			return *this;
+		}
+
+		Handle(const Handle&) = delete;
+		Handle& operator=(const Handle&) = delete;
+
+		~Handle() { reset(); }
+
+		T* get() const noexcept { return m_ptr; }
+		T* operator->() const noexcept { return m_ptr; }
+		T& operator*() const noexcept { return *m_ptr; }
+		explicit operator bool() const noexcept { return m_ptr != nullptr; }
+
+		/// <summary>
+		/// Gives up ownership without releasing the object.
+		/// </summary>
+		T* release() noexcept { return std::exchange(m_ptr, nullptr); }
+
+		void reset(T* ptr = nullptr) noexcept {
+			if (T* old = std::exchange(m_ptr, ptr)) {
+				Deleter{}(old);
+			}
+		}
+
+		/// <summary>
+		/// Releases the current object and exposes the storage to FFmpeg
+		/// functions returning a new object through T**.
+		/// </summary>
+		T** out() noexcept {
+			reset();
+			return &m_ptr;
+		}
+
+	private:
+		T* m_ptr = nullptr;
+	};
+
+	struct CodecContextDeleter {
+		void operator()(AVCodecContext* p) const noexcept { avcodec_free_context(&p); }
+	};
+
+	struct FormatInputDeleter {
+		void operator()(AVFormatContext* p) const noexcept { avformat_close_input(&p); }
+	};
+
+	struct FormatOutputDeleter {
+		void operator()(AVFormatContext* p) const noexcept {
+			if (p->oformat && !(p->oformat->flags & AVFMT_NOFILE) && !(p->flags & AVFMT_FLAG_CUSTOM_IO)) {
+				avio_closep(&p->pb);
+			}
+			avformat_free_context(p);
+		}
+	};
+
+	struct BSFContextDeleter {
+		void operator()(AVBSFContext* p) const noexcept { av_bsf_free(&p); }
+	};
+
+	struct FrameDeleter {
+		void operator()(AVFrame* p) const noexcept { av_frame_free(&p); }
+	};
+
+	struct PacketDeleter {
+		void operator()(AVPacket* p) const noexcept { av_packet_free(&p); }
+	};
+
+	struct SwsContextDeleter {
+		void operator()(SwsContext* p) const noexcept { sws_freeContext(p); }
+	};
+
+	struct SwrContextDeleter {
+		void operator()(SwrContext* p) const noexcept { swr_free(&p); }
+	};
+
+	struct AudioFifoDeleter {
+		void operator()(AVAudioFifo* p) const noexcept { av_audio_fifo_free(p); }
+	};
+
+	struct FilterGraphDeleter {
+		void operator()(AVFilterGraph* p) const noexcept { avfilter_graph_free(&p); }
+	};
+
+	struct BufferRefDeleter {
+		void operator()(AVBufferRef* p) const noexcept { av_buffer_unref(&p); }
+	};
+
+	struct IOContextDeleter {
+		void operator()(AVIOContext* p) const noexcept {
+			av_freep(&p->buffer);
+			avio_context_free(&p);
+		}
+	};
+
+	struct CodecParametersDeleter {
+		void operator()(AVCodecParameters* p) const noexcept { avcodec_parameters_free(&p); }
+	};
+
+	typedef Handle<AVCodecContext, CodecContextDeleter> CodecContextHandle;
+	typedef Handle<AVCodecParameters, CodecParametersDeleter> CodecParametersHandle;
+	typedef Handle<AVFormatContext, FormatInputDeleter> FormatInputHandle;
+	typedef Handle<AVFormatContext, FormatOutputDeleter> FormatOutputHandle;
+	typedef Handle<AVBSFContext, BSFContextDeleter> BSFContextHandle;
+	typedef Handle<AVFrame, FrameDeleter> FrameHandle;
+	typedef Handle<AVPacket, PacketDeleter> PacketHandle;
+	typedef Handle<SwsContext, SwsContextDeleter> SwsContextHandle;
+	typedef Handle<SwrContext, SwrContextDeleter> SwrContextHandle;
+	typedef Handle<AVAudioFifo, AudioFifoDeleter> AudioFifoHandle;
+	typedef Handle<AVFilterGraph, FilterGraphDeleter> FilterGraphHandle;
+	typedef Handle<AVBufferRef, BufferRefDeleter> BufferRefHandle;
+	typedef Handle<AVIOContext, IOContextDeleter> IOContextHandle;
+
+	static_assert(sizeof(CodecContextHandle) == sizeof(AVCodecContext*));
+	static_assert(sizeof(FrameHandle) == sizeof(AVFrame*));
+
+	/// <summary>
+	/// HandlePool recycles objects of one type instead of freeing them.
+	/// Traits provides static alloc(), reset(T*) and free(T*). There is one
+	/// pool per Traits type so that pooled handles keep a stateless deleter.
+	/// Each thread keeps a small cache in front of the shared free list, and
+	/// idle objects beyond the high-water mark are freed.
+	/// </summary>
+	template <typename T, typename Traits>
+	class HandlePool {
+	public:
+		struct Stats {
+			size_t live = 0;                      // Allocated and not yet freed
+			size_t idle = 0;                      // In the shared free list
+		};
+
+		static HandlePool& get_instance() {
+			static HandlePool instance;
+			return instance;
+		}
+
+		~HandlePool() {
+			for (T* obj : m_free) {
+				Traits::free(obj);
+			}
+		}
+
+		HandlePool(const HandlePool&) = delete;
+		HandlePool& operator=(const HandlePool&) = delete;
+
+		/// <summary>
+		/// Returns a recycled object, allocating only if the pool is empty.
+		/// </summary>
+		T* acquire() {
+			std::vector<T*>& cache = local_cache().objects;
+			if (cache.empty()) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				const size_t count = std::min(m_free.size(), LocalBatch);
+				cache.insert(cache.end(), m_free.end() - count, m_free.end());
+				m_free.resize(m_free.size() - count);
+			}
+			if (!cache.empty()) {
+				T* obj = cache.back();
+				cache.pop_back();
+				return obj;
+			}
+
+			T* obj = Traits::alloc();
+			if (obj) {
+				m_live.fetch_add(1, std::memory_order_relaxed);
+			}
+			return obj;
+		}
+
+		void release(T* obj) {
+			Traits::reset(obj);
+			std::vector<T*>& cache = local_cache().objects;
+			cache.push_back(obj);
+			if (cache.size() >= LocalCapacity) {
+				give_back(cache, LocalCapacity / 2);
+			}
+		}
+
+		/// <summary>
+		/// Pre-allocates objects so that the hot path never allocates.
+		/// </summary>
+		void reserve(size_t count) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_free.reserve(count);
+			while (m_free.size() < count) {
+				T* obj = Traits::alloc();
+				if (!obj) {
+					break;
+				}
+				m_live.fetch_add(1, std::memory_order_relaxed);
+				m_free.push_back(obj);
+			}
+		}
+
+		/// <summary>
+		/// Idle objects kept in the shared free list, the rest are freed.
+		/// </summary>
+		void set_high_water(size_t count) {
+			m_high_water.store(count, std::memory_order_relaxed);
+			std::vector<T*> cache;
+			give_back(cache, 0);
+		}
+
+		Stats stats() const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return Stats{ m_live.load(std::memory_order_relaxed), m_free.size() };
+		}
+
+	private:
+		static constexpr size_t LocalCapacity = 32;
+		static constexpr size_t LocalBatch = 8;
+
+		struct LocalCache {
+			std::vector<T*> objects;
+			~LocalCache() { HandlePool::get_instance().give_back(objects, 0); }
+		};
+
+		HandlePool() = default;
+
+		static LocalCache& local_cache() {
+			thread_local LocalCache cache;
+			return cache;
+		}
+
+		/// <summary>
+		/// Moves all but keep objects of cache to the shared list and trims it.
+		/// </summary>
+		void give_back(std::vector<T*>& cache, size_t keep) {
+			std::vector<T*> excess;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				while (cache.size() > keep) {
+					m_free.push_back(cache.back());
+					cache.pop_back();
+				}
+				const size_t high_water = m_high_water.load(std::memory_order_relaxed);
+				if (m_free.size() > high_water) {
+					excess.assign(m_free.begin() + high_water, m_free.end());
+					m_free.resize(high_water);
+				}
+			}
+			for (T* obj : excess) {
+				Traits::free(obj);
+			}
+			m_live.fetch_sub(excess.size(), std::memory_order_relaxed);
+		}
+
+		mutable std::mutex m_mutex;
+		std::vector<T*> m_free;
+		std::atomic<size_t> m_live = 0;
+		std::atomic<size_t> m_high_water = 1024;
+	};
+
+	template <typename Pool>
+	struct PoolDeleter {
+		template <typename T>
+		void operator()(T* p) const { Pool::get_instance().release(p); }
+	};
+
+	struct FramePoolTraits {
+		static AVFrame* alloc() { return av_frame_alloc(); }
+		static void reset(AVFrame* p) { av_frame_unref(p); }
+		static void free(AVFrame* p) { av_frame_free(&p); }
+	};
+
+	struct PacketPoolTraits {
+		static AVPacket* alloc() { return av_packet_alloc(); }
+		static void reset(AVPacket* p) { av_packet_unref(p); }
+		static void free(AVPacket* p) { av_packet_free(&p); }
+	};
+
+	typedef HandlePool<AVFrame, FramePoolTraits> FrameHandlePool;
+	typedef HandlePool<AVPacket, PacketPoolTraits> PacketHandlePool;
+
+	typedef Handle<AVFrame, PoolDeleter<FrameHandlePool>> PooledFrameHandle;
+	typedef Handle<AVPacket, PoolDeleter<PacketHandlePool>> PooledPacketHandle;
+
+	static_assert(sizeof(PooledFrameHandle) == sizeof(AVFrame*));
+
+	inline CodecContextHandle make_codec_context(const AVCodec* codec) {
+		return CodecContextHandle(avcodec_alloc_context3(codec));
+	}
+
+	inline FrameHandle make_frame() {
+		return FrameHandle(av_frame_alloc());
+	}
+
+	inline PacketHandle make_packet() {
+		return PacketHandle(av_packet_alloc());
+	}
+
+	inline PooledFrameHandle make_pooled_frame() {
+		return PooledFrameHandle(FrameHandlePool::get_instance().acquire());
+	}
+
+	inline PooledPacketHandle make_pooled_packet() {
+		return PooledPacketHandle(PacketHandlePool::get_instance().acquire());
+	}
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,47 @@
+/*
+ * BitstreamFilter.cpp
+ *
+ * Bitstream filter chain applied to the packets of one stream.
+ */
+
+#include "BitstreamFilter.h"
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+using namespace FFPP;
+
+int FFPP::BitstreamFilter::open(const std::string& chain, const AVCodecParameters* par, AVRational time_base)
+{
+	AVBSFContext* ctx = nullptr;
+	int ret = chain.empty() ? av_bsf_get_null_filter(&ctx) : av_bsf_list_parse_str(chain.c_str(), &ctx);
+	m_ctx.reset(ctx);
+	if (ret < 0) {
+		LOG_ERROR("BitstreamFilter: cannot parse " + chain + "\n");
+		return ret;
+	}
+
+	ret = avcodec_parameters_copy(m_ctx->par_in, par);
+	if (ret < 0) {
+		return ret;
+	}
+	m_ctx->time_base_in = time_base;
+	ret = av_bsf_init(m_ctx.get());
+	if (ret < 0) {
+		LOG_ERROR("BitstreamFilter: cannot initialise " + chain + "\n");
+	}
+	return ret;
+}
+
+int FFPP::BitstreamFilter::send(AVPacket* packet)
+{
+	return av_bsf_send_packet(m_ctx.get(), packet);
+}
+
+int FFPP::BitstreamFilter::receive(AVPacket* packet)
+{
+	return av_bsf_receive_packet(m_ctx.get(), packet);
+}
@@ -0,0 +1,65 @@
+/*
+ * BitstreamFilter.h
+ *
+ * Bitstream filter chain applied to the packets of one stream.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_BITSTREAM_FILTER
+#define FFMPEG_PLUS_PLUS_BITSTREAM_FILTER
+
+#include <string>
+
+#include "../FFPPBase.h"
+#include "../FFPPHandle.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// BitstreamFilter owns an AVBSFContext running a chain such as
+	/// "h264_mp4toannexb" or "h264_mp4toannexb,dump_extra" over the packets
+	/// of one stream. Packets are passed by reference; only the filters that
+	/// rewrite the bitstream touch the payload.
+	/// </summary>
+	class BitstreamFilter : public FFPPBase<BitstreamFilter, AVBSFContext> {
+	public:
+		BitstreamFilter() = default;
+
+		BitstreamFilter(const BitstreamFilter&) = delete;
+		BitstreamFilter& operator=(const BitstreamFilter&) = delete;
+
+		AVBSFContext* native() const noexcept { return m_ctx.get(); }
+
+		/// <summary>
+		/// Sets up chain for a stream with parameters par and timestamps in
+		/// time_base. An empty chain passes packets through.
+		/// </summary>
+		int open(const std::string& chain, const AVCodecParameters* par, AVRational time_base);
+
+		/// <summary>
+		/// Parameters of the filtered stream, valid after open().
+		/// </summary>
+		const AVCodecParameters* parameters() const { return m_ctx->par_out; }
+
+		/// <summary>
+		/// Time base of the filtered packets, valid after open().
+		/// </summary>
+		AVRational time_base() const { return m_ctx->time_base_out; }
+
+		/// <summary>
+		/// Takes the reference of packet, leaving it blank. A null packet
+		/// flushes the chain.
+		/// </summary>
+		int send(AVPacket* packet);
+
+		/// <summary>
+		/// Returns AVERROR(EAGAIN) if more input is needed and AVERROR_EOF
+		/// once flushed.
+		/// </summary>
+		int receive(AVPacket* packet);
+
+	private:
+		BSFContextHandle m_ctx;
+	};
+}
+
+#endif
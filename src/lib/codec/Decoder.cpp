@@ -0,0 +1,223 @@
+/*
+ * Decoder.cpp
+ *
+ * Multi-threaded decoder serving picture buffers from our own pools.
+ */
+
+#include "Decoder.h"
+
+#include "../../utils/Logging/Logger.h"
+#include "../util/BufferPools.h"
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	constexpr size_t BufferPadding = 64; // Some SIMD code reads past the last row
+}
+
+FFPP::Decoder::Decoder(const Config& config)
+	: m_config(config)
+{
+	m_codec = config.codec_name.empty()
+		? avcodec_find_decoder(config.codec_id)
+		: avcodec_find_decoder_by_name(config.codec_name.c_str());
+	if (!m_codec) {
+		LOG_ERROR("Decoder: codec not found\n");
+		return;
+	}
+	m_ctx = make_codec_context(m_codec);
+	if (!m_ctx) {
+		LOG_ERROR("Decoder: could not allocate codec context\n");
+	}
+}
+
+FFPP::Decoder::Decoder(const AVCodecParameters* par, const Config& config)
+	: Decoder([&] { Config c = config; c.codec_id = par->codec_id; return c; }())
+{
+	if (m_ctx && avcodec_parameters_to_context(m_ctx.get(), par) < 0) {
+		LOG_ERROR("Decoder: invalid codec parameters\n");
+		m_ctx.reset();
+	}
+}
+
+FFPP::Decoder::~Decoder()
+{
+	uninstall_shared_execute(m_ctx.get());
+}
+
+void FFPP::Decoder::set_timing_callback(TimingCallback callback)
+{
+	m_timing_callback = std::move(callback);
+}
+
+int FFPP::Decoder::open(AVDictionary** options)
+{
+	if (!m_ctx) {
+		return AVERROR(EINVAL);
+	}
+
+	const int thread_count = m_config.thread_count ? m_config.thread_count : auto_thread_count();
+	apply_threading(m_ctx.get(), m_config.threading, thread_count);
+
+	if (m_config.pooled_buffers && m_codec->type == AVMEDIA_TYPE_VIDEO && (m_codec->capabilities & AV_CODEC_CAP_DR1)) {
+		m_ctx->opaque = this;
+		m_ctx->get_buffer2 = &Decoder::get_buffer2;
+	}
+
+	const int ret = avcodec_open2(m_ctx.get(), m_codec, options);
+	if (ret < 0) {
+		LOG_ERROR("Decoder: could not open codec\n");
+		return ret;
+	}
+	if (m_config.threading == Threading::Shared) {
+		install_shared_execute(m_ctx.get(), m_config.job);
+	}
+	return 0;
+}
+
+int FFPP::Decoder::send(const AVPacket* packet)
+{
+	if (!packet) {
+		m_draining = true;
+	}
+	m_mark = std::chrono::steady_clock::now();
+	return avcodec_send_packet(m_ctx.get(), packet);
+}
+
+int FFPP::Decoder::receive(AVFrame* frame)
+{
+	const int ret = avcodec_receive_frame(m_ctx.get(), frame);
+	if (ret >= 0) {
+		record(frame);
+	}
+	return ret;
+}
+
+int FFPP::Decoder::decode(const AVPacket* packet, const std::function<void(AVFrame*)>& callback)
+{
+	FrameHandle frame = make_frame();
+	if (!frame) {
+		return AVERROR(ENOMEM);
+	}
+
+	int ret = send(packet);
+	while (ret == AVERROR(EAGAIN)) {
+		// Output has to be collected before the packet is accepted.
+		while ((ret = receive(frame.get())) >= 0) {
+			callback(frame.get());
+			av_frame_unref(frame.get());
+		}
+		if (ret != AVERROR(EAGAIN)) {
+			return ret;
+		}
+		ret = send(packet);
+	}
+	if (ret < 0) {
+		return ret;
+	}
+
+	while ((ret = receive(frame.get())) >= 0) {
+		callback(frame.get());
+		av_frame_unref(frame.get());
+	}
+	return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+void FFPP::Decoder::flush()
+{
+	avcodec_flush_buffers(m_ctx.get());
+	m_draining = false;
+}
+
+FFPP::Decoder::Stats FFPP::Decoder::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_stats_mutex);
+	Stats stats = m_stats;
+	stats.pools = BufferPools::get_instance().stats().pools;
+	return stats;
+}
+
+void FFPP::Decoder::record(const AVFrame* frame)
+{
+	const auto now = std::chrono::steady_clock::now();
+	const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_mark);
+	m_mark = now;
+	{
+		std::lock_guard<std::mutex> lock(m_stats_mutex);
+		m_stats.frames++;
+		m_stats.total += elapsed;
+		m_stats.last = elapsed;
+		m_stats.max = std::max(m_stats.max, elapsed);
+	}
+	if (m_timing_callback) {
+		m_timing_callback(frame, elapsed);
+	}
+}
+
+int FFPP::Decoder::get_buffer2(AVCodecContext* ctx, AVFrame* frame, int flags)
+{
+	auto* self = static_cast<Decoder*>(ctx->opaque);
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+
+	// Hardware and palette formats need the special handling of the default.
+	if (!self || !desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL))) {
+		return avcodec_default_get_buffer2(ctx, frame, flags);
+	}
+
+	const int ret = alloc_picture(ctx, frame);
+	return ret < 0 ? avcodec_default_get_buffer2(ctx, frame, flags) : ret;
+}
+
+int FFPP::Decoder::alloc_picture(AVCodecContext* ctx, AVFrame* frame)
+{
+	const auto format = static_cast<AVPixelFormat>(frame->format);
+	int width = frame->width;
+	int height = frame->height;
+	int align[AV_NUM_DATA_POINTERS];
+	// ctx is the calling thread's context; with frame threading the user
+	// facing one lags behind and belongs to another thread.
+	avcodec_align_dimensions2(ctx, &width, &height, align);
+
+	// Widen until every plane meets its alignment, as the default allocator does.
+	int linesize[4] = { 0 };
+	int unaligned = 0;
+	do {
+		const int ret = av_image_fill_linesizes(linesize, format, width);
+		if (ret < 0) {
+			return ret;
+		}
+		width += width & ~(width - 1);
+		unaligned = 0;
+		for (int i = 0; i < 4; i++) {
+			unaligned |= linesize[i] % align[i];
+		}
+	} while (unaligned);
+
+	const ptrdiff_t linesize_ptr[4] = { linesize[0], linesize[1], linesize[2], linesize[3] };
+	size_t sizes[4] = { 0 };
+	const int ret = av_image_fill_plane_sizes(sizes, format, height, linesize_ptr);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (int i = 0; i < 4 && sizes[i]; i++) {
+		frame->buf[i] = BufferPools::get_instance().get(sizes[i] + BufferPadding);
+		if (!frame->buf[i]) {
+			for (int j = 0; j < i; j++) {
+				av_buffer_unref(&frame->buf[j]);
+			}
+			return AVERROR(ENOMEM);
+		}
+		frame->data[i] = frame->buf[i]->data;
+		frame->linesize[i] = linesize[i];
+	}
+	frame->extended_data = frame->data;
+	return 0;
+}
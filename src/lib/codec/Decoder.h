@@ -0,0 +1,114 @@
+/*
+ * Decoder.h
+ *
+ * Multi-threaded decoder serving picture buffers from our own pools.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_DECODER
+#define FFMPEG_PLUS_PLUS_DECODER
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "../FFPPBase.h"
+#include "../FFPPHandle.h"
+#include "SharedExecute.h"
+#include "Threading.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Decoder owns an AVCodecContext configured for frame and slice threading.
+	/// Video pictures are allocated by a custom get_buffer2 from the shared
+	/// BufferPools, so steady state decoding does not call av_malloc for
+	/// picture data.
+	/// </summary>
+	class Decoder : public FFPPBase<Decoder, AVCodecContext> {
+	public:
+		struct Config {
+			std::string codec_name = "";          // Takes precedence over codec_id
+			AVCodecID codec_id = AV_CODEC_ID_H264;
+			Threading threading = Threading::Auto;
+			int thread_count = 0;                 // 0 sizes from the available CPUs
+			bool pooled_buffers = true;
+			std::shared_ptr<UTLX::Job> job;       // Scheduler job for Threading::Shared, null creates one
+		};
+
+		struct Stats {
+			uint64_t frames = 0;
+			std::chrono::nanoseconds total{ 0 };
+			std::chrono::nanoseconds max{ 0 };
+			std::chrono::nanoseconds last{ 0 };
+			size_t pools = 0;                     // Size classes in use process-wide
+		};
+
+		/// <summary>
+		/// Called for every decoded frame with the time spent producing it.
+		/// </summary>
+		typedef std::function<void(const AVFrame* frame, std::chrono::nanoseconds elapsed)> TimingCallback;
+
+		explicit Decoder(const Config& config);
+
+		/// <summary>
+		/// Creates a decoder for a demuxed stream, codec_id is taken from par.
+		/// </summary>
+		Decoder(const AVCodecParameters* par, const Config& config);
+		~Decoder();
+
+		Decoder(const Decoder&) = delete;
+		Decoder& operator=(const Decoder&) = delete;
+
+		AVCodecContext* native() const noexcept { return m_ctx.get(); }
+
+		void set_timing_callback(TimingCallback callback);
+
+		int open(AVDictionary** options = nullptr);
+
+		/// <summary>
+		/// Sends a packet, a null packet starts draining.
+		/// </summary>
+		int send(const AVPacket* packet);
+
+		/// <summary>
+		/// Returns 0 and a frame, AVERROR(EAGAIN) if more input is needed or
+		/// AVERROR_EOF once fully drained.
+		/// </summary>
+		int receive(AVFrame* frame);
+
+		/// <summary>
+		/// Sends packet and passes every frame it completes to callback.
+		/// A null packet drains the decoder.
+		/// </summary>
+		int decode(const AVPacket* packet, const std::function<void(AVFrame*)>& callback);
+
+		/// <summary>
+		/// Drops all buffered data, e.g. after a seek. Also ends a drain.
+		/// </summary>
+		void flush();
+
+		bool draining() const { return m_draining; }
+
+		Stats stats() const;
+
+	private:
+		static int get_buffer2(AVCodecContext* ctx, AVFrame* frame, int flags);
+		static int alloc_picture(AVCodecContext* ctx, AVFrame* frame);
+
+		void record(const AVFrame* frame);
+
+		const AVCodec* m_codec = nullptr;
+		CodecContextHandle m_ctx;
+		Config m_config;
+		bool m_draining = false;
+
+		TimingCallback m_timing_callback;
+		mutable std::mutex m_stats_mutex;
+		Stats m_stats;
+		std::chrono::steady_clock::time_point m_mark;  // Last send or last frame out
+	};
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,206 @@
+/*
+ * Encoder.cpp
+ *
+ * Asynchronous encoder running the send/receive loop on its own thread.
+ */
+
+#include "Encoder.h"
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+using namespace FFPP;
+
+FFPP::Encoder::Encoder(const Config& config)
+	: m_config(config)
+	, m_input(config.input_capacity, config.wait_mode)
+	, m_output(config.output_capacity, config.wait_mode)
+{
+	m_codec = config.codec_name.empty()
+		? avcodec_find_encoder(config.codec_id)
+		: avcodec_find_encoder_by_name(config.codec_name.c_str());
+	if (!m_codec) {
+		LOG_ERROR("Encoder: codec not found\n");
+		return;
+	}
+	m_ctx = make_codec_context(m_codec);
+	if (!m_ctx) {
+		LOG_ERROR("Encoder: could not allocate codec context\n");
+	}
+}
+
+FFPP::Encoder::~Encoder()
+{
+	stop();
+	uninstall_shared_execute(m_ctx.get());
+}
+
+void FFPP::Encoder::set_packet_callback(PacketCallback callback)
+{
+	m_packet_callback = std::move(callback);
+}
+
+void FFPP::Encoder::set_finished_callback(FinishedCallback callback)
+{
+	m_finished_callback = std::move(callback);
+}
+
+int FFPP::Encoder::open(AVDictionary** options)
+{
+	if (!m_ctx || m_worker.joinable()) {
+		return AVERROR(EINVAL);
+	}
+
+	apply_threading(m_ctx.get(), m_config.threading, m_config.thread_count);
+
+	const int ret = avcodec_open2(m_ctx.get(), m_codec, options);
+	if (ret < 0) {
+		LOG_ERROR("Encoder: could not open codec\n");
+		return ret;
+	}
+	if (m_config.threading == Threading::Shared) {
+		install_shared_execute(m_ctx.get(), m_config.job);
+	}
+
+	m_stop = false;
+	m_finished = false;
+	m_worker = std::thread(&Encoder::run, this);
+	return 0;
+}
+
+bool FFPP::Encoder::try_submit(const AVFrame* frame)
+{
+	if (!frame || finished()) {
+		return false;
+	}
+
+	PooledFrameHandle ref = make_pooled_frame();
+	if (!ref || av_frame_ref(ref.get(), frame) < 0) {
+		return false;
+	}
+	return m_input.try_push(ref);
+}
+
+bool FFPP::Encoder::try_finish()
+{
+	PooledFrameHandle flush;
+	return m_input.try_push(flush);
+}
+
+bool FFPP::Encoder::submit(const AVFrame* frame)
+{
+	if (!frame || finished()) {
+		return false;
+	}
+
+	PooledFrameHandle ref = make_pooled_frame();
+	if (!ref || av_frame_ref(ref.get(), frame) < 0) {
+		return false;
+	}
+	return m_input.push(std::move(ref));
+}
+
+bool FFPP::Encoder::finish()
+{
+	return m_input.push(PooledFrameHandle());
+}
+
+bool FFPP::Encoder::poll(PooledPacketHandle& packet)
+{
+	auto item = m_output.try_pop();
+	if (!item) {
+		return false;
+	}
+	packet = std::move(*item);
+	return true;
+}
+
+void FFPP::Encoder::stop()
+{
+	m_stop = true;
+	m_input.close();
+	m_output.close();
+	if (m_worker.joinable()) {
+		m_worker.join();
+	}
+	m_input.clear();
+	m_output.clear();
+}
+
+void FFPP::Encoder::run()
+{
+	while (!m_stop) {
+		auto item = m_input.pop();
+		if (!item) {
+			break;
+		}
+
+		AVFrame* frame = item->get();
+		int ret = 0;
+		while ((ret = avcodec_send_frame(m_ctx.get(), frame)) == AVERROR(EAGAIN)) {
+			// The codec wants its output collected before it accepts more input.
+			if (!drain()) {
+				break;
+			}
+		}
+		if (ret < 0 && ret != AVERROR(EAGAIN)) {
+			fail(ret);
+			break;
+		}
+		if (frame) {
+			m_frames_in.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (!drain() || !frame) {
+			break;
+		}
+	}
+
+	// Blocked submit() and finish() calls return instead of waiting for a worker that is gone.
+	m_input.close();
+	m_finished.store(true, std::memory_order_release);
+	if (m_finished_callback) {
+		m_finished_callback(error());
+	}
+}
+
+bool FFPP::Encoder::drain()
+{
+	while (!m_stop) {
+		PooledPacketHandle packet = make_pooled_packet();
+		if (!packet) {
+			fail(AVERROR(ENOMEM));
+			return false;
+		}
+
+		const int ret = avcodec_receive_packet(m_ctx.get(), packet.get());
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+			return true;
+		}
+		if (ret < 0) {
+			fail(ret);
+			return false;
+		}
+
+		m_packets_out.fetch_add(1, std::memory_order_relaxed);
+		if (m_packet_callback) {
+			m_packet_callback(std::move(packet));
+		}
+		else if (!m_output.push(std::move(packet))) {
+			return false; // Closed by stop()
+		}
+	}
+	return false;
+}
+
+void FFPP::Encoder::fail(int error)
+{
+	int expected = 0;
+	m_error.compare_exchange_strong(expected, error);
+
+	char msg[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+	av_strerror(error, msg, sizeof(msg));
+	LOG_ERROR(std::string("Encoder: ") + msg + "\n");
+}
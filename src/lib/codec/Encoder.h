@@ -0,0 +1,146 @@
+/*
+ * Encoder.h
+ *
+ * Asynchronous encoder running the send/receive loop on its own thread.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_ENCODER
+#define FFMPEG_PLUS_PLUS_ENCODER
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "../FFPPBase.h"
+#include "../FFPPHandle.h"
+#include "../../utils/Concurrency/MpmcQueue.h"
+#include "SharedExecute.h"
+#include "Threading.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Encoder owns an AVCodecContext and runs avcodec_send_frame() and
+	/// avcodec_receive_packet() on a dedicated worker. Frames are handed in
+	/// through a bounded input queue, packets leave through a bounded output
+	/// queue or a callback invoked on the worker thread.
+	/// </summary>
+	class Encoder : public FFPPBase<Encoder, AVCodecContext> {
+	public:
+		typedef FFPP::Threading Threading;
+
+		struct Config {
+			std::string codec_name = "";          // Takes precedence over codec_id
+			AVCodecID codec_id = AV_CODEC_ID_H264;
+			Threading threading = Threading::Auto;
+			int thread_count = 0;                 // 0 lets FFmpeg use all CPUs
+			size_t input_capacity = 8;            // Frames
+			size_t output_capacity = 32;          // Packets
+			UTLX::WaitMode wait_mode = UTLX::WaitMode::Futex;
+			std::shared_ptr<UTLX::Job> job;       // Scheduler job for Threading::Shared, null creates one
+		};
+
+		typedef std::function<void(PooledPacketHandle)> PacketCallback;
+		typedef std::function<void(int error)> FinishedCallback;
+
+		explicit Encoder(const Config& config);
+		~Encoder();
+
+		Encoder(const Encoder&) = delete;
+		Encoder& operator=(const Encoder&) = delete;
+
+		AVCodecContext* native() const noexcept { return m_ctx.get(); }
+
+		/// <summary>
+		/// Packets are passed to callback instead of the output queue. Must be
+		/// set before open(). Blocking in the callback holds the encoder back
+		/// like a full output queue does.
+		/// </summary>
+		void set_packet_callback(PacketCallback callback);
+
+		/// <summary>
+		/// Called on the worker once the encoder is flushed or failed.
+		/// </summary>
+		void set_finished_callback(FinishedCallback callback);
+
+		/// <summary>
+		/// Applies the threading configuration, opens the codec and starts the
+		/// worker. The context has to be configured through operator-> first.
+		/// </summary>
+		int open(AVDictionary** options = nullptr);
+
+		/// <summary>
+		/// Queues a new reference to frame. Never blocks, returns false if the
+		/// input queue is full or the encoder is finished.
+		/// </summary>
+		bool try_submit(const AVFrame* frame);
+
+		/// <summary>
+		/// Queues the flush request. Never blocks, returns false if the input
+		/// queue is full.
+		/// </summary>
+		bool try_finish();
+
+		/// <summary>
+		/// Blocking variants of try_submit() and try_finish(), waiting for
+		/// space in the input queue. Return false once the encoder is stopped,
+		/// flushed or failed.
+		/// </summary>
+		bool submit(const AVFrame* frame);
+		bool finish();
+
+		/// <summary>
+		/// Takes the next encoded packet if one is ready. Never blocks.
+		/// </summary>
+		bool poll(PooledPacketHandle& packet);
+
+		/// <summary>
+		/// True once all packets were produced after try_finish(), or on error.
+		/// </summary>
+		bool finished() const { return m_finished.load(std::memory_order_acquire); }
+
+		/// <summary>
+		/// First error returned by libavcodec, 0 if none.
+		/// </summary>
+		int error() const { return m_error.load(std::memory_order_acquire); }
+
+		uint64_t frames_in() const { return m_frames_in.load(std::memory_order_relaxed); }
+		uint64_t packets_out() const { return m_packets_out.load(std::memory_order_relaxed); }
+
+		/// <summary>
+		/// Depth, high-water and blocked-time counters of the frame and packet queues.
+		/// </summary>
+		UTLX::QueueStats input_stats() const { return m_input.stats(); }
+		UTLX::QueueStats output_stats() const { return m_output.stats(); }
+
+		/// <summary>
+		/// Stops the worker, dropping queued frames and packets.
+		/// </summary>
+		void stop();
+
+	private:
+		void run();
+		bool drain();
+		void fail(int error);
+
+		const AVCodec* m_codec = nullptr;
+		CodecContextHandle m_ctx;
+		Config m_config;
+
+		UTLX::MpmcQueue<PooledFrameHandle> m_input;    // Null handle requests the flush
+		UTLX::MpmcQueue<PooledPacketHandle> m_output;
+
+		PacketCallback m_packet_callback;
+		FinishedCallback m_finished_callback;
+
+		std::thread m_worker;
+		std::atomic<bool> m_stop = false;
+		std::atomic<bool> m_finished = false;
+		std::atomic<int> m_error = 0;
+		std::atomic<uint64_t> m_frames_in = 0;
+		std::atomic<uint64_t> m_packets_out = 0;
+	};
+}
+
+#endif
\ No newline at end of file
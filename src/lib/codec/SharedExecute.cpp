@@ -0,0 +1,106 @@
+/*
+ * SharedExecute.cpp
+ *
+ * Runs libavcodec slice jobs on the shared UTLX::Scheduler.
+ */
+
+#include "SharedExecute.h"
+
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	/// <summary>
+	/// The callbacks only get the codec context, so the job is looked up here.
+	/// </summary>
+	class Registry {
+	public:
+		static Registry& get_instance() {
+			static Registry instance;
+			return instance;
+		}
+
+		void add(const AVCodecContext* ctx, std::shared_ptr<UTLX::Job> job) {
+			std::unique_lock<std::shared_mutex> lock(m_mutex);
+			m_jobs[ctx] = std::move(job);
+		}
+
+		void remove(const AVCodecContext* ctx) {
+			std::unique_lock<std::shared_mutex> lock(m_mutex);
+			m_jobs.erase(ctx);
+		}
+
+		std::shared_ptr<UTLX::Job> find(const AVCodecContext* ctx) const {
+			std::shared_lock<std::shared_mutex> lock(m_mutex);
+			const auto it = m_jobs.find(ctx);
+			return it != m_jobs.end() ? it->second : nullptr;
+		}
+
+	private:
+		mutable std::shared_mutex m_mutex;
+		std::unordered_map<const AVCodecContext*, std::shared_ptr<UTLX::Job>> m_jobs;
+	};
+
+	int execute(AVCodecContext* ctx, int (*func)(AVCodecContext*, void*), void* arg, int* ret, int count, int size) {
+		std::shared_ptr<UTLX::Job> job = Registry::get_instance().find(ctx);
+		if (!job) {
+			return avcodec_default_execute(ctx, func, arg, ret, count, size);
+		}
+
+		const unsigned runners = static_cast<unsigned>(std::max(ctx->thread_count, 1));
+		UTLX::Scheduler::get_instance().parallel_for(job, count, runners, [&](int index, unsigned) {
+			const int r = func(ctx, static_cast<char*>(arg) + static_cast<size_t>(index) * size);
+			if (ret) {
+				ret[index] = r;
+			}
+		});
+		return 0;
+	}
+
+	int execute2(AVCodecContext* ctx, int (*func)(AVCodecContext*, void*, int, int), void* arg, int* ret, int count) {
+		std::shared_ptr<UTLX::Job> job = Registry::get_instance().find(ctx);
+		if (!job) {
+			return avcodec_default_execute2(ctx, func, arg, ret, count);
+		}
+
+		// Codecs index per-thread scratch data by threadnr, so at most
+		// thread_count runners with distinct numbers may take part.
+		const unsigned runners = static_cast<unsigned>(std::max(ctx->thread_count, 1));
+		UTLX::Scheduler::get_instance().parallel_for(job, count, runners, [&](int index, unsigned runner) {
+			const int r = func(ctx, arg, index, static_cast<int>(runner));
+			if (ret) {
+				ret[index] = r;
+			}
+		});
+		return 0;
+	}
+}
+
+int FFPP::install_shared_execute(AVCodecContext* ctx, std::shared_ptr<UTLX::Job> job)
+{
+	if (!ctx || !avcodec_is_open(ctx)) {
+		return AVERROR(EINVAL);
+	}
+	if (!job) {
+		job = UTLX::Scheduler::get_instance().create_job(ctx->codec ? ctx->codec->name : "codec");
+	}
+
+	Registry::get_instance().add(ctx, std::move(job));
+	ctx->execute = &execute;
+	ctx->execute2 = &execute2;
+	return 0;
+}
+
+void FFPP::uninstall_shared_execute(AVCodecContext* ctx)
+{
+	Registry::get_instance().remove(ctx);
+}
@@ -0,0 +1,35 @@
+/*
+ * SharedExecute.h
+ *
+ * Runs libavcodec slice jobs on the shared UTLX::Scheduler.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_SHARED_EXECUTE
+#define FFMPEG_PLUS_PLUS_SHARED_EXECUTE
+
+#include <memory>
+
+#include "../../utils/Concurrency/Scheduler.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace FFPP {
+
+	/// <summary>
+	/// Replaces execute and execute2 of an opened codec context so that its
+	/// slice jobs run on the process-wide scheduler under job. A null job
+	/// creates one named after the codec. The context has to be opened with
+	/// Threading::Shared, which makes the codec split its work into
+	/// thread_count slices; libavcodec's own slice threads then stay idle.
+	/// </summary>
+	int install_shared_execute(AVCodecContext* ctx, std::shared_ptr<UTLX::Job> job = nullptr);
+
+	/// <summary>
+	/// Forgets ctx, call before freeing it.
+	/// </summary>
+	void uninstall_shared_execute(AVCodecContext* ctx);
+}
+
+#endif
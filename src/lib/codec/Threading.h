@@ -0,0 +1,64 @@
+/*
+ * Threading.h
+ *
+ * Threading configuration shared by the encoder and decoder wrappers.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_CODEC_THREADING
+#define FFMPEG_PLUS_PLUS_CODEC_THREADING
+
+#include <algorithm>
+#include <thread>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+namespace FFPP {
+
+	enum class Threading {
+		None,   // Single threaded
+		Frame,  // FF_THREAD_FRAME
+		Slice,  // FF_THREAD_SLICE
+		Auto,   // Let the codec pick among frame and slice threading
+		Shared, // FF_THREAD_SLICE with the slices run on the shared UTLX::Scheduler
+	};
+
+	/// <summary>
+	/// Number of threads to use when none is configured, capped like FFmpeg
+	/// caps its own automatic thread count.
+	/// </summary>
+	inline int auto_thread_count() {
+		const unsigned cpus = std::thread::hardware_concurrency();
+		return static_cast<int>(std::clamp(cpus, 1u, 16u));
+	}
+
+	/// <summary>
+	/// Sets thread_count and thread_type of ctx before avcodec_open2().
+	/// A thread_count of 0 leaves the choice to FFmpeg. Threading::Shared
+	/// additionally needs install_shared_execute() after avcodec_open2().
+	/// </summary>
+	inline void apply_threading(AVCodecContext* ctx, Threading threading, int thread_count) {
+		switch (threading) {
+			case Threading::None:
+				ctx->thread_count = 1;
+				ctx->thread_type = 0;
+				break;
+			case Threading::Frame:
+				ctx->thread_count = thread_count;
+				ctx->thread_type = FF_THREAD_FRAME;
+				break;
+			case Threading::Slice:
+			case Threading::Shared:
+				ctx->thread_count = thread_count;
+				ctx->thread_type = FF_THREAD_SLICE;
+				break;
+			case Threading::Auto:
+				ctx->thread_count = thread_count;
+				ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+				break;
+		}
+	}
+}
+
+#endif
\ No newline at end of file
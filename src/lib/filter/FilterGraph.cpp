@@ -0,0 +1,589 @@
+/*
+ * FilterGraph.cpp
+ *
+ * Filter graphs built once per input format and recycled between jobs.
+ */
+
+#include "FilterGraph.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string_view>
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	constexpr const char* SourceName = "ffpp_in";
+	constexpr const char* SinkName = "ffpp_out";
+
+	// Filters whose output depends on the current frame only and which hold
+	// nothing back, so a graph of them is empty once it asks for input.
+	constexpr std::string_view StatelessFilters[] = {
+		"buffer", "buffersink", "abuffer", "abuffersink",
+		"null", "anull", "copy", "format", "noformat", "aformat",
+		"scale", "crop", "pad", "setsar", "setdar", "setparams", "colorspace",
+		"hflip", "vflip", "transpose", "rotate", "drawbox", "lut", "lutyuv", "lutrgb", "eq",
+		"volume", "pan", "channelmap",
+	};
+
+	/// <summary>
+	/// Filters of a linear chain, split at the commas outside quotes. Labelled
+	/// pads and several chains are left in one piece.
+	/// </summary>
+	std::vector<std::string> split_chain(const std::string& description) {
+		if (description.find_first_of("[;") != std::string::npos) {
+			return { description };
+		}
+		std::vector<std::string> filters;
+		std::string filter;
+		bool quoted = false;
+		for (size_t i = 0; i < description.size(); i++) {
+			const char c = description[i];
+			if (c == '\\' && i + 1 < description.size()) {
+				filter += c;
+				filter += description[++i];
+				continue;
+			}
+			if (c == '\'') {
+				quoted = !quoted;
+			}
+			if (c == ',' && !quoted) {
+				filters.push_back(std::move(filter));
+				filter.clear();
+				continue;
+			}
+			filter += c;
+		}
+		filters.push_back(std::move(filter));
+		return filters;
+	}
+
+	/// <summary>
+	/// Runs the slice jobs of a filter on the scheduler job the graph's
+	/// opaque points to, serially while the graph sits in the cache.
+	/// </summary>
+	int execute(AVFilterContext* ctx, avfilter_action_func* func, void* arg, int* ret, int count) {
+		const auto* job = static_cast<const std::shared_ptr<UTLX::Job>*>(ctx->graph->opaque);
+		if (!job || !*job) {
+			for (int index = 0; index < count; index++) {
+				const int r = func(ctx, arg, index, count);
+				if (ret) {
+					ret[index] = r;
+				}
+			}
+			return 0;
+		}
+
+		const unsigned runners = static_cast<unsigned>(std::max(ctx->graph->nb_threads, 1));
+		UTLX::Scheduler::get_instance().parallel_for(*job, count, runners, [&](int index, unsigned) {
+			const int r = func(ctx, arg, index, count);
+			if (ret) {
+				ret[index] = r;
+			}
+		});
+		return 0;
+	}
+
+	/// <summary>
+	/// Idle configured graphs, keyed by description, input format and threading.
+	/// </summary>
+	class GraphCache {
+	public:
+		static GraphCache& get_instance() {
+			static GraphCache instance;
+			return instance;
+		}
+
+		FilterGraphHandle take(const std::string& key) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const auto it = m_graphs.find(key);
+			if (it == m_graphs.end()) {
+				return nullptr;
+			}
+			FilterGraphHandle graph = std::move(it->second.back());
+			it->second.pop_back();
+			if (it->second.empty()) {
+				m_graphs.erase(it);
+			}
+			return graph;
+		}
+
+		void put(const std::string& key, FilterGraphHandle graph, size_t limit) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::vector<FilterGraphHandle>& idle = m_graphs[key];
+			if (idle.size() < limit) {
+				idle.push_back(std::move(graph));
+			}
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::map<std::string, std::vector<FilterGraphHandle>> m_graphs;
+	};
+}
+
+FFPP::FilterGraph::FilterGraph(const Config& config)
+	: m_config(config)
+{
+	if (m_config.shared && !m_config.job) {
+		m_config.job = UTLX::Scheduler::get_instance().create_job("filtergraph");
+	}
+
+	const std::vector<std::string> filters = m_config.probe ? split_chain(m_config.description) : std::vector<std::string>();
+	if (filters.size() > 1) {
+		Config stage = m_config;
+		stage.probe = false;
+		for (const std::string& filter : filters) {
+			stage.description = filter;
+			m_stages.push_back(std::make_unique<FilterGraph>(stage));
+		}
+		m_transfer = make_frame();
+	}
+	else {
+		m_probe.name = m_config.description;
+		const MetricTags tags{ ObjectTraits<AVFilterGraph>::kind, m_probe.name.c_str() };
+		Metrics& metrics = Metrics::get_instance();
+		m_frames_in = &metrics.counter(tags, "frames_in");
+		m_frames_out = &metrics.counter(tags, "frames_out");
+		m_time = &metrics.counter(tags, "time_ns");
+	}
+}
+
+FFPP::FilterGraph::~FilterGraph()
+{
+	close();
+}
+
+int FFPP::FilterGraph::push(const AVFrame* frame)
+{
+	if (m_flushed) {
+		return AVERROR_EOF;
+	}
+	if (!m_stages.empty()) {
+		m_flushed = !frame;
+		const int ret = m_stages.front()->push(frame);
+		return ret < 0 ? ret : forward();
+	}
+	if (!frame) {
+		m_flushed = true;
+		if (!m_graph.graph) {
+			return 0;
+		}
+		return recyclable() ? drain() : send(nullptr, 0);
+	}
+
+	int ret = 0;
+	if (!m_graph.graph || !matches(frame)) {
+		if (m_graph.graph) {
+			m_stats.format_changes++;
+			ret = drain();
+			if (ret < 0) {
+				return ret;
+			}
+		}
+		ret = open(frame);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	ret = send(const_cast<AVFrame*>(frame), AV_BUFFERSRC_FLAG_KEEP_REF);
+	if (ret < 0) {
+		LOG_ERROR("FilterGraph: cannot feed frame\n");
+	}
+	return ret;
+}
+
+int FFPP::FilterGraph::pull(AVFrame* frame)
+{
+	if (!m_stages.empty()) {
+		return m_stages.back()->pull(frame);
+	}
+	if (!m_pending.empty()) {
+		av_frame_move_ref(frame, m_pending.front().get());
+		m_pending.pop_front();
+		return 0;
+	}
+	if (!m_graph.graph) {
+		return m_flushed ? AVERROR_EOF : AVERROR(EAGAIN);
+	}
+	return receive(frame);
+}
+
+int FFPP::FilterGraph::send_command(const std::string& target, const std::string& command, const std::string& arg)
+{
+	if (!m_stages.empty()) {
+		// Stages without a matching filter refuse the command.
+		int ret = AVERROR(ENOSYS);
+		for (const std::unique_ptr<FilterGraph>& stage : m_stages) {
+			if (stage->send_command(target, command, arg) >= 0) {
+				ret = 0;
+			}
+		}
+		m_stats.commands += ret >= 0;
+		return ret;
+	}
+
+	if (m_graph.graph) {
+		char response[256] = "";
+		const int ret = avfilter_graph_send_command(m_graph.graph.get(), target.c_str(), command.c_str(), arg.c_str(),
+			response, sizeof(response), 0);
+		if (ret < 0) {
+			if (ret != AVERROR(ENOSYS)) {
+				LOG_ERROR("FilterGraph: command " + command + " for " + target + " failed\n");
+			}
+			return ret;
+		}
+	}
+	m_commands.push_back(Command{ target, command, arg });
+	m_stats.commands++;
+	return 0;
+}
+
+FilterGraph::Stats FFPP::FilterGraph::stats() const
+{
+	Stats stats = m_stats;
+	for (const std::unique_ptr<FilterGraph>& stage : m_stages) {
+		const Stats stage_stats = stage->stats();
+		stats.builds += stage_stats.builds;
+		stats.reuses += stage_stats.reuses;
+		stats.format_changes += stage_stats.format_changes;
+	}
+	return stats;
+}
+
+std::vector<FilterGraph::FilterStats> FFPP::FilterGraph::filter_stats() const
+{
+	if (m_stages.empty()) {
+		return { m_probe };
+	}
+	std::vector<FilterStats> filters;
+	for (const std::unique_ptr<FilterGraph>& stage : m_stages) {
+		filters.push_back(stage->m_probe);
+	}
+	return filters;
+}
+
+bool FFPP::FilterGraph::matches(const AVFrame* frame) const
+{
+	const AVRational time_base = input_time_base(frame);
+	return frame->format == m_input.format && frame->width == m_input.width && frame->height == m_input.height
+		&& frame->sample_rate == m_input.sample_rate && frame->ch_layout.nb_channels == m_input.channels
+		&& av_cmp_q(frame->sample_aspect_ratio, m_input.sample_aspect_ratio) == 0
+		&& av_cmp_q(time_base, m_input.time_base) == 0
+		&& frame->colorspace == m_input.colorspace && frame->color_range == m_input.color_range;
+}
+
+AVRational FFPP::FilterGraph::input_time_base(const AVFrame* frame) const
+{
+	if (frame->time_base.num > 0) {
+		return frame->time_base;
+	}
+	if (m_config.time_base.num > 0) {
+		return m_config.time_base;
+	}
+	return frame->width > 0 ? AVRational{ 1, AV_TIME_BASE } : AVRational{ 1, frame->sample_rate };
+}
+
+std::string FFPP::FilterGraph::source_args(const AVFrame* frame) const
+{
+	const AVRational time_base = input_time_base(frame);
+	char args[256];
+	if (frame->width > 0) {
+		snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+			frame->width, frame->height, frame->format, time_base.num, time_base.den,
+			frame->sample_aspect_ratio.num, std::max(frame->sample_aspect_ratio.den, 1));
+	}
+	else {
+		char layout[64] = "";
+		av_channel_layout_describe(&frame->ch_layout, layout, sizeof(layout));
+		snprintf(args, sizeof(args), "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=%s",
+			time_base.num, time_base.den, frame->sample_rate,
+			av_get_sample_fmt_name(static_cast<AVSampleFormat>(frame->format)), layout);
+	}
+	return args;
+}
+
+unsigned FFPP::FilterGraph::threads() const
+{
+	if (m_config.nb_threads) {
+		return m_config.nb_threads;
+	}
+	if (m_config.job && m_config.job->cpu_budget()) {
+		return m_config.job->cpu_budget();
+	}
+	return std::max(1u, UTLX::Scheduler::get_instance().worker_count());
+}
+
+int FFPP::FilterGraph::open(const AVFrame* frame)
+{
+	const std::string args = source_args(frame);
+	std::string key = m_config.description + '\n' + args
+		+ "\ncolor=" + std::to_string(frame->colorspace) + '/' + std::to_string(frame->color_range)
+		+ "\nthreads=" + std::to_string(threads()) + (m_config.shared ? "s" : "");
+
+	FilterGraphHandle cached = m_config.recycle ? GraphCache::get_instance().take(key) : nullptr;
+	if (cached) {
+		m_graph.source = avfilter_graph_get_filter(cached.get(), SourceName);
+		m_graph.sink = avfilter_graph_get_filter(cached.get(), SinkName);
+		m_graph.graph = std::move(cached);
+		m_graph.stateless = true;               // Only stateless graphs are cached
+		m_stats.reuses++;
+	}
+	else {
+		const int ret = build(frame, args, m_graph);
+		if (ret < 0) {
+			return ret;
+		}
+		m_stats.builds++;
+	}
+	m_graph.graph->opaque = &m_config.job;
+	m_key = std::move(key);
+
+	m_input.format = frame->format;
+	m_input.width = frame->width;
+	m_input.height = frame->height;
+	m_input.sample_rate = frame->sample_rate;
+	m_input.channels = frame->ch_layout.nb_channels;
+	m_input.sample_aspect_ratio = frame->sample_aspect_ratio;
+	m_input.time_base = input_time_base(frame);
+	m_input.colorspace = frame->colorspace;
+	m_input.color_range = frame->color_range;
+
+	// Parameters changed on the previous graph carry over.
+	for (const Command& command : m_commands) {
+		avfilter_graph_send_command(m_graph.graph.get(), command.target.c_str(), command.command.c_str(),
+			command.arg.c_str(), nullptr, 0, 0);
+	}
+	return 0;
+}
+
+int FFPP::FilterGraph::build(const AVFrame* frame, const std::string& args, Graph& graph) const
+{
+	FilterGraphHandle handle(avfilter_graph_alloc());
+	if (!handle) {
+		return AVERROR(ENOMEM);
+	}
+
+	// Threading has to be set before any filter is added.
+	handle->nb_threads = static_cast<int>(threads());
+	handle->thread_type = AVFILTER_THREAD_SLICE;
+	if (m_config.shared) {
+		handle->execute = &execute;
+	}
+
+	const bool video = frame->width > 0;
+	AVFilterContext* source = avfilter_graph_alloc_filter(handle.get(), avfilter_get_by_name(video ? "buffer" : "abuffer"), SourceName);
+	if (!source) {
+		return AVERROR(ENOMEM);
+	}
+	int ret = 0;
+	if (video) {
+		AVBufferSrcParameters* params = av_buffersrc_parameters_alloc();
+		if (!params) {
+			return AVERROR(ENOMEM);
+		}
+		params->color_space = frame->colorspace;
+		params->color_range = frame->color_range;
+		ret = av_buffersrc_parameters_set(source, params);
+		av_free(params);
+	}
+	if (ret >= 0) {
+		ret = avfilter_init_str(source, args.c_str());
+	}
+	if (ret < 0) {
+		LOG_ERROR("FilterGraph: cannot create source with " + args + "\n");
+		return ret;
+	}
+
+	AVFilterContext* sink = nullptr;
+	ret = avfilter_graph_create_filter(&sink, avfilter_get_by_name(video ? "buffersink" : "abuffersink"), SinkName,
+		nullptr, nullptr, handle.get());
+	if (ret < 0) {
+		return ret;
+	}
+
+	AVFilterInOut* outputs = avfilter_inout_alloc();
+	AVFilterInOut* inputs = avfilter_inout_alloc();
+	if (!outputs || !inputs) {
+		avfilter_inout_free(&outputs);
+		avfilter_inout_free(&inputs);
+		return AVERROR(ENOMEM);
+	}
+	outputs->name = av_strdup("in");
+	outputs->filter_ctx = source;
+	inputs->name = av_strdup("out");
+	inputs->filter_ctx = sink;
+
+	ret = avfilter_graph_parse_ptr(handle.get(), m_config.description.c_str(), &inputs, &outputs, nullptr);
+	avfilter_inout_free(&outputs);
+	avfilter_inout_free(&inputs);
+	if (ret >= 0) {
+		ret = avfilter_graph_config(handle.get(), nullptr);
+	}
+	if (ret < 0) {
+		LOG_ERROR("FilterGraph: cannot configure '" + m_config.description + "'\n");
+		return ret;
+	}
+
+	graph.stateless = stateless(handle.get());
+	graph.graph = std::move(handle);
+	graph.source = source;
+	graph.sink = sink;
+	return 0;
+}
+
+bool FFPP::FilterGraph::stateless(const AVFilterGraph* graph)
+{
+	// Includes the filters libavfilter inserted for format negotiation.
+	for (unsigned i = 0; i < graph->nb_filters; i++) {
+		const std::string_view name = graph->filters[i]->filter->name;
+		if (std::find(std::begin(StatelessFilters), std::end(StatelessFilters), name) == std::end(StatelessFilters)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int FFPP::FilterGraph::send(AVFrame* frame, int flags)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const int ret = av_buffersrc_add_frame_flags(m_graph.source, frame, flags);
+	const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	m_probe.time += elapsed;
+	m_time->add(elapsed.count());
+	if (ret >= 0 && frame) {
+		m_probe.frames_in++;
+		m_frames_in->add(1);
+	}
+	return ret;
+}
+
+int FFPP::FilterGraph::receive(AVFrame* frame)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const int ret = av_buffersink_get_frame(m_graph.sink, frame);
+	const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	m_probe.time += elapsed;
+	m_time->add(elapsed.count());
+	if (ret >= 0) {
+		frame->time_base = av_buffersink_get_time_base(m_graph.sink);
+		m_probe.frames_out++;
+		m_frames_out->add(1);
+	}
+	return ret;
+}
+
+int FFPP::FilterGraph::forward()
+{
+	// Every stage hands on what it has before the next one runs.
+	for (size_t i = 0; i + 1 < m_stages.size(); i++) {
+		while (true) {
+			int ret = m_stages[i]->pull(m_transfer.get());
+			if (ret == AVERROR(EAGAIN)) {
+				break;
+			}
+			if (ret == AVERROR_EOF) {
+				ret = m_stages[i + 1]->push(nullptr);
+				if (ret < 0 && ret != AVERROR_EOF) {
+					return ret;
+				}
+				break;
+			}
+			if (ret < 0) {
+				return ret;
+			}
+			ret = m_stages[i + 1]->push(m_transfer.get());
+			av_frame_unref(m_transfer.get());
+			if (ret < 0) {
+				return ret;
+			}
+		}
+	}
+	return 0;
+}
+
+int FFPP::FilterGraph::collect()
+{
+	while (true) {
+		FrameHandle frame = make_frame();
+		if (!frame) {
+			return AVERROR(ENOMEM);
+		}
+		const int ret = receive(frame.get());
+		if (ret == AVERROR(EAGAIN)) {
+			return 0;
+		}
+		if (ret < 0) {
+			return ret;
+		}
+		m_pending.push_back(std::move(frame));
+	}
+}
+
+int FFPP::FilterGraph::drain()
+{
+	if (recyclable()) {
+		// Filters holding nothing back are empty once they ask for input,
+		// so the graph can serve a later input of its format without EOF.
+		const int ret = collect();
+		if (ret >= 0) {
+			release();
+		}
+		m_graph = Graph();
+		return ret;
+	}
+
+	int ret = send(nullptr, 0);
+	while (ret >= 0) {
+		FrameHandle frame = make_frame();
+		if (!frame) {
+			ret = AVERROR(ENOMEM);
+			break;
+		}
+		ret = receive(frame.get());
+		if (ret >= 0) {
+			m_pending.push_back(std::move(frame));
+		}
+	}
+
+	// A graph that saw EOF cannot take frames again.
+	m_graph = Graph();
+	return ret == AVERROR_EOF ? 0 : ret;
+}
+
+void FFPP::FilterGraph::release()
+{
+	m_graph.graph->opaque = nullptr;
+	GraphCache::get_instance().put(m_key, std::move(m_graph.graph), m_config.cache_size);
+	m_graph = Graph();
+}
+
+void FFPP::FilterGraph::close()
+{
+	if (!m_graph.graph) {
+		return;
+	}
+	if (recyclable()) {
+		// Frames the job did not pull are dropped rather than left for the next one.
+		FrameHandle frame = make_frame();
+		while (frame && av_buffersink_get_frame(m_graph.sink, frame.get()) >= 0) {
+			av_frame_unref(frame.get());
+		}
+		release();
+		return;
+	}
+	m_graph = Graph();
+}
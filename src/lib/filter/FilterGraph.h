@@ -0,0 +1,176 @@
+/*
+ * FilterGraph.h
+ *
+ * Filter graphs built once per input format and recycled between jobs.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_FILTER_GRAPH
+#define FFMPEG_PLUS_PLUS_FILTER_GRAPH
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../FFPPBase.h"
+#include "../FFPPHandle.h"
+#include "../util/Metrics.h"
+#include "../../utils/Concurrency/Scheduler.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// FilterGraph runs a single input, single output filter description
+	/// such as "scale=1280:720,format=yuv420p". The graph is built from the
+	/// first frame and whenever the input format changes. Configured graphs
+	/// are kept in a process-wide cache keyed by the description and the
+	/// input format, so a later job, or an input switching back to an
+	/// earlier resolution, takes a ready graph instead of parsing and
+	/// configuring a new one. Only graphs made entirely of filters known to
+	/// hold no frames or state between frames (scale, format, crop, pad, ...)
+	/// are recycled: they go back to the cache without EOF, at a format
+	/// change, at the end of input and on destruction, once every frame they
+	/// can produce without more input was pulled. Any other graph is flushed
+	/// with EOF and dropped. Slice threaded filters run their jobs on the shared
+	/// UTLX::Scheduler within the job's CPU budget. Time spent in the graph
+	/// and frames in and out are counted per filter with probing on, per
+	/// graph otherwise, and published to the Metrics registry. A FilterGraph
+	/// is used by one thread at a time.
+	/// </summary>
+	class FilterGraph : public FFPPBase<FilterGraph, AVFilterGraph> {
+	public:
+		struct Config {
+			std::string description;
+			AVRational time_base{ 0, 1 };        // Input timestamps, 0/1 takes frame->time_base
+			unsigned nb_threads = 0;              // 0 takes the job's CPU budget, or every scheduler worker
+			bool shared = true;                   // Slice jobs run on the shared UTLX::Scheduler
+			std::shared_ptr<UTLX::Job> job;       // Null creates one
+			bool recycle = true;                  // Applies to stateless graphs only, see stateless()
+			size_t cache_size = 4;                // Idle graphs kept per description and input format
+			bool probe = false;                   // Runs each filter of a linear chain as its own graph
+		};
+
+		struct Stats {
+			uint64_t builds = 0;                  // Graphs parsed and configured
+			uint64_t reuses = 0;                  // Graphs taken from the cache
+			uint64_t format_changes = 0;
+			uint64_t commands = 0;
+		};
+
+		/// <summary>
+		/// Work done by one filter, or by the whole graph without probing.
+		/// Time covers the buffersrc pushes and buffersink pulls, which is
+		/// where libavfilter runs the filters.
+		/// </summary>
+		struct FilterStats {
+			std::string name;                     // Filter description, e.g. "scale=1280:720"
+			uint64_t frames_in = 0;
+			uint64_t frames_out = 0;
+			std::chrono::nanoseconds time{ 0 };
+		};
+
+		explicit FilterGraph(const Config& config);
+		~FilterGraph();
+
+		FilterGraph(const FilterGraph&) = delete;
+		FilterGraph& operator=(const FilterGraph&) = delete;
+
+		/// <summary>
+		/// Graph in use, null before the first frame and when probing.
+		/// </summary>
+		AVFilterGraph* native() const noexcept { return m_graph.graph.get(); }
+
+		/// <summary>
+		/// Feeds a new reference to frame. A format change drains the current
+		/// graph, its remaining frames come out of pull() first. A null frame
+		/// flushes.
+		/// </summary>
+		int push(const AVFrame* frame);
+
+		/// <summary>
+		/// Takes the next filtered frame, its time_base set. Returns
+		/// AVERROR(EAGAIN) if more input is needed and AVERROR_EOF once
+		/// flushed.
+		/// </summary>
+		int pull(AVFrame* frame);
+
+		/// <summary>
+		/// Sends a command to the filters matching target through
+		/// avfilter_graph_send_command(), e.g. ("scale", "w", "640"). The
+		/// command is replayed on graphs set up for later format changes.
+		/// A graph that received commands is not recycled.
+		/// </summary>
+		int send_command(const std::string& target, const std::string& command, const std::string& arg);
+
+		Stats stats() const;
+
+		/// <summary>
+		/// One entry per filter when probing, else one for the graph.
+		/// </summary>
+		std::vector<FilterStats> filter_stats() const;
+
+	private:
+		struct Graph {
+			FilterGraphHandle graph;
+			AVFilterContext* source = nullptr;
+			AVFilterContext* sink = nullptr;
+			bool stateless = false;               // Every filter is on the recycling allowlist
+		};
+
+		struct Command {
+			std::string target;
+			std::string command;
+			std::string arg;
+		};
+
+		// Input format the current graph was configured for.
+		struct Input {
+			int format = -1;
+			int width = 0;
+			int height = 0;
+			int sample_rate = 0;
+			int channels = 0;
+			AVRational sample_aspect_ratio{ 0, 1 };
+			AVRational time_base{ 0, 1 };
+			AVColorSpace colorspace = AVCOL_SPC_UNSPECIFIED;
+			AVColorRange color_range = AVCOL_RANGE_UNSPECIFIED;
+		};
+
+		bool matches(const AVFrame* frame) const;
+		AVRational input_time_base(const AVFrame* frame) const;
+		std::string source_args(const AVFrame* frame) const;
+		unsigned threads() const;
+		int open(const AVFrame* frame);
+		int build(const AVFrame* frame, const std::string& args, Graph& graph) const;
+		int send(AVFrame* frame, int flags);
+		int receive(AVFrame* frame);
+		int forward();
+		int collect();
+		int drain();
+		void release();
+		void close();
+		bool recyclable() const { return m_config.recycle && m_graph.stateless && m_commands.empty(); }
+		static bool stateless(const AVFilterGraph* graph);
+
+		Config m_config;
+		Graph m_graph;
+		Input m_input;
+		std::string m_key;                        // Cache key of m_graph
+		std::vector<Command> m_commands;
+		std::deque<FrameHandle> m_pending;        // Drained from a replaced graph
+		bool m_flushed = false;
+		Stats m_stats;
+
+		// Probe points: filters running as stages of their own, fed in turn.
+		std::vector<std::unique_ptr<FilterGraph>> m_stages;
+		FrameHandle m_transfer;
+
+		FilterStats m_probe;
+		Metrics::Counter* m_frames_in = nullptr;
+		Metrics::Counter* m_frames_out = nullptr;
+		Metrics::Counter* m_time = nullptr;      // Nanoseconds
+	};
+}
+
+#endif
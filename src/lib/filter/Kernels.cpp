@@ -0,0 +1,280 @@
+/*
+ * Kernels.cpp
+ *
+ * SIMD pixel format conversions selected at runtime.
+ */
+
+#include "Kernels.h"
+
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/cpu.h>
+}
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FFPP_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define FFPP_KERNELS_X86 0
+#endif
+
+// MSVC compiles intrinsics of any level without per-function targets.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define FFPP_TARGET(isa)
+#else
+#define FFPP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace FFPP;
+
+namespace {
+
+	// Row functions. count is the number of samples written per output row.
+	struct Rows {
+		void (*deinterleave)(const uint8_t* src, uint8_t* u, uint8_t* v, int count);
+		void (*even_bytes)(const uint8_t* src, uint8_t* dst, int count);
+		void (*yuyv_chroma)(const uint8_t* src0, const uint8_t* src1, uint8_t* u, uint8_t* v, int count);
+	};
+
+	void deinterleave_c(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+		for (int i = 0; i < count; i++) {
+			u[i] = src[2 * i];
+			v[i] = src[2 * i + 1];
+		}
+	}
+
+	void even_bytes_c(const uint8_t* src, uint8_t* dst, int count) {
+		for (int i = 0; i < count; i++) {
+			dst[i] = src[2 * i];
+		}
+	}
+
+	// Chroma of two YUYV rows, averaged with rounding like pavgb.
+	void yuyv_chroma_c(const uint8_t* src0, const uint8_t* src1, uint8_t* u, uint8_t* v, int count) {
+		for (int i = 0; i < count; i++) {
+			u[i] = static_cast<uint8_t>((src0[4 * i + 1] + src1[4 * i + 1] + 1) >> 1);
+			v[i] = static_cast<uint8_t>((src0[4 * i + 3] + src1[4 * i + 3] + 1) >> 1);
+		}
+	}
+
+#if FFPP_KERNELS_X86
+	FFPP_TARGET("sse4.1")
+	void deinterleave_sse4(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+		const __m128i mask = _mm_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 16 <= count; i += 16) {
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(u + i), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(v + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+		}
+		deinterleave_c(src + 2 * i, u + i, v + i, count - i);
+	}
+
+	FFPP_TARGET("sse4.1")
+	void even_bytes_sse4(const uint8_t* src, uint8_t* dst, int count) {
+		const __m128i mask = _mm_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 16 <= count; i += 16) {
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+		}
+		even_bytes_c(src + 2 * i, dst + i, count - i);
+	}
+
+	FFPP_TARGET("sse4.1")
+	void yuyv_chroma_sse4(const uint8_t* src0, const uint8_t* src1, uint8_t* u, uint8_t* v, int count) {
+		const __m128i mask = _mm_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m128i rows[4];
+			for (int k = 0; k < 4; k++) {
+				const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 4 * i + 16 * k));
+				const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 4 * i + 16 * k));
+				rows[k] = _mm_srli_epi16(_mm_avg_epu8(a, b), 8);
+			}
+			const __m128i uv0 = _mm_packus_epi16(rows[0], rows[1]);
+			const __m128i uv1 = _mm_packus_epi16(rows[2], rows[3]);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(u + i), _mm_packus_epi16(_mm_and_si128(uv0, mask), _mm_and_si128(uv1, mask)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(v + i), _mm_packus_epi16(_mm_srli_epi16(uv0, 8), _mm_srli_epi16(uv1, 8)));
+		}
+		yuyv_chroma_c(src0 + 4 * i, src1 + 4 * i, u + i, v + i, count - i);
+	}
+
+	// 256 and 512 bit packs work per 128 bit lane; the permutes restore order.
+	FFPP_TARGET("avx2")
+	inline __m256i pack_avx2(__m256i a, __m256i b) {
+		return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+	}
+
+	FFPP_TARGET("avx2")
+	void deinterleave_avx2(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+		const __m256i mask = _mm256_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 32 <= count; i += 32) {
+			const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i));
+			const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i + 32));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(u + i), pack_avx2(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i), pack_avx2(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)));
+		}
+		deinterleave_sse4(src + 2 * i, u + i, v + i, count - i);
+	}
+
+	FFPP_TARGET("avx2")
+	void even_bytes_avx2(const uint8_t* src, uint8_t* dst, int count) {
+		const __m256i mask = _mm256_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 32 <= count; i += 32) {
+			const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i));
+			const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i + 32));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), pack_avx2(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)));
+		}
+		even_bytes_sse4(src + 2 * i, dst + i, count - i);
+	}
+
+	FFPP_TARGET("avx2")
+	void yuyv_chroma_avx2(const uint8_t* src0, const uint8_t* src1, uint8_t* u, uint8_t* v, int count) {
+		const __m256i mask = _mm256_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 32 <= count; i += 32) {
+			__m256i rows[4];
+			for (int k = 0; k < 4; k++) {
+				const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + 4 * i + 32 * k));
+				const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + 4 * i + 32 * k));
+				rows[k] = _mm256_srli_epi16(_mm256_avg_epu8(a, b), 8);
+			}
+			const __m256i uv0 = pack_avx2(rows[0], rows[1]);
+			const __m256i uv1 = pack_avx2(rows[2], rows[3]);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(u + i), pack_avx2(_mm256_and_si256(uv0, mask), _mm256_and_si256(uv1, mask)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i), pack_avx2(_mm256_srli_epi16(uv0, 8), _mm256_srli_epi16(uv1, 8)));
+		}
+		yuyv_chroma_sse4(src0 + 4 * i, src1 + 4 * i, u + i, v + i, count - i);
+	}
+
+	FFPP_TARGET("avx512f,avx512bw")
+	inline __m512i pack_avx512(__m512i a, __m512i b) {
+		const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+		return _mm512_permutexvar_epi64(order, _mm512_packus_epi16(a, b));
+	}
+
+	FFPP_TARGET("avx512f,avx512bw")
+	void deinterleave_avx512(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+		const __m512i mask = _mm512_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 64 <= count; i += 64) {
+			const __m512i a = _mm512_loadu_si512(src + 2 * i);
+			const __m512i b = _mm512_loadu_si512(src + 2 * i + 64);
+			_mm512_storeu_si512(u + i, pack_avx512(_mm512_and_si512(a, mask), _mm512_and_si512(b, mask)));
+			_mm512_storeu_si512(v + i, pack_avx512(_mm512_srli_epi16(a, 8), _mm512_srli_epi16(b, 8)));
+		}
+		deinterleave_avx2(src + 2 * i, u + i, v + i, count - i);
+	}
+
+	FFPP_TARGET("avx512f,avx512bw")
+	void even_bytes_avx512(const uint8_t* src, uint8_t* dst, int count) {
+		const __m512i mask = _mm512_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 64 <= count; i += 64) {
+			const __m512i a = _mm512_loadu_si512(src + 2 * i);
+			const __m512i b = _mm512_loadu_si512(src + 2 * i + 64);
+			_mm512_storeu_si512(dst + i, pack_avx512(_mm512_and_si512(a, mask), _mm512_and_si512(b, mask)));
+		}
+		even_bytes_avx2(src + 2 * i, dst + i, count - i);
+	}
+
+	FFPP_TARGET("avx512f,avx512bw")
+	void yuyv_chroma_avx512(const uint8_t* src0, const uint8_t* src1, uint8_t* u, uint8_t* v, int count) {
+		const __m512i mask = _mm512_set1_epi16(0x00FF);
+		int i = 0;
+		for (; i + 64 <= count; i += 64) {
+			__m512i rows[4];
+			for (int k = 0; k < 4; k++) {
+				const __m512i a = _mm512_loadu_si512(src0 + 4 * i + 64 * k);
+				const __m512i b = _mm512_loadu_si512(src1 + 4 * i + 64 * k);
+				rows[k] = _mm512_srli_epi16(_mm512_avg_epu8(a, b), 8);
+			}
+			const __m512i uv0 = pack_avx512(rows[0], rows[1]);
+			const __m512i uv1 = pack_avx512(rows[2], rows[3]);
+			_mm512_storeu_si512(u + i, pack_avx512(_mm512_and_si512(uv0, mask), _mm512_and_si512(uv1, mask)));
+			_mm512_storeu_si512(v + i, pack_avx512(_mm512_srli_epi16(uv0, 8), _mm512_srli_epi16(uv1, 8)));
+		}
+		yuyv_chroma_avx2(src0 + 4 * i, src1 + 4 * i, u + i, v + i, count - i);
+	}
+
+#endif
+
+	struct Isa {
+		const char* name;
+		Rows rows;
+	};
+
+	const Isa& isa() {
+		static const Isa selected = [] {
+			Isa isa{ "c", { deinterleave_c, even_bytes_c, yuyv_chroma_c } };
+#if FFPP_KERNELS_X86
+			const int flags = av_get_cpu_flags();
+			if (flags & AV_CPU_FLAG_SSE4) {
+				isa = { "sse4", { deinterleave_sse4, even_bytes_sse4, yuyv_chroma_sse4 } };
+			}
+			if ((flags & AV_CPU_FLAG_SSE4) && (flags & AV_CPU_FLAG_AVX2)) {
+				isa = { "avx2", { deinterleave_avx2, even_bytes_avx2, yuyv_chroma_avx2 } };
+			}
+			if ((flags & AV_CPU_FLAG_SSE4) && (flags & AV_CPU_FLAG_AVX2) && (flags & AV_CPU_FLAG_AVX512)) {
+				isa = { "avx512", { deinterleave_avx512, even_bytes_avx512, yuyv_chroma_avx512 } };
+			}
+#endif
+			return isa;
+		}();
+		return selected;
+	}
+
+	uint8_t* row(const AVFrame* frame, int plane, int y) {
+		return frame->data[plane] + static_cast<ptrdiff_t>(y) * frame->linesize[plane];
+	}
+
+	void nv12_to_yuv420p(AVFrame* dst, const AVFrame* src) {
+		const Rows& rows = isa().rows;
+		for (int y = 0; y < dst->height; y++) {
+			std::memcpy(row(dst, 0, y), row(src, 0, y), dst->width);
+		}
+		for (int y = 0; y < dst->height / 2; y++) {
+			rows.deinterleave(row(src, 1, y), row(dst, 1, y), row(dst, 2, y), dst->width / 2);
+		}
+	}
+
+	void yuyv422_to_yuv420p(AVFrame* dst, const AVFrame* src) {
+		const Rows& rows = isa().rows;
+		for (int y = 0; y < dst->height; y++) {
+			rows.even_bytes(row(src, 0, y), row(dst, 0, y), dst->width);
+		}
+		for (int y = 0; y < dst->height / 2; y++) {
+			rows.yuyv_chroma(row(src, 0, 2 * y), row(src, 0, 2 * y + 1), row(dst, 1, y), row(dst, 2, y), dst->width / 2);
+		}
+	}
+
+	const Kernel kernels[] = {
+		{ "nv12_to_yuv420p", AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P, &nv12_to_yuv420p },
+		{ "yuyv422_to_yuv420p", AV_PIX_FMT_YUYV422, AV_PIX_FMT_YUV420P, &yuyv422_to_yuv420p },
+	};
+}
+
+const Kernel* FFPP::find_kernel(AVPixelFormat src_format, AVPixelFormat dst_format, int width, int height)
+{
+	if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) {
+		return nullptr;
+	}
+	for (const Kernel& kernel : kernels) {
+		if (kernel.src_format == src_format && kernel.dst_format == dst_format) {
+			return &kernel;
+		}
+	}
+	return nullptr;
+}
+
+const char* FFPP::kernel_isa()
+{
+	return isa().name;
+}
\ No newline at end of file
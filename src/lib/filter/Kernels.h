@@ -0,0 +1,48 @@
+/*
+ * Kernels.h
+ *
+ * SIMD pixel format conversions selected at runtime.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_KERNELS
+#define FFMPEG_PLUS_PLUS_KERNELS
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+namespace FFPP {
+
+	/// <summary>
+	/// A same-size pixel format conversion. The kernels cover the conversions
+	/// that dominate our profiles and that swscale's unscaled converters do
+	/// by moving or averaging samples: NV12 and YUYV422 to YUV420P. Matrix
+	/// conversions and dithered bit depth reductions are left to swscale,
+	/// whose arithmetic a kernel cannot reproduce bit for bit. Row functions
+	/// come in C, SSE4, AVX2 and AVX-512 variants, picked once from
+	/// av_get_cpu_flags().
+	/// </summary>
+	struct Kernel {
+		typedef void (*Convert)(AVFrame* dst, const AVFrame* src);
+
+		const char* name;
+		AVPixelFormat src_format;
+		AVPixelFormat dst_format;
+		Convert convert;                          // dst needs buffers, width and height of src
+	};
+
+	/// <summary>
+	/// Kernel converting src_format to dst_format at width x height, null if
+	/// there is none. Kernels need even dimensions.
+	/// </summary>
+	const Kernel* find_kernel(AVPixelFormat src_format, AVPixelFormat dst_format, int width, int height);
+
+	/// <summary>
+	/// Instruction set the row functions were selected for: "c", "sse4",
+	/// "avx2" or "avx512".
+	/// </summary>
+	const char* kernel_isa();
+}
+
+#endif
\ No newline at end of file
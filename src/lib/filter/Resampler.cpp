@@ -0,0 +1,251 @@
+/*
+ * Resampler.cpp
+ *
+ * Audio resampling with reused buffers and re-chunked output.
+ */
+
+#include "Resampler.h"
+
+#include <algorithm>
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/samplefmt.h>
+}
+
+using namespace FFPP;
+
+FFPP::Resampler::Resampler()
+	: Resampler(Config())
+{
+}
+
+FFPP::Resampler::Resampler(const Config& config)
+	: m_config(config)
+{
+}
+
+FFPP::Resampler::~Resampler()
+{
+	av_channel_layout_uninit(&m_in_layout);
+}
+
+Resampler::Config FFPP::Resampler::for_encoder(const AVCodecContext* encoder)
+{
+	Config config;
+	config.sample_rate = encoder->sample_rate;
+	config.sample_format = encoder->sample_fmt;
+	if (encoder->ch_layout.order == AV_CHANNEL_ORDER_NATIVE) {
+		config.ch_layout = encoder->ch_layout;
+	}
+	else {
+		av_channel_layout_default(&config.ch_layout, encoder->ch_layout.nb_channels);
+	}
+	const bool variable = encoder->codec && (encoder->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE);
+	config.frame_size = variable ? 0 : encoder->frame_size;
+	return config;
+}
+
+int FFPP::Resampler::send(const AVFrame* frame)
+{
+	if (m_flushed) {
+		return AVERROR_EOF;
+	}
+	if (!frame) {
+		m_flushed = true;
+		return drain();
+	}
+	if (frame->nb_samples <= 0) {
+		return 0;
+	}
+
+	int ret = 0;
+	if (frame->sample_rate != m_in_rate || frame->format != m_in_format || av_channel_layout_compare(&frame->ch_layout, &m_in_layout)) {
+		ret = configure(frame);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	if (m_next_pts == AV_NOPTS_VALUE) {
+		const AVRational time_base = frame->time_base.num > 0 ? frame->time_base : AVRational{ 1, frame->sample_rate };
+		m_next_pts = frame->pts == AV_NOPTS_VALUE ? 0 : av_rescale_q(frame->pts, time_base, AVRational{ 1, m_config.sample_rate });
+	}
+	m_stats.input_frames++;
+
+	// Frames large enough on their own skip the copy into the batch.
+	if (!m_batch_count && frame->nb_samples >= m_config.batch_samples) {
+		ret = convert(frame->extended_data, frame->nb_samples);
+		return ret < 0 ? ret : 0;
+	}
+
+	const int channels = frame->ch_layout.nb_channels;
+	ret = m_batch.reserve(m_batch_count + frame->nb_samples, channels, m_in_format, m_batch_count);
+	if (ret < 0) {
+		return ret;
+	}
+	m_stats.reallocations += ret;
+	av_samples_copy(m_batch.data, frame->extended_data, m_batch_count, 0, frame->nb_samples, channels, m_in_format);
+	m_batch_count += frame->nb_samples;
+	return m_batch_count >= m_config.batch_samples ? convert_batch() : 0;
+}
+
+int FFPP::Resampler::receive(AVFrame* frame)
+{
+	const int available = m_fifo ? av_audio_fifo_size(m_fifo.get()) : 0;
+	int count = m_config.frame_size > 0 ? m_config.frame_size : available;
+	if (available < count) {
+		count = m_flushed ? available : 0;
+	}
+	if (!count) {
+		return m_flushed ? AVERROR_EOF : AVERROR(EAGAIN);
+	}
+
+	frame->nb_samples = count;
+	frame->format = m_config.sample_format;
+	frame->sample_rate = m_config.sample_rate;
+	int ret = av_channel_layout_copy(&frame->ch_layout, &m_config.ch_layout);
+	if (ret >= 0) {
+		ret = av_frame_get_buffer(frame, 0);
+	}
+	if (ret < 0) {
+		return ret;
+	}
+	if (av_audio_fifo_read(m_fifo.get(), reinterpret_cast<void**>(frame->extended_data), count) < count) {
+		return AVERROR_BUG;
+	}
+
+	frame->time_base = AVRational{ 1, m_config.sample_rate };
+	frame->pts = m_next_pts;
+	frame->duration = count;
+	m_next_pts += count;
+	return 0;
+}
+
+int FFPP::Resampler::configure(const AVFrame* frame)
+{
+	// Samples still held belong to the old input.
+	int ret = drain();
+	if (ret < 0) {
+		return ret;
+	}
+
+	const bool reconfigure = static_cast<bool>(m_swr);
+	SwrContext* swr = m_swr.release();
+	ret = swr_alloc_set_opts2(&swr, &m_config.ch_layout, m_config.sample_format, m_config.sample_rate,
+		&frame->ch_layout, static_cast<AVSampleFormat>(frame->format), frame->sample_rate, 0, nullptr);
+	m_swr.reset(swr);
+	if (ret >= 0) {
+		ret = swr_init(swr);
+	}
+	if (ret < 0) {
+		LOG_ERROR("Resampler: unsupported conversion\n");
+		m_swr.reset();
+		m_in_rate = 0;
+		return ret;
+	}
+
+	if (!m_fifo) {
+		m_fifo.reset(av_audio_fifo_alloc(m_config.sample_format, m_config.ch_layout.nb_channels,
+			std::max(m_config.frame_size, m_config.batch_samples) * 2));
+		if (!m_fifo) {
+			return AVERROR(ENOMEM);
+		}
+	}
+
+	m_in_rate = frame->sample_rate;
+	m_in_format = static_cast<AVSampleFormat>(frame->format);
+	av_channel_layout_uninit(&m_in_layout);
+	ret = av_channel_layout_copy(&m_in_layout, &frame->ch_layout);
+	if (ret < 0) {
+		return ret;
+	}
+	m_stats.reconfigurations += reconfigure;
+	return 0;
+}
+
+int FFPP::Resampler::convert(const uint8_t* const* input, int count)
+{
+	const int samples = swr_get_out_samples(m_swr.get(), count);
+	if (samples < 0) {
+		return samples;
+	}
+	int ret = m_output.reserve(std::max(samples, 1), m_config.ch_layout.nb_channels, m_config.sample_format, 0);
+	if (ret < 0) {
+		return ret;
+	}
+	m_stats.reallocations += ret;
+
+	const int converted = swr_convert(m_swr.get(), m_output.data, m_output.capacity, input, count);
+	if (converted < 0) {
+		LOG_ERROR("Resampler: conversion failed\n");
+		return converted;
+	}
+	m_stats.conversions += input != nullptr;
+	if (converted > 0 && av_audio_fifo_write(m_fifo.get(), reinterpret_cast<void**>(m_output.data), converted) < converted) {
+		return AVERROR(ENOMEM);
+	}
+	return converted;
+}
+
+int FFPP::Resampler::convert_batch()
+{
+	if (!m_batch_count) {
+		return 0;
+	}
+	const int ret = convert(m_batch.data, m_batch_count);
+	m_batch_count = 0;
+	return ret < 0 ? ret : 0;
+}
+
+int FFPP::Resampler::drain()
+{
+	if (!m_swr) {
+		return 0;
+	}
+	int ret = convert_batch();
+	while (ret >= 0) {
+		ret = convert(nullptr, 0);
+		if (ret == 0) {
+			break;
+		}
+	}
+	return ret < 0 ? ret : 0;
+}
+
+FFPP::Resampler::Samples::~Samples()
+{
+	if (data) {
+		av_freep(&data[0]);
+	}
+	av_freep(&data);
+}
+
+int FFPP::Resampler::Samples::reserve(int samples, int channels, AVSampleFormat format, int keep)
+{
+	if (samples <= capacity && channels == this->channels && format == this->format) {
+		return 0;
+	}
+
+	const int grown = format == this->format && channels == this->channels ? std::max(samples, capacity * 2) : samples;
+	uint8_t** grown_data = nullptr;
+	const int ret = av_samples_alloc_array_and_samples(&grown_data, nullptr, channels, grown, format, 0);
+	if (ret < 0) {
+		return ret;
+	}
+	if (keep > 0) {
+		av_samples_copy(grown_data, data, 0, 0, keep, channels, format);
+	}
+
+	if (data) {
+		av_freep(&data[0]);
+	}
+	av_freep(&data);
+	data = grown_data;
+	capacity = grown;
+	this->channels = channels;
+	this->format = format;
+	return 1;
+}
@@ -0,0 +1,110 @@
+/*
+ * Resampler.h
+ *
+ * Audio resampling with reused buffers and re-chunked output.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_RESAMPLER
+#define FFMPEG_PLUS_PLUS_RESAMPLER
+
+#include <cstdint>
+
+#include "../FFPPHandle.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Resampler converts audio frames to one sample rate, channel layout and
+	/// sample format with an SwrContext. Small input frames are gathered into
+	/// batches before conversion, converted samples go into an AVAudioFifo
+	/// and leave in frames of exactly frame_size samples, as encoders without
+	/// variable frame size need. Conversion buffers are kept across calls and
+	/// only grow. When the input rate, layout or format changes, the delayed
+	/// samples are drained and the same context is reconfigured. A Resampler
+	/// is used by one thread at a time.
+	/// </summary>
+	class Resampler {
+	public:
+		struct Config {
+			int sample_rate = 48000;
+			AVSampleFormat sample_format = AV_SAMPLE_FMT_FLTP;
+			AVChannelLayout ch_layout = AV_CHANNEL_LAYOUT_STEREO;  // Native order only
+			int frame_size = 1024;                // Samples per output frame, 0 passes on what is converted
+			int batch_samples = 1024;             // Smaller input frames are gathered up to this
+		};
+
+		struct Stats {
+			uint64_t input_frames = 0;
+			uint64_t conversions = 0;             // swr_convert() calls with input
+			uint64_t reconfigurations = 0;
+			uint64_t reallocations = 0;           // Growth of the batch and output buffers
+		};
+
+		Resampler();
+		explicit Resampler(const Config& config);
+		~Resampler();
+
+		Resampler(const Resampler&) = delete;
+		Resampler& operator=(const Resampler&) = delete;
+
+		/// <summary>
+		/// Config matching what encoder expects, frame_size included.
+		/// </summary>
+		static Config for_encoder(const AVCodecContext* encoder);
+
+		/// <summary>
+		/// Takes the samples of frame. The pts of the first frame, in
+		/// frame->time_base or 1/sample_rate if that is unset, starts the
+		/// output timeline; later output follows the sample count. A null
+		/// frame flushes: the batch and the context are drained and the last,
+		/// shorter, frame is released. Returns AVERROR_EOF after a flush.
+		/// </summary>
+		int send(const AVFrame* frame);
+
+		/// <summary>
+		/// Fills frame with the next output frame, pts in 1/sample_rate.
+		/// Returns AVERROR(EAGAIN) if more input is needed and AVERROR_EOF
+		/// once everything is drained after a flush.
+		/// </summary>
+		int receive(AVFrame* frame);
+
+		Stats stats() const { return m_stats; }
+
+	private:
+		// Planar or packed samples allocated by av_samples_alloc().
+		struct Samples {
+			~Samples();
+
+			// Returns 1 if the buffer was replaced, keeping its first keep samples.
+			int reserve(int samples, int channels, AVSampleFormat format, int keep);
+
+			uint8_t** data = nullptr;
+			int capacity = 0;
+			int channels = 0;
+			AVSampleFormat format = AV_SAMPLE_FMT_NONE;
+		};
+
+		int configure(const AVFrame* frame);
+		int convert(const uint8_t* const* input, int count);
+		int convert_batch();
+		int drain();
+
+		Config m_config;
+		SwrContextHandle m_swr;
+		AudioFifoHandle m_fifo;
+
+		// Input the context is configured for.
+		int m_in_rate = 0;
+		AVSampleFormat m_in_format = AV_SAMPLE_FMT_NONE;
+		AVChannelLayout m_in_layout{};
+
+		Samples m_batch;                          // Input, in the configured input format
+		int m_batch_count = 0;
+		Samples m_output;
+		int64_t m_next_pts = AV_NOPTS_VALUE;      // 1/sample_rate
+		bool m_flushed = false;
+		Stats m_stats;
+	};
+}
+
+#endif
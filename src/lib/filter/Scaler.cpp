@@ -0,0 +1,300 @@
+/*
+ * Scaler.cpp
+ *
+ * Scaling and pixel format conversion with cached SwsContexts.
+ */
+
+#include "Scaler.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <cstring>
+
+#include "../util/BufferPools.h"
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+using namespace FFPP;
+
+FFPP::Scaler::Scaler()
+	: Scaler(Config())
+{
+}
+
+FFPP::Scaler::Scaler(const Config& config)
+	: m_config(config)
+{
+}
+
+int FFPP::Scaler::scale(AVFrame* dst, const AVFrame* src)
+{
+	if (!dst || !src || dst->width <= 0 || dst->height <= 0 || dst->format < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	const Key key = key_for(dst, src);
+	Entry* entry = find(key);
+	const bool created = !entry;
+	if (!entry) {
+		m_stats.misses++;
+		m_entries.push_front(Entry{ key, {} });
+		m_index[key] = m_entries.begin();
+		entry = &m_entries.front();
+		while (m_entries.size() > std::max<size_t>(1, m_config.cache_size)) {
+			m_index.erase(m_entries.back().key);
+			m_entries.pop_back();
+			m_stats.evictions++;
+		}
+	}
+	else {
+		m_stats.hits++;
+	}
+
+	unsigned runners = 1;
+	if (static_cast<int64_t>(dst->width) * dst->height >= m_config.slice_threshold) {
+		runners = m_config.max_slices ? m_config.max_slices : UTLX::Scheduler::get_instance().worker_count();
+		runners = std::max(1u, runners);
+	}
+	int ret = prepare(*entry, runners);
+	if (ret < 0) {
+		return ret;
+	}
+	if (created && m_config.kernels && src->width == dst->width && src->height == dst->height) {
+		const Kernel* kernel = find_kernel(static_cast<AVPixelFormat>(src->format),
+			static_cast<AVPixelFormat>(dst->format), dst->width, dst->height);
+		if (kernel) {
+			verify_kernel(*entry, kernel);
+		}
+	}
+
+	if (!dst->buf[0]) {
+		ret = BufferPools::get_instance().get_video_buffer(dst);
+		if (ret == AVERROR(ENOSYS)) {
+			ret = av_frame_get_buffer(dst, 0);
+		}
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	// The requested colour properties are part of the conversion, keep them.
+	const AVColorSpace colorspace = dst->colorspace;
+	const AVColorRange color_range = dst->color_range;
+	ret = av_frame_copy_props(dst, src);
+	if (ret < 0) {
+		return ret;
+	}
+	if (colorspace != AVCOL_SPC_UNSPECIFIED) {
+		dst->colorspace = colorspace;
+	}
+	if (color_range != AVCOL_RANGE_UNSPECIFIED) {
+		dst->color_range = color_range;
+	}
+
+	const bool kernel = entry->kernel != nullptr;
+	const auto start = std::chrono::steady_clock::now();
+	if (kernel) {
+		entry->kernel->convert(dst, src);
+	}
+	else {
+		ret = runners > 1
+			? scale_sliced(*entry, dst, src, runners)
+			: sws_scale_frame(entry->contexts[0].get(), dst, src);
+	}
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+	if (ret < 0) {
+		LOG_ERROR("Scaler: conversion failed\n");
+		return ret;
+	}
+	PairStats& pair = m_pairs[key];
+	if (!pair.frames) {
+		pair.src_width = src->width;
+		pair.src_height = src->height;
+		pair.src_format = static_cast<AVPixelFormat>(src->format);
+		pair.dst_width = dst->width;
+		pair.dst_height = dst->height;
+		pair.dst_format = static_cast<AVPixelFormat>(dst->format);
+	}
+	if (kernel) {
+		pair.kernel = entry->kernel->name;
+	}
+	pair.frames++;
+	pair.sliced_frames += !kernel && runners > 1;
+	pair.time += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+	return 0;
+}
+
+void FFPP::Scaler::clear()
+{
+	m_index.clear();
+	m_entries.clear();
+}
+
+std::vector<Scaler::PairStats> FFPP::Scaler::pair_stats() const
+{
+	std::vector<PairStats> pairs;
+	for (const auto& [key, pair] : m_pairs) {
+		pairs.push_back(pair);
+	}
+	return pairs;
+}
+
+Scaler::Key FFPP::Scaler::key_for(const AVFrame* dst, const AVFrame* src)
+{
+	return Key(src->width, src->height, src->format, src->colorspace, src->color_range,
+		dst->width, dst->height, dst->format, dst->colorspace, dst->color_range);
+}
+
+Scaler::Entry* FFPP::Scaler::find(const Key& key)
+{
+	const auto it = m_index.find(key);
+	if (it == m_index.end()) {
+		return nullptr;
+	}
+	m_entries.splice(m_entries.begin(), m_entries, it->second);
+	return &m_entries.front();
+}
+
+int FFPP::Scaler::prepare(Entry& entry, size_t count)
+{
+	const auto& [src_w, src_h, src_fmt, src_space, src_range, dst_w, dst_h, dst_fmt, dst_space, dst_range] = entry.key;
+
+	while (entry.contexts.size() < count) {
+		SwsContextHandle ctx(sws_getContext(src_w, src_h, static_cast<AVPixelFormat>(src_fmt),
+			dst_w, dst_h, static_cast<AVPixelFormat>(dst_fmt), m_config.flags, nullptr, nullptr, nullptr));
+		if (!ctx) {
+			LOG_ERROR("Scaler: unsupported conversion\n");
+			return AVERROR(EINVAL);
+		}
+
+		// SWS_CS_* match the AVColorSpace values; RGB sides ignore these.
+		const int* src_coeffs = sws_getCoefficients(src_space == AVCOL_SPC_UNSPECIFIED ? SWS_CS_DEFAULT : src_space);
+		const int* dst_coeffs = dst_space == AVCOL_SPC_UNSPECIFIED ? src_coeffs : sws_getCoefficients(dst_space);
+		sws_setColorspaceDetails(ctx.get(), src_coeffs, src_range == AVCOL_RANGE_JPEG,
+			dst_coeffs, (dst_range == AVCOL_RANGE_UNSPECIFIED ? src_range : dst_range) == AVCOL_RANGE_JPEG,
+			0, 1 << 16, 1 << 16);
+
+		entry.contexts.push_back(std::move(ctx));
+	}
+	return 0;
+}
+
+int FFPP::Scaler::scale_sliced(Entry& entry, AVFrame* dst, const AVFrame* src, unsigned runners)
+{
+	UTLX::Scheduler& scheduler = UTLX::Scheduler::get_instance();
+	if (!m_config.job) {
+		m_config.job = scheduler.create_job("scaler");
+	}
+
+	// Bands are multiples of the alignment swscale needs for output slices.
+	const int align = std::max(1u, sws_receive_slice_alignment(entry.contexts[0].get()));
+	int band = (dst->height + static_cast<int>(runners) - 1) / static_cast<int>(runners);
+	band = (band + align - 1) / align * align;
+	const int count = (dst->height + band - 1) / band;
+
+	std::atomic<int> error = 0;
+	scheduler.parallel_for(m_config.job, count, runners, [&](int index, unsigned runner) {
+		SwsContext* ctx = entry.contexts[runner].get();
+		const int y = index * band;
+		int ret = sws_frame_start(ctx, dst, src);
+		if (ret >= 0) {
+			ret = sws_send_slice(ctx, 0, src->height);
+		}
+		if (ret >= 0) {
+			ret = sws_receive_slice(ctx, y, std::min(band, dst->height - y));
+		}
+		sws_frame_end(ctx);
+		if (ret < 0) {
+			error = ret;
+		}
+	});
+	return error;
+}
+
+void FFPP::Scaler::verify_kernel(Entry& entry, const Kernel* kernel)
+{
+	const auto& [width, height, src_fmt, src_space, src_range, dst_w, dst_h, dst_fmt, dst_space, dst_range] = entry.key;
+
+	FrameHandle pattern(av_frame_alloc());
+	FrameHandle reference(av_frame_alloc());
+	FrameHandle check(av_frame_alloc());
+	if (!pattern || !reference || !check) {
+		return;
+	}
+	pattern->format = src_fmt;
+	pattern->colorspace = static_cast<AVColorSpace>(src_space);
+	pattern->color_range = static_cast<AVColorRange>(src_range);
+	for (AVFrame* frame : { reference.get(), check.get() }) {
+		frame->format = dst_fmt;
+		frame->colorspace = static_cast<AVColorSpace>(dst_space);
+		frame->color_range = static_cast<AVColorRange>(dst_range);
+	}
+	for (AVFrame* frame : { pattern.get(), reference.get(), check.get() }) {
+		frame->width = width;
+		frame->height = height;
+		if (av_frame_get_buffer(frame, 0) < 0) {
+			return;
+		}
+	}
+
+	// A hash of the position visits every code value of every plane, at
+	// both parities of x and y, and across vertical neighbours.
+	const AVPixelFormat src_format = static_cast<AVPixelFormat>(src_fmt);
+	const AVPixFmtDescriptor* src_desc = av_pix_fmt_desc_get(src_format);
+	for (int plane = 0; plane < av_pix_fmt_count_planes(src_format); plane++) {
+		const int bytes = av_image_get_linesize(src_format, width, plane);
+		const int rows = plane == 1 || plane == 2 ? AV_CEIL_RSHIFT(height, src_desc->log2_chroma_h) : height;
+		for (int y = 0; y < rows; y++) {
+			uint8_t* line = pattern->data[plane] + static_cast<ptrdiff_t>(y) * pattern->linesize[plane];
+			for (int x = 0; x < bytes; x++) {
+				uint32_t h = static_cast<uint32_t>(x) * 0x9E3779B1u ^ static_cast<uint32_t>(y) * 0x85EBCA77u ^ static_cast<uint32_t>(plane) * 0xC2B2AE3Du;
+				h ^= h >> 15;
+				h *= 0x2C1B3C6Du;
+				h ^= h >> 12;
+				line[x] = static_cast<uint8_t>(h);
+			}
+		}
+	}
+
+	// Both paths run a few times; the best times make up the pair's comparison.
+	constexpr int Runs = 3;
+	auto swscale_time = std::chrono::steady_clock::duration::max();
+	auto kernel_time = std::chrono::steady_clock::duration::max();
+	for (int run = 0; run < Runs; run++) {
+		auto start = std::chrono::steady_clock::now();
+		if (sws_scale_frame(entry.contexts[0].get(), reference.get(), pattern.get()) < 0) {
+			return;
+		}
+		swscale_time = std::min(swscale_time, std::chrono::steady_clock::now() - start);
+
+		start = std::chrono::steady_clock::now();
+		kernel->convert(check.get(), pattern.get());
+		kernel_time = std::min(kernel_time, std::chrono::steady_clock::now() - start);
+	}
+
+	PairStats& pair = m_pairs[entry.key];
+	pair.swscale_time = std::chrono::duration_cast<std::chrono::nanoseconds>(swscale_time);
+	pair.kernel_time = std::chrono::duration_cast<std::chrono::nanoseconds>(kernel_time);
+
+	const AVPixelFormat dst_format = static_cast<AVPixelFormat>(dst_fmt);
+	const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(dst_format);
+	for (int plane = 0; plane < av_pix_fmt_count_planes(dst_format); plane++) {
+		const int bytes = av_image_get_linesize(dst_format, width, plane);
+		const int rows = plane == 1 || plane == 2 ? AV_CEIL_RSHIFT(height, dst_desc->log2_chroma_h) : height;
+		for (int y = 0; y < rows; y++) {
+			if (std::memcmp(reference->data[plane] + static_cast<ptrdiff_t>(y) * reference->linesize[plane],
+				check->data[plane] + static_cast<ptrdiff_t>(y) * check->linesize[plane], bytes)) {
+				LOG_WARN(std::string("Scaler: ") + kernel->name + " differs from swscale, keeping swscale\n");
+				return;
+			}
+		}
+	}
+
+	entry.kernel = kernel;
+}
@@ -0,0 +1,131 @@
+/*
+ * Scaler.h
+ *
+ * Scaling and pixel format conversion with cached SwsContexts.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_SCALER
+#define FFMPEG_PLUS_PLUS_SCALER
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "Kernels.h"
+#include "../FFPPHandle.h"
+#include "../../utils/Concurrency/Scheduler.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Scaler converts frames with SwsContexts kept in an LRU cache keyed by
+	/// source and destination geometry, format, colour space and range, so
+	/// inputs that change size back and forth do not rebuild contexts. Large
+	/// frames are split into horizontal bands of the output, each converted
+	/// by its own context through sws_send_slice()/sws_receive_slice() as a
+	/// task of the shared UTLX::Scheduler. Same-size conversions with a SIMD
+	/// kernel (see Kernels.h) first convert a synthetic frame holding every
+	/// code value at every row and column parity through both paths, with
+	/// the pair's flags, colour space and range; the kernel takes over only
+	/// if its output matches swscale bit for bit. A Scaler is used by one
+	/// thread at a time.
+	/// </summary>
+	class Scaler {
+	public:
+		struct Config {
+			size_t cache_size = 8;                // Conversions kept
+			int flags = SWS_BICUBIC;
+			int64_t slice_threshold = 1920 * 1080;  // Output pixels from which frames are sliced
+			unsigned max_slices = 0;              // 0 uses every scheduler worker
+			bool kernels = true;                  // Use verified SIMD kernels where available
+			std::shared_ptr<UTLX::Job> job;       // Null creates one
+		};
+
+		struct Stats {
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+			uint64_t evictions = 0;
+		};
+
+		/// <summary>
+		/// Throughput of one conversion pair.
+		/// </summary>
+		struct PairStats {
+			int src_width = 0;
+			int src_height = 0;
+			AVPixelFormat src_format = AV_PIX_FMT_NONE;
+			int dst_width = 0;
+			int dst_height = 0;
+			AVPixelFormat dst_format = AV_PIX_FMT_NONE;
+			const char* kernel = nullptr;         // Kernel converting the pair, null for swscale
+			uint64_t frames = 0;
+			uint64_t sliced_frames = 0;
+			std::chrono::nanoseconds time{ 0 };
+
+			// Best of a few conversions of the verification frame by each path,
+			// zero if the pair has no kernel.
+			std::chrono::nanoseconds kernel_time{ 0 };
+			std::chrono::nanoseconds swscale_time{ 0 };
+
+			double frames_per_second() const {
+				return time.count() ? frames * 1e9 / static_cast<double>(time.count()) : 0.0;
+			}
+
+			double kernel_speedup() const {
+				return kernel_time.count() ? swscale_time.count() / static_cast<double>(kernel_time.count()) : 0.0;
+			}
+		};
+
+		Scaler();
+		explicit Scaler(const Config& config);
+
+		Scaler(const Scaler&) = delete;
+		Scaler& operator=(const Scaler&) = delete;
+
+		/// <summary>
+		/// Converts src into dst, which needs width, height and format set.
+		/// Picture buffers are taken from the shared BufferPools if dst has
+		/// none. Properties such as pts are copied from src.
+		/// </summary>
+		int scale(AVFrame* dst, const AVFrame* src);
+
+		/// <summary>
+		/// Drops all cached contexts.
+		/// </summary>
+		void clear();
+
+		Stats stats() const { return m_stats; }
+
+		/// <summary>
+		/// Throughput of every conversion pair seen, including evicted ones.
+		/// </summary>
+		std::vector<PairStats> pair_stats() const;
+
+	private:
+		// Source width, height, format, colour space, range, then the same for the destination.
+		typedef std::tuple<int, int, int, int, int, int, int, int, int, int> Key;
+
+		struct Entry {
+			Key key;
+			std::vector<SwsContextHandle> contexts;  // One per slice runner
+			const Kernel* kernel = nullptr;       // Set once verified against swscale
+		};
+
+		static Key key_for(const AVFrame* dst, const AVFrame* src);
+		Entry* find(const Key& key);
+		int prepare(Entry& entry, size_t count);
+		int scale_sliced(Entry& entry, AVFrame* dst, const AVFrame* src, unsigned runners);
+		void verify_kernel(Entry& entry, const Kernel* kernel);
+
+		Config m_config;
+		std::list<Entry> m_entries;               // Most recently used first
+		std::map<Key, std::list<Entry>::iterator> m_index;
+		std::map<Key, PairStats> m_pairs;
+		Stats m_stats;
+	};
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+/*
+ * AsyncOutput.cpp
+ *
+ * Output AVIOContext queueing positional writes to a background thread.
+ */
+
+#include "AsyncOutput.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "../../utils/Logging/Logger.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+using namespace FFPP;
+
+FFPP::AsyncOutput::AsyncOutput()
+	: AsyncOutput(Config())
+{
+}
+
+FFPP::AsyncOutput::AsyncOutput(const Config& config)
+	: m_config(config)
+{
+}
+
+FFPP::AsyncOutput::~AsyncOutput()
+{
+	close();
+}
+
+int FFPP::AsyncOutput::open(const std::string& path)
+{
+	close();
+
+#ifdef _WIN32
+	const std::filesystem::path native_path(path);
+	HANDLE file = CreateFileW(native_path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		LOG_ERROR("AsyncOutput: could not create " + path + "\n");
+		return AVERROR(EIO);
+	}
+	m_file = file;
+#else
+	m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (m_fd < 0) {
+		LOG_ERROR("AsyncOutput: could not create " + path + "\n");
+		return AVERROR(errno);
+	}
+#endif
+
+	m_blocks.clear();
+	m_free.clear();
+	for (size_t i = 0; i < std::max<size_t>(m_config.blocks, 2); i++) {
+		auto block = std::make_unique<Block>();
+		block->data = std::make_unique<uint8_t[]>(m_config.block_size);
+		m_free.push_back(block.get());
+		m_blocks.push_back(std::move(block));
+	}
+
+	uint8_t* buffer = static_cast<uint8_t*>(av_malloc(m_config.buffer_size));
+	if (!buffer) {
+		close_file();
+		return AVERROR(ENOMEM);
+	}
+	m_io.reset(avio_alloc_context(buffer, static_cast<int>(m_config.buffer_size), 1, this,
+		nullptr, &AsyncOutput::write_packet, &AsyncOutput::seek));
+	if (!m_io) {
+		av_free(buffer);
+		close_file();
+		return AVERROR(ENOMEM);
+	}
+
+	m_current = nullptr;
+	m_pos = 0;
+	m_size = 0;
+	m_stop = false;
+	m_stats = Stats();
+	m_error = 0;
+	m_writer = std::thread(&AsyncOutput::run, this);
+	return 0;
+}
+
+int FFPP::AsyncOutput::flush()
+{
+	if (!m_io) {
+		return AVERROR(EINVAL);
+	}
+
+	avio_flush(m_io.get());
+	submit();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_in_flight == 0; });
+	return m_error;
+}
+
+int FFPP::AsyncOutput::close()
+{
+	if (!m_writer.joinable()) {
+		return m_error;
+	}
+
+	const int ret = flush();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_work.notify_one();
+	m_writer.join();
+
+	m_io.reset();
+	close_file();
+	return ret;
+}
+
+FFPP::AsyncOutput::Stats FFPP::AsyncOutput::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+int FFPP::AsyncOutput::write_packet(void* opaque, const uint8_t* buf, int buf_size)
+{
+	auto* self = static_cast<AsyncOutput*>(opaque);
+	if (const int error = self->m_error.load(std::memory_order_acquire)) {
+		return error;
+	}
+
+	size_t left = static_cast<size_t>(buf_size);
+	while (left > 0) {
+		// Only data continuing the current block may be appended to it.
+		Block* block = self->m_current;
+		if (block && (block->offset + static_cast<int64_t>(block->size) != self->m_pos
+			|| block->size == self->m_config.block_size)) {
+			self->submit();
+			block = nullptr;
+		}
+		if (!block) {
+			block = self->m_current = self->acquire();
+			block->offset = self->m_pos;
+			block->size = 0;
+		}
+
+		const size_t size = std::min(left, self->m_config.block_size - block->size);
+		std::memcpy(block->data.get() + block->size, buf, size);
+		block->size += size;
+		buf += size;
+		left -= size;
+		self->m_pos += size;
+		self->m_size = std::max(self->m_size, self->m_pos);
+	}
+	return buf_size;
+}
+
+int64_t FFPP::AsyncOutput::seek(void* opaque, int64_t offset, int whence)
+{
+	auto* self = static_cast<AsyncOutput*>(opaque);
+	int64_t pos = 0;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return self->m_size;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = self->m_pos + offset;
+		break;
+	case SEEK_END:
+		pos = self->m_size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+	if (pos < 0) {
+		return AVERROR(EINVAL);
+	}
+	self->m_pos = pos;
+	return pos;
+}
+
+FFPP::AsyncOutput::Block* FFPP::AsyncOutput::acquire()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_free.empty()) {
+		const auto start = std::chrono::steady_clock::now();
+		m_done.wait(lock, [this] { return !m_free.empty(); });
+		m_stats.blocked += std::chrono::steady_clock::now() - start;
+	}
+	Block* block = m_free.back();
+	m_free.pop_back();
+	return block;
+}
+
+void FFPP::AsyncOutput::submit()
+{
+	Block* block = std::exchange(m_current, nullptr);
+	if (!block) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (block->size == 0) {
+			m_free.push_back(block);
+			return;
+		}
+		m_pending.push_back(block);
+		m_in_flight++;
+		m_stats.max_pending = std::max(m_stats.max_pending, m_pending.size());
+	}
+	m_work.notify_one();
+}
+
+void FFPP::AsyncOutput::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_work.wait(lock, [this] { return !m_pending.empty() || m_stop; });
+		if (m_pending.empty()) {
+			break;
+		}
+
+		// One writer applies blocks in order, so overlapping patches land last.
+		Block* block = m_pending.front();
+		m_pending.pop_front();
+		lock.unlock();
+
+		const int ret = m_error ? 0 : write_at(block->data.get(), block->size, block->offset);
+		if (ret < 0) {
+			LOG_ERROR("AsyncOutput: write failed\n");
+			m_error = ret;
+		}
+
+		lock.lock();
+		m_stats.writes++;
+		m_stats.bytes += block->size;
+		m_free.push_back(block);
+		m_in_flight--;
+		m_done.notify_all();
+	}
+}
+
+int FFPP::AsyncOutput::write_at(const uint8_t* data, size_t size, int64_t offset)
+{
+	while (size > 0) {
+#ifdef _WIN32
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		DWORD written = 0;
+		const DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+		if (!WriteFile(static_cast<HANDLE>(m_file), data, chunk, &written, &overlapped) || written == 0) {
+			return AVERROR(EIO);
+		}
+#else
+		const ssize_t written = pwrite(m_fd, data, size, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return AVERROR(errno);
+		}
+		if (written == 0) {
+			return AVERROR(EIO);
+		}
+#endif
+		data += written;
+		size -= written;
+		offset += written;
+	}
+	return 0;
+}
+
+void FFPP::AsyncOutput::close_file()
+{
+#ifdef _WIN32
+	if (m_file) {
+		CloseHandle(static_cast<HANDLE>(m_file));
+	}
+	m_file = nullptr;
+#else
+	if (m_fd >= 0) {
+		::close(m_fd);
+	}
+	m_fd = -1;
+#endif
+}
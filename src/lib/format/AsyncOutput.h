@@ -0,0 +1,127 @@
+/*
+ * AsyncOutput.h
+ *
+ * Output AVIOContext queueing positional writes to a background thread.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_ASYNC_OUTPUT
+#define FFMPEG_PLUS_PLUS_ASYNC_OUTPUT
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../FFPPHandle.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// AsyncOutput provides an AVIOContext whose write and seek callbacks
+	/// return without touching the disk. Written data is gathered into a fixed
+	/// set of preallocated blocks, each tagged with its file offset, and a
+	/// writer thread applies them with positional writes in submission order.
+	/// Seeking only moves the logical position, so muxers patching earlier
+	/// data (MP4 moov sizes, MKV cues and seek heads) see the same result as
+	/// with synchronous I/O. When every block is in flight the callbacks wait,
+	/// which bounds memory and propagates back-pressure to the muxer.
+	/// </summary>
+	class AsyncOutput {
+	public:
+		struct Config {
+			size_t block_size = 1024 * 1024;
+			size_t blocks = 16;
+			size_t buffer_size = 64 * 1024;       // AVIO buffer in front of the blocks
+		};
+
+		struct Stats {
+			uint64_t writes = 0;                  // Positional writes issued
+			uint64_t bytes = 0;
+			size_t max_pending = 0;               // Blocks queued at once
+			std::chrono::nanoseconds blocked{ 0 };  // Callbacks waiting for a free block
+		};
+
+		AsyncOutput();
+		explicit AsyncOutput(const Config& config);
+		~AsyncOutput();
+
+		AsyncOutput(const AsyncOutput&) = delete;
+		AsyncOutput& operator=(const AsyncOutput&) = delete;
+
+		/// <summary>
+		/// Creates or truncates path and starts the writer thread.
+		/// </summary>
+		int open(const std::string& path);
+
+		/// <summary>
+		/// Flushes the AVIO buffer and waits for every queued write.
+		/// Returns the first write error.
+		/// </summary>
+		int flush();
+
+		/// <summary>
+		/// Flushes, stops the writer and closes the file.
+		/// </summary>
+		int close();
+
+		/// <summary>
+		/// The context to pass to Muxer::set_io(), owned by this object.
+		/// </summary>
+		AVIOContext* context() const { return m_io.get(); }
+
+		int error() const { return m_error.load(std::memory_order_acquire); }
+
+		Stats stats() const;
+
+	private:
+		struct Block {
+			std::unique_ptr<uint8_t[]> data;
+			size_t size = 0;
+			int64_t offset = 0;
+		};
+
+		static int write_packet(void* opaque, const uint8_t* buf, int buf_size);
+		static int64_t seek(void* opaque, int64_t offset, int whence);
+
+		Block* acquire();
+		void submit();
+		void run();
+		int write_at(const uint8_t* data, size_t size, int64_t offset);
+		void close_file();
+
+		Config m_config;
+		IOContextHandle m_io;
+
+		// Only touched from the callbacks.
+		Block* m_current = nullptr;
+		int64_t m_pos = 0;
+		int64_t m_size = 0;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_work;           // Signals the writer
+		std::condition_variable m_done;           // Signals the callbacks and flush()
+		std::vector<std::unique_ptr<Block>> m_blocks;
+		std::vector<Block*> m_free;
+		std::deque<Block*> m_pending;
+		size_t m_in_flight = 0;                   // Pending plus the one being written
+		bool m_stop = false;
+		Stats m_stats;
+
+		std::thread m_writer;
+		std::atomic<int> m_error = 0;
+
+#ifdef _WIN32
+		void* m_file = nullptr;
+#else
+		int m_fd = -1;
+#endif
+	};
+}
+
+#endif
\ No newline at end of file
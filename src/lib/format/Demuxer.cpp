@@ -0,0 +1,452 @@
+/*
+ * Demuxer.cpp
+ *
+ * Demuxer reading packets ahead on its own thread.
+ */
+
+#include "Demuxer.h"
+
+#include <thread>
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+}
+
+using namespace FFPP;
+
+FFPP::Demuxer::Demuxer()
+	: Demuxer(Config())
+{
+}
+
+FFPP::Demuxer::Demuxer(const Config& config)
+	: m_config(config)
+{
+}
+
+FFPP::Demuxer::~Demuxer()
+{
+	stop();
+	clear_queues();
+}
+
+int FFPP::Demuxer::open(const std::string& url, AVDictionary** options, const AVInputFormat* format)
+{
+	return open_input(url.c_str(), nullptr, options, format);
+}
+
+int FFPP::Demuxer::open(AVIOContext* io, AVDictionary** options, const AVInputFormat* format)
+{
+	return io ? open_input("", io, options, format) : AVERROR(EINVAL);
+}
+
+int FFPP::Demuxer::open_input(const char* url, AVIOContext* io, AVDictionary** options, const AVInputFormat* format)
+{
+	stop();
+	clear_queues();
+	m_queues.clear();
+	m_ctx.reset();
+
+	if (io) {
+		m_ctx.reset(avformat_alloc_context());
+		if (!m_ctx) {
+			return AVERROR(ENOMEM);
+		}
+		m_ctx->pb = io;
+		m_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+
+	// On failure avformat_open_input frees the context itself.
+	AVFormatContext* ctx = m_ctx.release();
+	int ret = avformat_open_input(&ctx, url, format, options);
+	m_ctx.reset(ctx);
+	if (ret < 0) {
+		LOG_ERROR(std::string("Demuxer: could not open ") + (io ? "custom I/O" : url) + "\n");
+		return ret;
+	}
+	ret = avformat_find_stream_info(m_ctx.get(), nullptr);
+	if (ret < 0) {
+		LOG_ERROR("Demuxer: could not find stream info\n");
+		return ret;
+	}
+
+	for (unsigned i = 0; i < m_ctx->nb_streams; i++) {
+		m_ctx->streams[i]->discard = AVDISCARD_ALL;
+		m_queues.emplace_back(std::make_unique<StreamQueue>(m_config.max_packets));
+	}
+	m_status = 0;
+	return 0;
+}
+
+bool FFPP::Demuxer::select(int stream_index)
+{
+	if (m_reader.joinable() || stream_index < 0 || stream_index >= static_cast<int>(m_queues.size())) {
+		return false;
+	}
+	m_ctx->streams[stream_index]->discard = AVDISCARD_DEFAULT;
+	m_queues[stream_index]->selected = true;
+	return true;
+}
+
+int FFPP::Demuxer::select_best(AVMediaType type)
+{
+	if (!m_ctx) {
+		return AVERROR(EINVAL);
+	}
+	const int index = av_find_best_stream(m_ctx.get(), type, -1, -1, nullptr, 0);
+	if (index >= 0 && !select(index)) {
+		return AVERROR(EINVAL);
+	}
+	return index;
+}
+
+const AVStream* FFPP::Demuxer::stream(int stream_index) const
+{
+	if (!m_ctx || stream_index < 0 || stream_index >= static_cast<int>(m_ctx->nb_streams)) {
+		return nullptr;
+	}
+	return m_ctx->streams[stream_index];
+}
+
+int FFPP::Demuxer::start()
+{
+	if (!m_ctx || m_reader.joinable()) {
+		return AVERROR(EINVAL);
+	}
+	m_stop = false;
+	m_reader = std::thread(&Demuxer::run, this);
+	return 0;
+}
+
+void FFPP::Demuxer::stop()
+{
+	m_stop = true;
+	wake_all();
+	if (m_reader.joinable()) {
+		m_reader.join();
+	}
+}
+
+bool FFPP::Demuxer::try_read(int stream_index, PooledPacketHandle& packet)
+{
+	if (stream_index < 0 || stream_index >= static_cast<int>(m_queues.size())) {
+		return false;
+	}
+	return pop(*m_queues[stream_index], packet);
+}
+
+int FFPP::Demuxer::read(int stream_index, PooledPacketHandle& packet)
+{
+	if (stream_index < 0 || stream_index >= static_cast<int>(m_queues.size())
+		|| !m_queues[stream_index]->selected) {
+		return AVERROR(EINVAL);
+	}
+
+	StreamQueue& queue = *m_queues[stream_index];
+	while (true) {
+		const uint64_t produced = queue.produced.load(std::memory_order_acquire);
+		if (pop(queue, packet)) {
+			return 0;
+		}
+		if (const int status = m_status.load(std::memory_order_acquire)) {
+			// The reader may have pushed its last packet before finishing.
+			return pop(queue, packet) ? 0 : status;
+		}
+		if (!m_reader.joinable()) {
+			return AVERROR(EINVAL);
+		}
+		add_waiter(queue);
+		queue.produced.wait(produced, std::memory_order_acquire);
+		queue.waiters.fetch_sub(1);
+	}
+}
+
+int FFPP::Demuxer::wait_any()
+{
+	const auto queued = [this] {
+		for (const auto& queue : m_queues) {
+			if (queue->selected && !queue->ring.empty()) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	while (true) {
+		const uint64_t produced = m_produced.load(std::memory_order_acquire);
+		if (queued()) {
+			return 0;
+		}
+		if (const int status = m_status.load(std::memory_order_acquire)) {
+			return queued() ? 0 : status;
+		}
+		if (!m_reader.joinable()) {
+			return AVERROR(EINVAL);
+		}
+		for (auto& queue : m_queues) {
+			if (queue->selected) {
+				add_waiter(*queue);
+			}
+		}
+		m_produced.wait(produced, std::memory_order_acquire);
+		for (auto& queue : m_queues) {
+			if (queue->selected) {
+				queue->waiters.fetch_sub(1);
+			}
+		}
+	}
+}
+
+int FFPP::Demuxer::poll(int stream_index, PooledPacketHandle& packet)
+{
+	if (stream_index < 0 || stream_index >= static_cast<int>(m_queues.size())
+		|| !m_queues[stream_index]->selected) {
+		return AVERROR(EINVAL);
+	}
+
+	StreamQueue& queue = *m_queues[stream_index];
+	if (pop(queue, packet)) {
+		return 0;
+	}
+	if (const int status = m_status.load(std::memory_order_acquire)) {
+		return pop(queue, packet) ? 0 : status;
+	}
+	return m_reader.joinable() ? AVERROR(EAGAIN) : AVERROR(EINVAL);
+}
+
+int FFPP::Demuxer::seek(int64_t timestamp, int flags)
+{
+	if (!m_ctx) {
+		return AVERROR(EINVAL);
+	}
+
+	const bool running = m_reader.joinable();
+	stop();
+	clear_queues();
+
+	const int ret = avformat_seek_file(m_ctx.get(), -1, INT64_MIN, timestamp, timestamp, flags);
+	if (ret < 0) {
+		LOG_ERROR("Demuxer: seek failed\n");
+	}
+	m_status = 0;
+	if (running) {
+		start();
+	}
+	return ret;
+}
+
+int FFPP::Demuxer::seek(const KeyframeIndex& index, int stream_index, int64_t pts)
+{
+	if (!m_ctx) {
+		return AVERROR(EINVAL);
+	}
+
+	const bool running = m_reader.joinable();
+	stop();
+	clear_queues();
+
+	const int ret = index.seek(m_ctx.get(), stream_index, pts);
+	m_status = 0;
+	if (running) {
+		start();
+	}
+	return ret;
+}
+
+FFPP::Demuxer::StreamStats FFPP::Demuxer::stats(int stream_index) const
+{
+	StreamStats stats;
+	if (stream_index >= 0 && stream_index < static_cast<int>(m_queues.size())) {
+		const StreamQueue& queue = *m_queues[stream_index];
+		stats.packets = queue.ring.size() + queue.overflowed.load(std::memory_order_relaxed);
+		stats.bytes = queue.bytes.load(std::memory_order_relaxed);
+		stats.duration = queue.duration.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+void FFPP::Demuxer::run()
+{
+	PacketHandlePool& pool = PacketHandlePool::get_instance();
+
+	int status = 0;
+	while (!m_stop) {
+		AVPacket* packet = pool.acquire();
+		if (!packet) {
+			status = AVERROR(ENOMEM);
+			break;
+		}
+
+		const int ret = av_read_frame(m_ctx.get(), packet);
+		if (ret == AVERROR(EAGAIN)) {
+			pool.release(packet);
+			std::this_thread::yield();
+			continue;
+		}
+		if (ret < 0) {
+			pool.release(packet);
+			status = ret;
+			break;
+		}
+
+		const int index = packet->stream_index;
+		if (index < 0 || index >= static_cast<int>(m_queues.size()) || !m_queues[index]->selected) {
+			pool.release(packet); // e.g. a stream added mid-file
+			continue;
+		}
+
+		StreamQueue& queue = *m_queues[index];
+		const AVStream* st = m_ctx->streams[index];
+		const int64_t duration = packet->duration > 0
+			? av_rescale_q(packet->duration, st->time_base, AV_TIME_BASE_Q)
+			: 0;
+
+		// Wait for the consumer while the queue is over its limits.
+		while (!m_stop) {
+			const uint64_t consumed = m_consumed.load(std::memory_order_acquire);
+			flush_overflow();
+			if (!must_wait(queue)) {
+				break;
+			}
+			m_consumed.wait(consumed, std::memory_order_acquire);
+		}
+		if (m_stop) {
+			pool.release(packet);
+			break;
+		}
+
+		queue.bytes.fetch_add(packet->size, std::memory_order_relaxed);
+		queue.duration.fetch_add(duration, std::memory_order_relaxed);
+		if (!queue.overflow.empty() || !queue.ring.try_push(packet)) {
+			queue.overflow.push_back(packet);
+			queue.overflowed.store(queue.overflow.size(), std::memory_order_relaxed);
+			continue;
+		}
+		publish(queue);
+	}
+
+	// The consumer sees the end only after the overflow went into the rings.
+	while (!m_stop) {
+		const uint64_t consumed = m_consumed.load(std::memory_order_acquire);
+		flush_overflow();
+		bool pending = false;
+		for (const auto& queue : m_queues) {
+			pending = pending || !queue->overflow.empty();
+		}
+		if (!pending) {
+			break;
+		}
+		m_consumed.wait(consumed, std::memory_order_acquire);
+	}
+
+	m_status = status ? status : AVERROR_EXIT;
+	wake_all();
+}
+
+bool FFPP::Demuxer::must_wait(const StreamQueue& queue) const
+{
+	const bool over = queue.ring.size() + queue.overflow.size() >= queue.ring.capacity()
+		|| queue.bytes.load(std::memory_order_relaxed) >= m_config.max_bytes
+		|| queue.duration.load(std::memory_order_relaxed) >= m_config.max_duration;
+	if (!over) {
+		return false;
+	}
+	if (queue.overflow.size() >= m_config.max_overflow) {
+		return true;
+	}
+
+	// Keep reading if a consumer is blocked on another empty queue, otherwise both would wait.
+	for (const auto& other : m_queues) {
+		if (other.get() != &queue && other->selected && other->waiters.load() > 0
+			&& other->ring.empty() && other->overflow.empty()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void FFPP::Demuxer::flush_overflow()
+{
+	for (auto& queue : m_queues) {
+		bool moved = false;
+		while (!queue->overflow.empty() && queue->ring.try_push(queue->overflow.front())) {
+			queue->overflow.pop_front();
+			moved = true;
+		}
+		if (moved) {
+			queue->overflowed.store(queue->overflow.size(), std::memory_order_relaxed);
+			publish(*queue);
+		}
+	}
+}
+
+void FFPP::Demuxer::publish(StreamQueue& queue)
+{
+	queue.produced.fetch_add(1, std::memory_order_release);
+	queue.produced.notify_all();
+	m_produced.fetch_add(1, std::memory_order_release);
+	m_produced.notify_all();
+}
+
+bool FFPP::Demuxer::pop(StreamQueue& queue, PooledPacketHandle& packet)
+{
+	const std::optional<AVPacket*> item = queue.ring.try_pop();
+	if (!item) {
+		return false;
+	}
+	AVPacket* raw = *item;
+
+	const AVStream* st = m_ctx->streams[raw->stream_index];
+	const int64_t duration = raw->duration > 0
+		? av_rescale_q(raw->duration, st->time_base, AV_TIME_BASE_Q)
+		: 0;
+	queue.bytes.fetch_sub(raw->size, std::memory_order_relaxed);
+	queue.duration.fetch_sub(duration, std::memory_order_relaxed);
+	packet.reset(raw);
+
+	m_consumed.fetch_add(1, std::memory_order_release);
+	m_consumed.notify_one();
+	return true;
+}
+
+void FFPP::Demuxer::clear_queues()
+{
+	PooledPacketHandle packet;
+	for (auto& queue : m_queues) {
+		while (pop(*queue, packet)) {
+			packet.reset();
+		}
+		// Only called with the reader stopped.
+		for (AVPacket* raw : queue->overflow) {
+			packet.reset(raw);
+		}
+		queue->overflow.clear();
+		queue->overflowed = 0;
+		packet.reset();
+		queue->bytes = 0;
+		queue->duration = 0;
+	}
+}
+
+void FFPP::Demuxer::wake_all()
+{
+	m_consumed.fetch_add(1, std::memory_order_release);
+	m_consumed.notify_all();
+	m_produced.fetch_add(1, std::memory_order_release);
+	m_produced.notify_all();
+	for (auto& queue : m_queues) {
+		queue->produced.fetch_add(1, std::memory_order_release);
+		queue->produced.notify_all();
+	}
+}
+
+void FFPP::Demuxer::add_waiter(StreamQueue& queue)
+{
+	// The reader may be parked over a full queue; it has to see the waiter.
+	queue.waiters.fetch_add(1);
+	m_consumed.fetch_add(1, std::memory_order_release);
+	m_consumed.notify_all();
+}
@@ -0,0 +1,167 @@
+/*
+ * Demuxer.h
+ *
+ * Demuxer reading packets ahead on its own thread.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_DEMUXER
+#define FFMPEG_PLUS_PLUS_DEMUXER
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../FFPPBase.h"
+#include "../FFPPHandle.h"
+#include "../../utils/Concurrency/SpscQueue.h"
+#include "KeyframeIndex.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Demuxer runs av_read_frame() on a read-ahead thread and distributes the
+	/// packets into one lock-free queue per selected stream. Streams that are
+	/// not selected are set to AVDISCARD_ALL and never parsed. Each queue is
+	/// limited by bytes and by duration; a full queue stalls reading unless
+	/// a consumer is blocked on another, empty selected queue. Then its
+	/// packets wait in an overflow list on the reader side, up to
+	/// max_overflow, so a consumer blocked on a sparse stream does not
+	/// deadlock against a busy one.
+	/// </summary>
+	class Demuxer : public FFPPBase<Demuxer, AVFormatContext> {
+	public:
+		struct Config {
+			size_t max_bytes = 16 * 1024 * 1024;  // Per stream
+			int64_t max_duration = 4000000;       // Per stream, in AV_TIME_BASE units
+			size_t max_packets = 1024;            // Per stream hard limit
+			size_t max_overflow = 4096;           // Per stream packets beyond the limits while another stream starves
+		};
+
+		struct StreamStats {
+			size_t packets = 0;
+			size_t bytes = 0;
+			int64_t duration = 0;                 // AV_TIME_BASE units
+		};
+
+		Demuxer();
+		explicit Demuxer(const Config& config);
+		~Demuxer();
+
+		Demuxer(const Demuxer&) = delete;
+		Demuxer& operator=(const Demuxer&) = delete;
+
+		AVFormatContext* native() const noexcept { return m_ctx.get(); }
+
+		/// <summary>
+		/// Opens url and probes its streams. All streams start out discarded.
+		/// </summary>
+		int open(const std::string& url, AVDictionary** options = nullptr, const AVInputFormat* format = nullptr);
+
+		/// <summary>
+		/// Opens a custom I/O context such as MappedInput::context(). io is
+		/// not owned and has to outlive the demuxer.
+		/// </summary>
+		int open(AVIOContext* io, AVDictionary** options = nullptr, const AVInputFormat* format = nullptr);
+
+		/// <summary>
+		/// Marks a stream as consumed. Must be called before start().
+		/// </summary>
+		bool select(int stream_index);
+
+		/// <summary>
+		/// Selects and returns the best stream of the given type, or a negative error.
+		/// </summary>
+		int select_best(AVMediaType type);
+
+		const AVStream* stream(int stream_index) const;
+
+		/// <summary>
+		/// Starts the read-ahead thread.
+		/// </summary>
+		int start();
+
+		/// <summary>
+		/// Stops the read-ahead thread, queued packets are kept.
+		/// </summary>
+		void stop();
+
+		/// <summary>
+		/// Takes the next packet of a stream if one is queued. Never blocks.
+		/// </summary>
+		bool try_read(int stream_index, PooledPacketHandle& packet);
+
+		/// <summary>
+		/// Like read() but never blocks: returns AVERROR(EAGAIN) while the
+		/// queue is empty and the reader is still going.
+		/// </summary>
+		int poll(int stream_index, PooledPacketHandle& packet);
+
+		/// <summary>
+		/// Waits for the next packet of a stream. Returns AVERROR_EOF once the
+		/// input is exhausted and the queue drained, or the read error.
+		/// </summary>
+		int read(int stream_index, PooledPacketHandle& packet);
+
+		/// <summary>
+		/// Waits until a packet of any selected stream is queued and returns 0,
+		/// or the reader's status once the input is exhausted and every queue
+		/// drained. For consumers of several streams, which must not block on
+		/// one stream while the others fill up.
+		/// </summary>
+		int wait_any();
+
+		/// <summary>
+		/// Seeks to timestamp (AV_TIME_BASE units), dropping queued packets.
+		/// </summary>
+		int seek(int64_t timestamp, int flags = 0);
+
+		/// <summary>
+		/// Seeks to the keyframe of stream_index at or before pts (stream time
+		/// base) recorded in index, dropping queued packets. Returns the
+		/// keyframe's position in the index.
+		/// </summary>
+		int seek(const KeyframeIndex& index, int stream_index, int64_t pts);
+
+		StreamStats stats(int stream_index) const;
+
+	private:
+		struct StreamQueue {
+			// Waiting spans several queues, so only the non-blocking calls are used.
+			explicit StreamQueue(size_t capacity) : ring(capacity, UTLX::WaitMode::Spin) {}
+
+			UTLX::SpscQueue<AVPacket*> ring;
+			std::atomic<size_t> bytes = 0;
+			std::atomic<int64_t> duration = 0;
+			std::atomic<uint64_t> produced = 0;   // Wakes up the consumer
+			std::deque<AVPacket*> overflow;       // Reader only, ahead of the ring
+			std::atomic<size_t> overflowed = 0;   // overflow.size() for other threads
+			std::atomic<int> waiters = 0;         // Consumers blocked on the queue
+			bool selected = false;
+		};
+
+		int open_input(const char* url, AVIOContext* io, AVDictionary** options, const AVInputFormat* format);
+		void run();
+		bool must_wait(const StreamQueue& queue) const;
+		void flush_overflow();
+		void publish(StreamQueue& queue);
+		bool pop(StreamQueue& queue, PooledPacketHandle& packet);
+		void clear_queues();
+		void wake_all();
+		void add_waiter(StreamQueue& queue);
+
+		Config m_config;
+		FormatInputHandle m_ctx;
+		std::vector<std::unique_ptr<StreamQueue>> m_queues;
+
+		std::thread m_reader;
+		std::atomic<bool> m_stop = false;
+		std::atomic<int> m_status = 0;            // AVERROR_EOF or read error once done
+		std::atomic<uint64_t> m_consumed = 0;     // Wakes up the reader
+		std::atomic<uint64_t> m_produced = 0;     // Any stream, wakes up wait_any()
+	};
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+/*
+ * KeyframeIndex.cpp
+ *
+ * Keyframe positions of every stream, gathered without decoding.
+ */
+
+#include "KeyframeIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <type_traits>
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	// Sidecar layout: FileHeader, stream_count FileStreams, then the
+	// Keyframe records of all streams. Every part is 8 byte aligned.
+	constexpr char Magic[8] = { 'F', 'F', 'P', 'P', 'K', 'F', 'I', 0 };
+	constexpr uint32_t Version = 1;
+
+	struct FileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t stream_count;
+		int64_t source_size;
+		int64_t source_time;
+	};
+
+	struct FileStream {
+		int32_t time_base_num;
+		int32_t time_base_den;
+		int64_t start;
+		int64_t end;
+		uint64_t packets;
+		uint64_t first_keyframe;
+		uint64_t keyframe_count;
+	};
+
+	static_assert(sizeof(FileHeader) == 32 && sizeof(FileStream) == 48);
+	static_assert(sizeof(KeyframeIndex::Keyframe) == 32 && std::is_trivially_copyable_v<KeyframeIndex::Keyframe>,
+		"Keyframes are used in place from the mapped sidecar");
+
+	bool byte_seekable(const AVInputFormat* format) {
+		if (format->flags & AVFMT_NO_BYTE_SEEK) {
+			return false;
+		}
+		const std::string_view name = format->name;
+		for (const std::string_view seekable : { "mpegts", "mpeg", "mpegvideo", "h264", "hevc", "aac", "mp3", "ac3" }) {
+			if (name == seekable) {
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+int FFPP::KeyframeIndex::open(const std::string& url)
+{
+	std::error_code error;
+	const std::filesystem::path path(url);
+	const uintmax_t size = std::filesystem::file_size(path, error);
+	const auto time = error ? std::filesystem::file_time_type() : std::filesystem::last_write_time(path, error);
+	if (error) {
+		return build(url);
+	}
+	const int64_t source_size = static_cast<int64_t>(size);
+	const int64_t source_time = static_cast<int64_t>(time.time_since_epoch().count());
+
+	const std::string sidecar = sidecar_path(url);
+	if (std::filesystem::exists(sidecar, error) && load(sidecar) >= 0
+		&& m_source_size == source_size && m_source_time == source_time) {
+		return 0;
+	}
+
+	const int ret = build(url);
+	if (ret < 0) {
+		return ret;
+	}
+	m_source_size = source_size;
+	m_source_time = source_time;
+	if (save(sidecar) < 0) {
+		LOG_WARN("KeyframeIndex: could not write " + sidecar + "\n");
+	}
+	return 0;
+}
+
+int FFPP::KeyframeIndex::build(const std::string& url)
+{
+	FormatInputHandle ctx;
+	int ret = avformat_open_input(ctx.out(), url.c_str(), nullptr, nullptr);
+	if (ret < 0) {
+		LOG_ERROR("KeyframeIndex: could not open " + url + "\n");
+		return ret;
+	}
+	return build(ctx.get());
+}
+
+int FFPP::KeyframeIndex::build(AVFormatContext* ctx)
+{
+	if (!ctx) {
+		return AVERROR(EINVAL);
+	}
+	m_streams.clear();
+	m_storage.clear();
+	m_mapping.reset();
+	m_source_size = -1;
+	m_source_time = -1;
+
+	PacketHandle packet = make_packet();
+	if (!packet) {
+		return AVERROR(ENOMEM);
+	}
+
+	int ret = 0;
+	while ((ret = av_read_frame(ctx, packet.get())) >= 0) {
+		// Streams may show up while reading, e.g. in MPEG-TS.
+		if (m_streams.size() < ctx->nb_streams) {
+			const size_t first = m_streams.size();
+			m_streams.resize(ctx->nb_streams);
+			m_storage.resize(ctx->nb_streams);
+			for (size_t i = first; i < m_streams.size(); i++) {
+				m_streams[i].time_base = ctx->streams[i]->time_base;
+			}
+		}
+
+		Stream& stream = m_streams[packet->stream_index];
+		std::vector<Keyframe>& keyframes = m_storage[packet->stream_index];
+		const int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+		stream.packets++;
+		if (pts != AV_NOPTS_VALUE) {
+			stream.start = stream.start == AV_NOPTS_VALUE ? pts : std::min(stream.start, pts);
+			const int64_t end = pts + std::max<int64_t>(packet->duration, 0);
+			stream.end = stream.end == AV_NOPTS_VALUE ? end : std::max(stream.end, end);
+		}
+
+		if ((packet->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE) {
+			Keyframe keyframe;
+			keyframe.pts = pts;
+			keyframe.dts = packet->dts;
+			keyframe.pos = packet->pos;
+			keyframe.gop_size = 1;
+			keyframes.push_back(keyframe);
+		}
+		else if (!keyframes.empty()) {
+			keyframes.back().gop_size++;
+		}
+		av_packet_unref(packet.get());
+	}
+	if (ret != AVERROR_EOF) {
+		LOG_ERROR("KeyframeIndex: read error\n");
+		return ret;
+	}
+
+	for (size_t i = 0; i < m_streams.size(); i++) {
+		std::stable_sort(m_storage[i].begin(), m_storage[i].end(),
+			[](const Keyframe& a, const Keyframe& b) { return a.pts < b.pts; });
+		m_streams[i].keyframes = m_storage[i];
+	}
+	return 0;
+}
+
+int FFPP::KeyframeIndex::save(const std::string& path) const
+{
+	FileHeader header;
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.stream_count = static_cast<uint32_t>(m_streams.size());
+	header.source_size = m_source_size;
+	header.source_time = m_source_time;
+
+	const std::string temporary = path + ".tmp";
+	std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	uint64_t first = 0;
+	for (const Stream& stream : m_streams) {
+		const FileStream entry{ stream.time_base.num, stream.time_base.den, stream.start, stream.end,
+			stream.packets, first, stream.keyframes.size() };
+		out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		first += stream.keyframes.size();
+	}
+	for (const Stream& stream : m_streams) {
+		out.write(reinterpret_cast<const char*>(stream.keyframes.data()),
+			static_cast<std::streamsize>(stream.keyframes.size_bytes()));
+	}
+	out.close();
+
+	std::error_code error;
+	if (out) {
+		std::filesystem::rename(temporary, path, error);
+	}
+	if (!out || error) {
+		std::filesystem::remove(temporary, error);
+		return AVERROR(EIO);
+	}
+	return 0;
+}
+
+int FFPP::KeyframeIndex::load(const std::string& path)
+{
+	auto mapping = std::make_unique<MappedInput>();
+	int ret = mapping->open(path);
+	if (ret < 0) {
+		return ret;
+	}
+
+	const uint8_t* data = mapping->data();
+	const size_t size = static_cast<size_t>(mapping->size());
+	FileHeader header;
+	if (size < sizeof(header)) {
+		return AVERROR_INVALIDDATA;
+	}
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, Magic, sizeof(Magic)) || header.version != Version) {
+		LOG_ERROR("KeyframeIndex: " + path + " is not a keyframe index\n");
+		return AVERROR_INVALIDDATA;
+	}
+
+	const size_t keyframes_offset = sizeof(header) + static_cast<size_t>(header.stream_count) * sizeof(FileStream);
+	if (size < keyframes_offset) {
+		return AVERROR_INVALIDDATA;
+	}
+	const uint64_t total = (size - keyframes_offset) / sizeof(Keyframe);
+	const Keyframe* keyframes = reinterpret_cast<const Keyframe*>(data + keyframes_offset);
+
+	std::vector<Stream> streams(header.stream_count);
+	for (size_t i = 0; i < streams.size(); i++) {
+		FileStream entry;
+		std::memcpy(&entry, data + sizeof(header) + i * sizeof(FileStream), sizeof(entry));
+		if (entry.first_keyframe > total || entry.keyframe_count > total - entry.first_keyframe) {
+			LOG_ERROR("KeyframeIndex: " + path + " is truncated\n");
+			return AVERROR_INVALIDDATA;
+		}
+		streams[i].time_base = AVRational{ entry.time_base_num, entry.time_base_den };
+		streams[i].start = entry.start;
+		streams[i].end = entry.end;
+		streams[i].packets = entry.packets;
+		streams[i].keyframes = std::span<const Keyframe>(keyframes + entry.first_keyframe, entry.keyframe_count);
+	}
+
+	m_streams = std::move(streams);
+	m_storage.clear();
+	m_mapping = std::move(mapping);
+	m_source_size = header.source_size;
+	m_source_time = header.source_time;
+	return 0;
+}
+
+const KeyframeIndex::Stream* FFPP::KeyframeIndex::stream(int stream_index) const
+{
+	if (stream_index < 0 || stream_index >= static_cast<int>(m_streams.size())) {
+		return nullptr;
+	}
+	return &m_streams[stream_index];
+}
+
+int FFPP::KeyframeIndex::find(int stream_index, int64_t pts) const
+{
+	const Stream* st = stream(stream_index);
+	if (!st) {
+		return -1;
+	}
+	const auto it = std::upper_bound(st->keyframes.begin(), st->keyframes.end(), pts,
+		[](int64_t value, const Keyframe& keyframe) { return value < keyframe.pts; });
+	return static_cast<int>(it - st->keyframes.begin()) - 1;
+}
+
+int FFPP::KeyframeIndex::seek(AVFormatContext* ctx, int stream_index, int64_t pts) const
+{
+	const int index = find(stream_index, pts);
+	if (index < 0) {
+		return AVERROR(ERANGE);
+	}
+	const int ret = seek(ctx, stream_index, m_streams[stream_index].keyframes[index]);
+	return ret < 0 ? ret : index;
+}
+
+int FFPP::KeyframeIndex::seek(AVFormatContext* ctx, int stream_index, const Keyframe& keyframe)
+{
+	if (!ctx || stream_index < 0 || stream_index >= static_cast<int>(ctx->nb_streams)) {
+		return AVERROR(EINVAL);
+	}
+	if (keyframe.pos >= 0 && byte_seekable(ctx->iformat)
+		&& av_seek_frame(ctx, stream_index, keyframe.pos, AVSEEK_FLAG_BYTE) >= 0) {
+		return 0;
+	}
+
+	const int64_t timestamp = keyframe.dts != AV_NOPTS_VALUE ? keyframe.dts : keyframe.pts;
+	const int ret = av_seek_frame(ctx, stream_index, timestamp, AVSEEK_FLAG_BACKWARD);
+	if (ret < 0) {
+		LOG_ERROR("KeyframeIndex: seek failed\n");
+	}
+	return ret;
+}
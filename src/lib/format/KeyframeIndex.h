@@ -0,0 +1,120 @@
+/*
+ * KeyframeIndex.h
+ *
+ * Keyframe positions of every stream, gathered without decoding.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_KEYFRAME_INDEX
+#define FFMPEG_PLUS_PLUS_KEYFRAME_INDEX
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "../FFPPHandle.h"
+#include "MappedInput.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// KeyframeIndex reads the packets of an input once and records where
+	/// each stream's keyframes are. Timestamps are in the stream's time base.
+	/// An index can be kept in a sidecar file next to the input; a loaded
+	/// sidecar is memory-mapped and its keyframes are used in place, so
+	/// opening the index of a long input costs no parsing.
+	/// </summary>
+	class KeyframeIndex {
+	public:
+		struct Keyframe {
+			int64_t pts = AV_NOPTS_VALUE;         // dts if the packet had no pts
+			int64_t dts = AV_NOPTS_VALUE;
+			int64_t pos = -1;                     // Byte offset, -1 if unknown
+			uint32_t gop_size = 0;                // Packets up to the next keyframe
+			uint32_t reserved = 0;                // Keeps the sidecar layout free of padding
+		};
+
+		struct Stream {
+			AVRational time_base{ 0, 1 };
+			int64_t start = AV_NOPTS_VALUE;       // Smallest pts
+			int64_t end = AV_NOPTS_VALUE;         // Largest pts plus its duration
+			uint64_t packets = 0;
+			std::span<const Keyframe> keyframes;  // Ordered by pts
+		};
+
+		KeyframeIndex() = default;
+		KeyframeIndex(KeyframeIndex&&) = default;
+		KeyframeIndex& operator=(KeyframeIndex&&) = default;
+
+		KeyframeIndex(const KeyframeIndex&) = delete;
+		KeyframeIndex& operator=(const KeyframeIndex&) = delete;
+
+		/// <summary>
+		/// Sidecar file of the index of url.
+		/// </summary>
+		static std::string sidecar_path(const std::string& url) { return url + ".kfi"; }
+
+		/// <summary>
+		/// Loads the sidecar of url if it matches the file's size and time,
+		/// else indexes url and writes the sidecar. Inputs that are not local
+		/// files are indexed without a sidecar.
+		/// </summary>
+		int open(const std::string& url);
+
+		/// <summary>
+		/// Opens url and indexes all of it.
+		/// </summary>
+		int build(const std::string& url);
+
+		/// <summary>
+		/// Indexes ctx from its current position to the end.
+		/// </summary>
+		int build(AVFormatContext* ctx);
+
+		/// <summary>
+		/// Writes the index to path. The file is replaced atomically.
+		/// </summary>
+		int save(const std::string& path) const;
+
+		/// <summary>
+		/// Maps an index written by save(). The file stays mapped while the
+		/// index lives. Files are little-endian, like the hosts we run on.
+		/// </summary>
+		int load(const std::string& path);
+
+		size_t stream_count() const { return m_streams.size(); }
+
+		const Stream* stream(int stream_index) const;
+
+		/// <summary>
+		/// Index of the last keyframe at or before pts, -1 if there is none.
+		/// </summary>
+		int find(int stream_index, int64_t pts) const;
+
+		/// <summary>
+		/// Positions ctx so the next packet of stream_index read is the
+		/// keyframe at or before pts; decoding from there up to pts is the
+		/// least work. Returns the keyframe's index.
+		/// </summary>
+		int seek(AVFormatContext* ctx, int stream_index, int64_t pts) const;
+
+		/// <summary>
+		/// Positions ctx on keyframe: at its byte offset for formats whose
+		/// packets resynchronise on their own (MPEG-TS, PS, elementary
+		/// streams), through av_seek_frame() on its dts otherwise.
+		/// </summary>
+		static int seek(AVFormatContext* ctx, int stream_index, const Keyframe& keyframe);
+
+	private:
+		std::vector<Stream> m_streams;
+		std::vector<std::vector<Keyframe>> m_storage;  // Keyframes of a built index
+		std::unique_ptr<MappedInput> m_mapping;       // File of a loaded index
+
+		// Source file the index describes, -1 if unknown.
+		int64_t m_source_size = -1;
+		int64_t m_source_time = -1;
+	};
+}
+
+#endif
\ No newline at end of file
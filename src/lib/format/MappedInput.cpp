@@ -0,0 +1,236 @@
+/*
+ * MappedInput.cpp
+ *
+ * Memory-mapped local file exposed as an AVIOContext.
+ */
+
+#include "MappedInput.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "../../utils/Logging/Logger.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	constexpr int64_t PageSize = 4096;
+
+	int64_t page_floor(int64_t pos) { return pos & ~(PageSize - 1); }
+}
+
+FFPP::MappedInput::MappedInput()
+	: MappedInput(Config())
+{
+}
+
+FFPP::MappedInput::MappedInput(const Config& config)
+	: m_config(config)
+{
+}
+
+FFPP::MappedInput::~MappedInput()
+{
+	close();
+}
+
+int FFPP::MappedInput::open(const std::string& path)
+{
+	close();
+
+#ifdef _WIN32
+	const std::filesystem::path native_path(path);
+	HANDLE file = CreateFileW(native_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		LOG_ERROR("MappedInput: could not open " + path + "\n");
+		return AVERROR(ENOENT);
+	}
+	m_file = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		close();
+		return AVERROR(EIO);
+	}
+	m_size = size.QuadPart;
+
+	if (m_size > 0) {
+		m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		m_data = m_mapping
+			? static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0))
+			: nullptr;
+	}
+#else
+	m_fd = ::open(path.c_str(), O_RDONLY);
+	if (m_fd < 0) {
+		// Logging may overwrite errno.
+		const int error = errno;
+		LOG_ERROR("MappedInput: could not open " + path + "\n");
+		return AVERROR(error);
+	}
+
+	struct stat st;
+	if (fstat(m_fd, &st) < 0) {
+		close();
+		return AVERROR(EIO);
+	}
+	m_size = st.st_size;
+
+	if (m_size > 0) {
+		void* data = mmap(nullptr, static_cast<size_t>(m_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+		m_data = data != MAP_FAILED ? static_cast<const uint8_t*>(data) : nullptr;
+		if (m_data) {
+			madvise(const_cast<uint8_t*>(m_data), static_cast<size_t>(m_size), MADV_SEQUENTIAL);
+		}
+	}
+#endif
+
+	if (m_size > 0 && !m_data) {
+		LOG_ERROR("MappedInput: could not map " + path + "\n");
+		close();
+		return AVERROR(ENOMEM);
+	}
+
+	uint8_t* buffer = static_cast<uint8_t*>(av_malloc(m_config.buffer_size));
+	if (!buffer) {
+		close();
+		return AVERROR(ENOMEM);
+	}
+	m_io.reset(avio_alloc_context(buffer, static_cast<int>(m_config.buffer_size), 0, this,
+		&MappedInput::read_packet, nullptr, &MappedInput::seek));
+	if (!m_io) {
+		av_free(buffer);
+		close();
+		return AVERROR(ENOMEM);
+	}
+	// Reads larger than the buffer bypass it and land in the caller's memory.
+	m_io->direct = 1;
+
+	prefetch(0, m_config.prefetch);
+	return 0;
+}
+
+void FFPP::MappedInput::close()
+{
+	m_io.reset();
+
+#ifdef _WIN32
+	if (m_data) {
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+	}
+	if (m_file) {
+		CloseHandle(m_file);
+	}
+	m_mapping = nullptr;
+	m_file = nullptr;
+#else
+	if (m_data) {
+		munmap(const_cast<uint8_t*>(m_data), static_cast<size_t>(m_size));
+	}
+	if (m_fd >= 0) {
+		::close(m_fd);
+	}
+	m_fd = -1;
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+	m_pos = 0;
+	m_prefetched = 0;
+}
+
+int FFPP::MappedInput::read_packet(void* opaque, uint8_t* buf, int buf_size)
+{
+	auto* self = static_cast<MappedInput*>(opaque);
+	const int64_t left = self->m_size - self->m_pos;
+	if (left <= 0) {
+		return AVERROR_EOF;
+	}
+
+	const int size = static_cast<int>(std::min<int64_t>(buf_size, left));
+	self->advise(self->m_pos + size);
+	std::memcpy(buf, self->m_data + self->m_pos, size);
+	self->m_pos += size;
+	return size;
+}
+
+int64_t FFPP::MappedInput::seek(void* opaque, int64_t offset, int whence)
+{
+	auto* self = static_cast<MappedInput*>(opaque);
+	int64_t pos = 0;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return self->m_size;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = self->m_pos + offset;
+		break;
+	case SEEK_END:
+		pos = self->m_size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+	if (pos < 0 || pos > self->m_size) {
+		return AVERROR(EINVAL);
+	}
+
+	// Jumping outside the window (e.g. to the moov atom or cues) restarts read-ahead there.
+	if (pos < self->m_prefetched - static_cast<int64_t>(self->m_config.prefetch) || pos > self->m_prefetched) {
+		self->m_prefetched = page_floor(pos);
+	}
+	self->m_pos = pos;
+	return pos;
+}
+
+void FFPP::MappedInput::advise(int64_t end)
+{
+	// Keep the window half full so that pages are resident before they are touched.
+	const int64_t window = static_cast<int64_t>(m_config.prefetch);
+	if (end + window / 2 > m_prefetched) {
+		prefetch(m_prefetched, std::max(end, m_prefetched) + window);
+	}
+}
+
+void FFPP::MappedInput::prefetch(int64_t begin, int64_t end)
+{
+	begin = page_floor(std::max<int64_t>(begin, 0));
+	end = std::min(end, m_size);
+	if (!m_data || begin >= end) {
+		return;
+	}
+
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<uint8_t*>(m_data + begin);
+	range.NumberOfBytes = static_cast<SIZE_T>(end - begin);
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	madvise(const_cast<uint8_t*>(m_data + begin), static_cast<size_t>(end - begin), MADV_WILLNEED);
+#endif
+	m_prefetched = end;
+}
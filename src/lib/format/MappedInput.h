@@ -0,0 +1,79 @@
+/*
+ * MappedInput.h
+ *
+ * Memory-mapped local file exposed as an AVIOContext.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_MAPPED_INPUT
+#define FFMPEG_PLUS_PLUS_MAPPED_INPUT
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "../FFPPHandle.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// MappedInput maps a whole file read-only and serves it through a custom
+	/// AVIOContext. The context reads in direct mode, so large reads go from
+	/// the mapping straight into the caller's buffer instead of through a
+	/// read() syscall and the AVIO buffer. Seeking is pointer arithmetic.
+	/// The kernel is told the access is sequential and pages ahead of the
+	/// read position are prefetched, following the demuxer after seeks.
+	/// </summary>
+	class MappedInput {
+	public:
+		struct Config {
+			size_t buffer_size = 64 * 1024;       // AVIO buffer for small reads
+			size_t prefetch = 8 * 1024 * 1024;    // Read-ahead window
+		};
+
+		MappedInput();
+		explicit MappedInput(const Config& config);
+		~MappedInput();
+
+		MappedInput(const MappedInput&) = delete;
+		MappedInput& operator=(const MappedInput&) = delete;
+
+		int open(const std::string& path);
+		void close();
+
+		/// <summary>
+		/// The context to set as AVFormatContext::pb, owned by this object.
+		/// </summary>
+		AVIOContext* context() const { return m_io.get(); }
+
+		/// <summary>
+		/// The mapping itself, for consumers that can parse in place.
+		/// </summary>
+		const uint8_t* data() const { return m_data; }
+		int64_t size() const { return m_size; }
+		int64_t position() const { return m_pos; }
+
+	private:
+		static int read_packet(void* opaque, uint8_t* buf, int buf_size);
+		static int64_t seek(void* opaque, int64_t offset, int whence);
+
+		void advise(int64_t end);
+		void prefetch(int64_t begin, int64_t end);
+
+		Config m_config;
+		IOContextHandle m_io;
+
+		const uint8_t* m_data = nullptr;
+		int64_t m_size = 0;
+		int64_t m_pos = 0;
+		int64_t m_prefetched = 0;                 // End of the prefetched range
+
+#ifdef _WIN32
+		void* m_file = nullptr;
+		void* m_mapping = nullptr;
+#else
+		int m_fd = -1;
+#endif
+	};
+}
+
+#endif
\ No newline at end of file
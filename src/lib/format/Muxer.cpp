@@ -0,0 +1,314 @@
+/*
+ * Muxer.cpp
+ *
+ * Muxer interleaving packets itself and writing them on its own thread.
+ */
+
+#include "Muxer.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+}
+
+using namespace FFPP;
+
+FFPP::Muxer::Muxer()
+	: Muxer(Config())
+{
+}
+
+FFPP::Muxer::Muxer(const Config& config)
+	: m_config(config)
+{
+}
+
+FFPP::Muxer::~Muxer()
+{
+	if (m_writer.joinable()) {
+		finish();
+	}
+}
+
+int FFPP::Muxer::open(const std::string& url, const std::string& format_name)
+{
+	if (m_writer.joinable()) {
+		return AVERROR(EINVAL);
+	}
+
+	const int ret = avformat_alloc_output_context2(m_ctx.out(), nullptr,
+		format_name.empty() ? nullptr : format_name.c_str(), url.c_str());
+	if (ret < 0) {
+		LOG_ERROR("Muxer: could not create output context for " + url + "\n");
+	}
+	return ret;
+}
+
+int FFPP::Muxer::add_stream(const AVCodecContext* encoder)
+{
+	if (!m_ctx || m_writer.joinable()) {
+		return AVERROR(EINVAL);
+	}
+
+	AVStream* st = avformat_new_stream(m_ctx.get(), nullptr);
+	if (!st) {
+		return AVERROR(ENOMEM);
+	}
+	const int ret = avcodec_parameters_from_context(st->codecpar, encoder);
+	if (ret < 0) {
+		return ret;
+	}
+	st->time_base = encoder->time_base;
+	return st->index;
+}
+
+int FFPP::Muxer::add_stream(const AVCodecParameters* par, AVRational time_base)
+{
+	if (!m_ctx || m_writer.joinable()) {
+		return AVERROR(EINVAL);
+	}
+
+	AVStream* st = avformat_new_stream(m_ctx.get(), nullptr);
+	if (!st) {
+		return AVERROR(ENOMEM);
+	}
+	const int ret = avcodec_parameters_copy(st->codecpar, par);
+	if (ret < 0) {
+		return ret;
+	}
+	st->codecpar->codec_tag = 0;
+	st->time_base = time_base;
+	return st->index;
+}
+
+int FFPP::Muxer::set_io(AVIOContext* io)
+{
+	if (!m_ctx || !io || m_writer.joinable() || (m_ctx->oformat->flags & AVFMT_NOFILE)) {
+		return AVERROR(EINVAL);
+	}
+	m_ctx->pb = io;
+	m_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	return 0;
+}
+
+int FFPP::Muxer::start(AVDictionary** options)
+{
+	if (!m_ctx || m_writer.joinable() || m_ctx->nb_streams == 0) {
+		return AVERROR(EINVAL);
+	}
+
+	int ret = 0;
+	if (!(m_ctx->oformat->flags & AVFMT_NOFILE) && !m_ctx->pb) {
+		ret = avio_open(&m_ctx->pb, m_ctx->url, AVIO_FLAG_WRITE);
+		if (ret < 0) {
+			LOG_ERROR(std::string("Muxer: could not open ") + m_ctx->url + "\n");
+			return ret;
+		}
+	}
+
+	ret = avformat_write_header(m_ctx.get(), options);
+	if (ret < 0) {
+		LOG_ERROR("Muxer: could not write header\n");
+		return ret;
+	}
+
+	m_queues = std::vector<StreamQueue>(m_ctx->nb_streams);
+	m_newest = AV_NOPTS_VALUE;
+	m_flushing = false;
+	m_stats = Stats();
+	m_error = 0;
+	m_writer = std::thread(&Muxer::run, this);
+	return 0;
+}
+
+int FFPP::Muxer::write(PooledPacketHandle packet, int stream_index, AVRational time_base)
+{
+	return enqueue(packet, stream_index, time_base, true);
+}
+
+int FFPP::Muxer::try_write(PooledPacketHandle& packet, int stream_index, AVRational time_base)
+{
+	return enqueue(packet, stream_index, time_base, false);
+}
+
+bool FFPP::Muxer::congested() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats.queued_bytes >= m_config.max_bytes;
+}
+
+void FFPP::Muxer::end_stream(int stream_index)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (stream_index < 0 || stream_index >= static_cast<int>(m_queues.size())) {
+			return;
+		}
+		m_queues[stream_index].ended = true;
+	}
+	m_ready.notify_one();
+}
+
+int FFPP::Muxer::finish()
+{
+	if (!m_writer.joinable()) {
+		return AVERROR(EINVAL);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_flushing = true;
+	}
+	m_ready.notify_one();
+	m_writer.join();
+
+	const int ret = av_write_trailer(m_ctx.get());
+	if (ret < 0 && !m_error) {
+		LOG_ERROR("Muxer: could not write trailer\n");
+		m_error = ret;
+	}
+	if (!(m_ctx->oformat->flags & AVFMT_NOFILE) && !(m_ctx->flags & AVFMT_FLAG_CUSTOM_IO)) {
+		avio_closep(&m_ctx->pb);
+	}
+	return m_error;
+}
+
+FFPP::Muxer::Stats FFPP::Muxer::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+int FFPP::Muxer::enqueue(PooledPacketHandle& packet, int stream_index, AVRational time_base, bool block)
+{
+	if (!packet || !m_writer.joinable()) {
+		return AVERROR(EINVAL);
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (stream_index < 0 || stream_index >= static_cast<int>(m_queues.size())
+		|| m_queues[stream_index].ended || m_flushing) {
+		return AVERROR(EINVAL);
+	}
+
+	if (m_stats.queued_bytes >= m_config.max_bytes) {
+		if (!block) {
+			return AVERROR(EAGAIN);
+		}
+		const auto start = std::chrono::steady_clock::now();
+		m_space.wait(lock, [this] { return m_stats.queued_bytes < m_config.max_bytes || m_error; });
+		m_stats.blocked += std::chrono::steady_clock::now() - start;
+	}
+	if (const int error = m_error.load(std::memory_order_acquire)) {
+		return error;
+	}
+
+	const AVStream* st = m_ctx->streams[stream_index];
+	av_packet_rescale_ts(packet.get(), time_base, st->time_base);
+	packet->stream_index = stream_index;
+
+	StreamQueue& queue = m_queues[stream_index];
+	m_stats.queued_packets++;
+	m_stats.queued_bytes += packet->size;
+	m_stats.high_water_bytes = std::max(m_stats.high_water_bytes, m_stats.queued_bytes);
+	queue.packets.emplace_back(std::move(packet));
+
+	const AVPacket* back = queue.packets.back().get();
+	const int64_t ts = back->dts != AV_NOPTS_VALUE ? back->dts : back->pts;
+	if (ts != AV_NOPTS_VALUE) {
+		queue.last_dts = av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q);
+		m_newest = m_newest == AV_NOPTS_VALUE ? queue.last_dts : std::max(m_newest, queue.last_dts);
+	}
+
+	lock.unlock();
+	m_ready.notify_one();
+	return 0;
+}
+
+void FFPP::Muxer::run()
+{
+	while (true) {
+		PooledPacketHandle packet;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			int index = -1;
+			m_ready.wait(lock, [&] { return (index = next_stream(m_flushing)) >= 0 || m_flushing; });
+			if (index < 0) {
+				break;
+			}
+
+			auto& packets = m_queues[index].packets;
+			packet = std::move(packets.front());
+			packets.pop_front();
+			m_stats.queued_packets--;
+			m_stats.queued_bytes -= packet->size;
+		}
+		m_space.notify_all();
+
+		// After an error the queue is still drained so producers never hang.
+		if (m_error.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		const int ret = av_write_frame(m_ctx.get(), packet.get());
+		if (ret < 0) {
+			char buf[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+			av_strerror(ret, buf, sizeof(buf));
+			LOG_ERROR(std::string("Muxer: write failed: ") + buf + "\n");
+			m_error = ret;
+			m_space.notify_all();
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.packets_written++;
+	}
+}
+
+int FFPP::Muxer::next_stream(bool flushing)
+{
+	int best = -1;
+	int64_t best_key = INT64_MAX;
+	bool complete = true;
+	for (size_t i = 0; i < m_queues.size(); i++) {
+		const StreamQueue& queue = m_queues[i];
+		if (queue.packets.empty()) {
+			complete = complete && queue.ended;
+			continue;
+		}
+		const int64_t key = queue_key(queue);
+		if (best < 0 || key < best_key) {
+			best = static_cast<int>(i);
+			best_key = key;
+		}
+	}
+	if (best < 0 || complete || flushing) {
+		return best;
+	}
+
+	// A stream is silent; only release what it can no longer precede.
+	const bool stale = best_key == INT64_MIN
+		|| (m_newest != AV_NOPTS_VALUE && m_newest - best_key > m_config.max_interleave_delta);
+	if (stale || m_stats.queued_bytes >= m_config.max_bytes) {
+		m_stats.forced++;
+		return best;
+	}
+	return -1;
+}
+
+int64_t FFPP::Muxer::queue_key(const StreamQueue& queue) const
+{
+	if (queue.packets.empty()) {
+		return INT64_MAX;
+	}
+	const AVPacket* packet = queue.packets.front().get();
+	const int64_t ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+	if (ts == AV_NOPTS_VALUE) {
+		return INT64_MIN;
+	}
+	return av_rescale_q(ts, m_ctx->streams[packet->stream_index]->time_base, AV_TIME_BASE_Q);
+}
@@ -0,0 +1,148 @@
+/*
+ * Muxer.h
+ *
+ * Muxer interleaving packets itself and writing them on its own thread.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_MUXER
+#define FFMPEG_PLUS_PLUS_MUXER
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../FFPPBase.h"
+#include "../FFPPHandle.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Muxer owns an output AVFormatContext. Packets are sorted by dts in an
+	/// interleaving queue and written with av_write_frame() by a background
+	/// I/O thread, so producers never wait on the disk. A packet leaves the
+	/// queue once every open stream has one queued, once it is older than
+	/// max_interleave_delta relative to the newest packet, or once the queue
+	/// exceeds max_bytes. Producers are held back while max_bytes is exceeded.
+	/// </summary>
+	class Muxer : public FFPPBase<Muxer, AVFormatContext> {
+	public:
+		struct Config {
+			int64_t max_interleave_delta = 10000000;  // AV_TIME_BASE units
+			size_t max_bytes = 64 * 1024 * 1024;      // Queued packet data
+		};
+
+		struct Stats {
+			size_t queued_packets = 0;
+			size_t queued_bytes = 0;
+			size_t high_water_bytes = 0;
+			uint64_t packets_written = 0;
+			uint64_t forced = 0;                      // Packets written out of full interleaving
+			std::chrono::nanoseconds blocked{ 0 };    // Producers waiting on back-pressure
+		};
+
+		Muxer();
+		explicit Muxer(const Config& config);
+		~Muxer();
+
+		Muxer(const Muxer&) = delete;
+		Muxer& operator=(const Muxer&) = delete;
+
+		AVFormatContext* native() const noexcept { return m_ctx.get(); }
+
+		/// <summary>
+		/// Allocates the output context, the format is guessed from url if
+		/// format_name is empty.
+		/// </summary>
+		int open(const std::string& url, const std::string& format_name = "");
+
+		/// <summary>
+		/// Adds a stream with the parameters of an opened encoder. Returns the
+		/// stream index or a negative error.
+		/// </summary>
+		int add_stream(const AVCodecContext* encoder);
+
+		/// <summary>
+		/// Adds a stream copying par, e.g. from a demuxed stream.
+		/// </summary>
+		int add_stream(const AVCodecParameters* par, AVRational time_base);
+
+		/// <summary>
+		/// Writes through io instead of opening the url, e.g. AsyncOutput::context().
+		/// io is not owned and has to outlive finish().
+		/// </summary>
+		int set_io(AVIOContext* io);
+
+		/// <summary>
+		/// Opens the output file, writes the header and starts the I/O thread.
+		/// </summary>
+		int start(AVDictionary** options = nullptr);
+
+		/// <summary>
+		/// Queues packet for stream_index, its timestamps are in time_base.
+		/// Blocks while the queue is over its memory cap.
+		/// </summary>
+		int write(PooledPacketHandle packet, int stream_index, AVRational time_base);
+
+		/// <summary>
+		/// Like write() but returns AVERROR(EAGAIN) instead of blocking. The
+		/// packet is left untouched in that case.
+		/// </summary>
+		int try_write(PooledPacketHandle& packet, int stream_index, AVRational time_base);
+
+		/// <summary>
+		/// True while producers would be held back.
+		/// </summary>
+		bool congested() const;
+
+		/// <summary>
+		/// Marks a stream as complete so it no longer holds back interleaving.
+		/// </summary>
+		void end_stream(int stream_index);
+
+		/// <summary>
+		/// Writes all queued packets and the trailer, then stops the I/O thread.
+		/// Returns the first error that occurred.
+		/// </summary>
+		int finish();
+
+		/// <summary>
+		/// First write error, 0 if none.
+		/// </summary>
+		int error() const { return m_error.load(std::memory_order_acquire); }
+
+		Stats stats() const;
+
+	private:
+		struct StreamQueue {
+			std::deque<PooledPacketHandle> packets;
+			int64_t last_dts = AV_NOPTS_VALUE;    // AV_TIME_BASE units
+			bool ended = false;
+		};
+
+		int enqueue(PooledPacketHandle& packet, int stream_index, AVRational time_base, bool block);
+		void run();
+		int next_stream(bool flushing);
+		int64_t queue_key(const StreamQueue& queue) const;
+
+		Config m_config;
+		FormatOutputHandle m_ctx;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_ready;          // Signals the I/O thread
+		std::condition_variable m_space;          // Signals producers
+		std::vector<StreamQueue> m_queues;
+		int64_t m_newest = AV_NOPTS_VALUE;        // Highest dts queued
+		bool m_flushing = false;
+		Stats m_stats;
+
+		std::thread m_writer;
+		std::atomic<int> m_error = 0;
+	};
+}
+
+#endif
\ No newline at end of file
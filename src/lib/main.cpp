@@ -6,7 +6,8 @@
 
 #include "../utils/Logging/Logger.h"
 #include "util/FFmpegLogging.h"
-#include "util/FFmpegParams.h"
+#include "FFPPBase.h"
+#include "codec/Encoder.h"
 
 extern "C" {
 #include <libavcodec\avcodec.h>
@@ -22,34 +23,28 @@ int main()
     FFmpegLogging::ConnectLogger();
     FFmpegLogging::Test();
 
-    // Find the AAC audio encoder
-    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    if (!codec) {
-        LOG_ERROR("Codec not found\n");
-        return 0;
-    }
+    FFPP::Encoder::Config config;
+    config.codec_id = AV_CODEC_ID_H264;
 
-    // Allocate and initialize codec context for the encoder
-    AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        LOG_ERROR("Could not allocate audio codec context\n");
+    FFPP::Encoder encoder(config);
+    if (!encoder.get()) {
+        LOG_ERROR("Could not create encoder\n");
         return 0;
     }
 
-    codec_ctx->time_base.num = 1;
-    codec_ctx->time_base.den = 1000;
-    codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    codec_ctx->width = 1920;
-    codec_ctx->height = 1200;
+    encoder->time_base.num = 1;
+    encoder->time_base.den = 1000;
+    encoder->pix_fmt = AV_PIX_FMT_YUV420P;
+    encoder->width = 1920;
+    encoder->height = 1200;
 
     // Initialize the codec context with default settings
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+    if (encoder.open() < 0) {
         LOG_ERROR("Could not open codec\n");
-        avcodec_free_context(&codec_ctx);
         return 0;
     }
 
-    FFPP::FFPPArgs params = FFPP::FFPPArgs((AVClass *)codec_ctx);
+    FFPP::FFPPArgs params = encoder.args();
 
     for (int i = 0; i < 1; i++) {
         LOG_TRACE("Library trace message is here!\n");
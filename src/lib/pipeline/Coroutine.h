@@ -0,0 +1,293 @@
+/*
+ * Coroutine.h
+ *
+ * Task and Generator coroutine types for pipeline stages.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_COROUTINE
+#define FFMPEG_PLUS_PLUS_COROUTINE
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "../util/Arena.h"
+
+namespace FFPP {
+
+	namespace detail {
+
+		/// <summary>
+		/// Allocates coroutine frames from an Arena when the coroutine's first
+		/// parameter is an Arena or an object with an arena() accessor such as
+		/// Pipeline, otherwise from the global heap.
+		/// </summary>
+		class ArenaPromise {
+		public:
+			template<class... Args>
+			static void* operator new(size_t size, Arena& arena, Args&&...) {
+				return allocate(size, &arena);
+			}
+
+			template<class Owner, class... Args>
+				requires std::is_same_v<decltype(std::declval<Owner&>().arena()), Arena&>
+			static void* operator new(size_t size, Owner& owner, Args&&...) {
+				return allocate(size, &owner.arena());
+			}
+
+			static void* operator new(size_t size) {
+				return allocate(size, nullptr);
+			}
+
+			static void operator delete(void* p, size_t size) noexcept {
+				void* base = static_cast<std::byte*>(p) - Header;
+				Arena* arena = *static_cast<Arena**>(base);
+				if (arena) {
+					arena->deallocate(base, size + Header);
+				}
+				else {
+					::operator delete(base);
+				}
+			}
+
+		private:
+			static constexpr size_t Header = 16;  // Owning arena, keeps the frame 16 byte aligned
+
+			static void* allocate(size_t size, Arena* arena) {
+				void* base = arena ? arena->allocate(size + Header) : ::operator new(size + Header);
+				*static_cast<Arena**>(base) = arena;
+				return static_cast<std::byte*>(base) + Header;
+			}
+		};
+
+		/// <summary>
+		/// Resumes whoever awaits the finished task, or reports completion to
+		/// the callback installed by Pipeline::run().
+		/// </summary>
+		struct TaskFinal {
+			bool await_ready() const noexcept { return false; }
+
+			template<class Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+				auto& promise = handle.promise();
+				if (promise.m_continuation) {
+					return promise.m_continuation;
+				}
+				if (promise.m_on_done) {
+					promise.m_on_done(promise.m_on_done_opaque);
+				}
+				return std::noop_coroutine();
+			}
+
+			void await_resume() const noexcept {}
+		};
+
+		class TaskPromiseBase : public ArenaPromise {
+		public:
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			TaskFinal final_suspend() const noexcept { return {}; }
+			void unhandled_exception() noexcept { m_error = std::current_exception(); }
+
+			std::coroutine_handle<> m_continuation;
+			void (*m_on_done)(void* opaque) = nullptr;
+			void* m_on_done_opaque = nullptr;
+
+		protected:
+			void rethrow() {
+				if (m_error) {
+					std::rethrow_exception(std::exchange(m_error, nullptr));
+				}
+			}
+
+			std::exception_ptr m_error;
+		};
+
+		template<class T>
+		class TaskPromise : public TaskPromiseBase {
+		public:
+			void return_value(T value) { m_value.emplace(std::move(value)); }
+
+			T result() {
+				rethrow();
+				return std::move(*m_value);
+			}
+
+		private:
+			std::optional<T> m_value;
+		};
+
+		template<>
+		class TaskPromise<void> : public TaskPromiseBase {
+		public:
+			void return_void() const noexcept {}
+
+			void result() { rethrow(); }
+		};
+	}
+
+	/// <summary>
+	/// Lazily started coroutine producing one T. Awaiting it runs it on the
+	/// awaiting thread until it suspends, and the awaiter continues wherever
+	/// the task finishes.
+	/// </summary>
+	template<class T = void>
+	class Task {
+	public:
+		class promise_type : public detail::TaskPromise<T> {
+		public:
+			Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		};
+
+		typedef std::coroutine_handle<promise_type> Handle;
+
+		Task() = default;
+		Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+		Task& operator=(Task&& other) noexcept {
+			if (this != &other) {
+				destroy();
+				m_handle = std::exchange(other.m_handle, nullptr);
+			}
+			return *this;
+		}
+		~Task() { destroy(); }
+
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+
+		auto operator co_await() && noexcept {
+			struct Awaiter {
+				Handle handle;
+
+				bool await_ready() const noexcept { return !handle || handle.done(); }
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+					handle.promise().m_continuation = awaiting;
+					return handle;
+				}
+
+				T await_resume() { return handle.promise().result(); }
+			};
+			return Awaiter{ m_handle };
+		}
+
+		Handle handle() const noexcept { return m_handle; }
+
+	private:
+		explicit Task(Handle handle) : m_handle(handle) {}
+
+		void destroy() {
+			if (m_handle) {
+				m_handle.destroy();
+				m_handle = nullptr;
+			}
+		}
+
+		Handle m_handle;
+	};
+
+	/// <summary>
+	/// Asynchronous generator. Each co_await next() runs the producer until
+	/// its next co_yield, which may suspend on back-pressure in between, and
+	/// returns the yielded value, or nullopt once the producer returned.
+	/// Values are moved through the coroutine frame, nothing is allocated
+	/// per element.
+	///
+	/// C++20 has no "for co_await", a stage consumes its input as
+	///     while (auto packet = co_await packets.next()) { ... }
+	/// </summary>
+	template<class T>
+	class Generator {
+	public:
+		class promise_type : public detail::ArenaPromise {
+		public:
+			struct ToConsumer {
+				bool await_ready() const noexcept { return false; }
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+					return handle.promise().m_consumer;
+				}
+
+				void await_resume() const noexcept {}
+			};
+
+			Generator get_return_object() { return Generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			ToConsumer final_suspend() const noexcept { return {}; }
+
+			ToConsumer yield_value(T value) {
+				m_value.emplace(std::move(value));
+				return {};
+			}
+
+			void return_void() const noexcept {}
+			void unhandled_exception() noexcept { m_error = std::current_exception(); }
+
+		private:
+			friend class Generator;
+
+			std::optional<T> m_value;
+			std::coroutine_handle<> m_consumer;
+			std::exception_ptr m_error;
+		};
+
+		typedef std::coroutine_handle<promise_type> Handle;
+
+		Generator() = default;
+		Generator(Generator&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+		Generator& operator=(Generator&& other) noexcept {
+			if (this != &other) {
+				destroy();
+				m_handle = std::exchange(other.m_handle, nullptr);
+			}
+			return *this;
+		}
+		~Generator() { destroy(); }
+
+		Generator(const Generator&) = delete;
+		Generator& operator=(const Generator&) = delete;
+
+		auto next() noexcept {
+			struct Awaiter {
+				Handle handle;
+
+				bool await_ready() const noexcept { return !handle || handle.done(); }
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept {
+					handle.promise().m_consumer = consumer;
+					return handle;
+				}
+
+				std::optional<T> await_resume() {
+					if (!handle) {
+						return std::nullopt;
+					}
+					promise_type& promise = handle.promise();
+					if (promise.m_error) {
+						std::rethrow_exception(std::exchange(promise.m_error, nullptr));
+					}
+					std::optional<T> value = std::move(promise.m_value);
+					promise.m_value.reset();
+					return value;
+				}
+			};
+			return Awaiter{ m_handle };
+		}
+
+	private:
+		explicit Generator(Handle handle) : m_handle(handle) {}
+
+		void destroy() {
+			if (m_handle) {
+				m_handle.destroy();
+				m_handle = nullptr;
+			}
+		}
+
+		Handle m_handle;
+	};
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+/*
+ * Pipeline.cpp
+ *
+ * Runs coroutine stages of one transcode on the shared scheduler.
+ */
+
+#include "Pipeline.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+using namespace FFPP;
+
+FFPP::Pipeline::Pipeline(const std::string& name, UTLX::Scheduler& scheduler, size_t arena_block_size)
+	: m_scheduler(scheduler),
+	m_job(scheduler.create_job(name)),
+	m_arena(arena_block_size)
+{
+}
+
+int FFPP::Pipeline::run(Task<int> task)
+{
+	std::vector<Task<int>> tasks;
+	tasks.push_back(std::move(task));
+	return run(std::move(tasks));
+}
+
+int FFPP::Pipeline::run(std::vector<Task<int>> tasks)
+{
+	Completion completion;
+	completion.remaining = tasks.size();
+
+	for (Task<int>& task : tasks) {
+		auto& promise = task.handle().promise();
+		promise.m_on_done = &Pipeline::task_done;
+		promise.m_on_done_opaque = &completion;
+		resume(task.handle());
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(completion.mutex);
+		completion.done.wait(lock, [&completion] { return completion.remaining == 0; });
+	}
+
+	// Every task is suspended at its end, so collecting the results runs nothing.
+	for (Task<int>& task : tasks) {
+		try {
+			const int ret = task.handle().promise().result();
+			if (ret < 0) {
+				fail(ret);
+			}
+		}
+		catch (...) {
+			fail(AVERROR_BUG);
+		}
+	}
+	return error();
+}
+
+void FFPP::Pipeline::fail(int error)
+{
+	int expected = 0;
+	m_error.compare_exchange_strong(expected, error, std::memory_order_acq_rel);
+}
+
+void FFPP::Pipeline::resume(std::coroutine_handle<> handle)
+{
+	m_scheduler.submit(m_job, [handle] { handle.resume(); });
+}
+
+void FFPP::Pipeline::task_done(void* opaque)
+{
+	auto* completion = static_cast<Completion*>(opaque);
+	// Notify under the lock: run() may return and destroy completion as soon
+	// as it can take the lock again.
+	std::lock_guard<std::mutex> lock(completion->mutex);
+	completion->remaining--;
+	completion->done.notify_all();
+}
\ No newline at end of file
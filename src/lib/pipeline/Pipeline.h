@@ -0,0 +1,125 @@
+/*
+ * Pipeline.h
+ *
+ * Runs coroutine stages of one transcode on the shared scheduler.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_PIPELINE
+#define FFMPEG_PLUS_PLUS_PIPELINE
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Coroutine.h"
+#include "../util/Arena.h"
+#include "../../utils/Concurrency/Scheduler.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Pipeline is the context passed as first argument to every stage
+	/// coroutine. The stages' frames are allocated from its arena, and a stage
+	/// that would block suspends and is resumed as a task of the pipeline's
+	/// scheduler job. The pipeline has to outlive its stages.
+	/// </summary>
+	class Pipeline {
+	public:
+		explicit Pipeline(const std::string& name, UTLX::Scheduler& scheduler = UTLX::Scheduler::get_instance(),
+			size_t arena_block_size = 64 * 1024);
+
+		Pipeline(const Pipeline&) = delete;
+		Pipeline& operator=(const Pipeline&) = delete;
+
+		Arena& arena() noexcept { return m_arena; }
+		UTLX::Scheduler& scheduler() const noexcept { return m_scheduler; }
+		const std::shared_ptr<UTLX::Job>& job() const noexcept { return m_job; }
+
+		/// <summary>
+		/// Runs tasks on the scheduler and waits for all of them. Must not be
+		/// called from a scheduler worker. Returns the first error recorded
+		/// by fail() or returned by a task.
+		/// </summary>
+		int run(std::vector<Task<int>> tasks);
+		int run(Task<int> task);
+
+		/// <summary>
+		/// Records error if it is the first one. Stages end early once an
+		/// error is recorded.
+		/// </summary>
+		void fail(int error);
+		int error() const { return m_error.load(std::memory_order_acquire); }
+
+		/// <summary>
+		/// Queues handle to be resumed on a worker.
+		/// </summary>
+		void resume(std::coroutine_handle<> handle);
+
+		/// <summary>
+		/// Suspends the stage and resumes it behind the tasks already queued,
+		/// for retrying a non-blocking call.
+		/// </summary>
+		auto yield() noexcept {
+			struct Awaiter {
+				Pipeline& pipeline;
+
+				bool await_ready() const noexcept { return false; }
+				void await_suspend(std::coroutine_handle<> handle) { pipeline.resume(handle); }
+				void await_resume() const noexcept {}
+			};
+			return Awaiter{ *this };
+		}
+
+		/// <summary>
+		/// Suspends the stage while fn, a blocking call such as Demuxer::read(),
+		/// runs on an I/O thread, and resumes it on a worker with fn's result.
+		/// </summary>
+		template<class F>
+		auto blocking(F fn) {
+			struct Awaiter {
+				Pipeline& pipeline;
+				F fn;
+				std::invoke_result_t<F&> result{};
+				std::coroutine_handle<> handle;
+
+				bool await_ready() const noexcept { return false; }
+
+				bool await_suspend(std::coroutine_handle<> awaiting) {
+					handle = awaiting;
+					const bool queued = pipeline.scheduler().submit_io([this] {
+						result = fn();
+						pipeline.resume(handle);
+					});
+					if (!queued) {
+						// Scheduler is shutting down, block the worker instead.
+						result = fn();
+					}
+					return queued;
+				}
+
+				auto await_resume() { return std::move(result); }
+			};
+			return Awaiter{ *this, std::move(fn), {}, {} };
+		}
+
+	private:
+		struct Completion {
+			std::mutex mutex;
+			std::condition_variable done;
+			size_t remaining = 0;
+		};
+
+		static void task_done(void* opaque);
+
+		UTLX::Scheduler& m_scheduler;
+		std::shared_ptr<UTLX::Job> m_job;
+		Arena m_arena;
+		std::atomic<int> m_error = 0;
+	};
+}
+
+#endif
\ No newline at end of file
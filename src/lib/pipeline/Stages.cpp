@@ -0,0 +1,153 @@
+/*
+ * Stages.cpp
+ *
+ * Demux, decode, encode and mux stages as coroutines.
+ */
+
+#include "Stages.h"
+
+#include <optional>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+using namespace FFPP;
+
+Generator<PooledPacketHandle> FFPP::demux(Pipeline& pipeline, Demuxer& demuxer, int stream_index)
+{
+	while (!pipeline.error()) {
+		PooledPacketHandle packet;
+		int ret = demuxer.poll(stream_index, packet);
+		if (ret == AVERROR(EAGAIN)) {
+			ret = co_await pipeline.blocking([&] { return demuxer.read(stream_index, packet); });
+		}
+		if (ret == AVERROR_EOF) {
+			co_return;
+		}
+		if (ret < 0) {
+			pipeline.fail(ret);
+			co_return;
+		}
+		co_yield std::move(packet);
+	}
+}
+
+Generator<PooledFrameHandle> FFPP::decode(Pipeline& pipeline, Decoder& decoder, Generator<PooledPacketHandle>& packets)
+{
+	while (!pipeline.error()) {
+		// Out of packets: a null packet drains the decoder.
+		std::optional<PooledPacketHandle> packet = co_await packets.next();
+		int ret = decoder.send(packet ? packet->get() : nullptr);
+		if (ret < 0) {
+			pipeline.fail(ret);
+			co_return;
+		}
+
+		while (true) {
+			PooledFrameHandle frame = make_pooled_frame();
+			ret = decoder.receive(frame.get());
+			if (ret == AVERROR(EAGAIN)) {
+				break;
+			}
+			if (ret == AVERROR_EOF) {
+				co_return;
+			}
+			if (ret < 0) {
+				pipeline.fail(ret);
+				co_return;
+			}
+			co_yield std::move(frame);
+		}
+	}
+}
+
+Generator<PooledFrameHandle> FFPP::filter(Pipeline& pipeline, FilterGraph& graph, Generator<PooledFrameHandle>& frames)
+{
+	while (!pipeline.error()) {
+		// Out of frames: a null frame flushes the graph.
+		std::optional<PooledFrameHandle> frame = co_await frames.next();
+		int ret = graph.push(frame ? frame->get() : nullptr);
+		if (ret < 0) {
+			pipeline.fail(ret);
+			co_return;
+		}
+
+		while (true) {
+			PooledFrameHandle filtered = make_pooled_frame();
+			ret = graph.pull(filtered.get());
+			if (ret == AVERROR(EAGAIN)) {
+				break;
+			}
+			if (ret == AVERROR_EOF) {
+				co_return;
+			}
+			if (ret < 0) {
+				pipeline.fail(ret);
+				co_return;
+			}
+			co_yield std::move(filtered);
+		}
+	}
+}
+
+Generator<PooledPacketHandle> FFPP::encode(Pipeline& pipeline, Encoder& encoder, Generator<PooledFrameHandle>& frames)
+{
+	std::optional<PooledFrameHandle> pending;
+	bool input_done = false;
+	bool flush_sent = false;
+
+	while (true) {
+		// Checked first: the worker queues its last packets before finishing.
+		const bool finished = encoder.finished();
+		PooledPacketHandle packet;
+		if (encoder.poll(packet)) {
+			co_yield std::move(packet);
+			continue;
+		}
+		if (finished) {
+			if (encoder.error() < 0) {
+				pipeline.fail(encoder.error());
+			}
+			co_return;
+		}
+
+		if (!pending && !input_done) {
+			pending = co_await frames.next();
+			input_done = !pending || pipeline.error();
+		}
+
+		// Output is polled between attempts, so a full output queue cannot
+		// stall the worker while we wait for input space.
+		bool progressed = false;
+		if (pending && !input_done) {
+			progressed = encoder.try_submit(pending->get());
+			if (progressed) {
+				pending.reset();
+			}
+		}
+		else if (!flush_sent) {
+			progressed = flush_sent = encoder.try_finish();
+		}
+		if (!progressed) {
+			co_await pipeline.yield();
+		}
+	}
+}
+
+Task<int> FFPP::mux(Pipeline& pipeline, Muxer& muxer, int stream_index, AVRational time_base,
+	Generator<PooledPacketHandle>& packets)
+{
+	while (std::optional<PooledPacketHandle> packet = co_await packets.next()) {
+		int ret = muxer.try_write(*packet, stream_index, time_base);
+		if (ret == AVERROR(EAGAIN)) {
+			ret = co_await pipeline.blocking([&] { return muxer.write(std::move(*packet), stream_index, time_base); });
+		}
+		if (ret < 0) {
+			pipeline.fail(ret);
+			break;
+		}
+	}
+	muxer.end_stream(stream_index);
+	co_return pipeline.error();
+}
\ No newline at end of file
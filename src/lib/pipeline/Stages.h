@@ -0,0 +1,63 @@
+/*
+ * Stages.h
+ *
+ * Demux, decode, encode and mux stages as coroutines.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_STAGES
+#define FFMPEG_PLUS_PLUS_STAGES
+
+#include "Coroutine.h"
+#include "Pipeline.h"
+#include "../FFPPHandle.h"
+#include "../codec/Decoder.h"
+#include "../codec/Encoder.h"
+#include "../filter/FilterGraph.h"
+#include "../format/Demuxer.h"
+#include "../format/Muxer.h"
+
+namespace FFPP {
+
+	// A transcode of one stream chains the stages:
+	//
+	//     Pipeline pipeline("transcode");
+	//     auto packets = demux(pipeline, demuxer, index);
+	//     auto frames = decode(pipeline, decoder, packets);
+	//     auto encoded = encode(pipeline, encoder, frames);
+	//     int ret = pipeline.run(mux(pipeline, muxer, 0, encoder->time_base, encoded));
+	//
+	// Stages take their inputs and components by reference; those have to
+	// outlive the stage. Errors are recorded with Pipeline::fail() and end
+	// the stage, which ends the stages consuming from it.
+
+	/// <summary>
+	/// Yields the packets of a started demuxer's stream. Waits for the
+	/// read-ahead thread on an I/O thread.
+	/// </summary>
+	Generator<PooledPacketHandle> demux(Pipeline& pipeline, Demuxer& demuxer, int stream_index);
+
+	/// <summary>
+	/// Yields the frames decoded from packets, draining the decoder at the end.
+	/// </summary>
+	Generator<PooledFrameHandle> decode(Pipeline& pipeline, Decoder& decoder, Generator<PooledPacketHandle>& packets);
+
+	/// <summary>
+	/// Yields the frames filtered from frames, flushing the graph at the end.
+	/// </summary>
+	Generator<PooledFrameHandle> filter(Pipeline& pipeline, FilterGraph& graph, Generator<PooledFrameHandle>& frames);
+
+	/// <summary>
+	/// Feeds frames to an opened encoder and yields its packets, flushing it
+	/// at the end. Yields the worker while the encoder's queues are full or empty.
+	/// </summary>
+	Generator<PooledPacketHandle> encode(Pipeline& pipeline, Encoder& encoder, Generator<PooledFrameHandle>& frames);
+
+	/// <summary>
+	/// Writes packets in time_base to a started muxer and ends the stream.
+	/// Waits for the muxer's writer on an I/O thread when its queue is full.
+	/// </summary>
+	Task<int> mux(Pipeline& pipeline, Muxer& muxer, int stream_index, AVRational time_base,
+		Generator<PooledPacketHandle>& packets);
+}
+
+#endif
\ No newline at end of file
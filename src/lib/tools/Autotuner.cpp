@@ -0,0 +1,515 @@
+/*
+ * Autotuner.cpp
+ *
+ * Searches encoder option sets for the best speed/quality trade-off.
+ */
+
+#include "Autotuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#include "../../utils/Logging/Logger.h"
+#include "../FFPPHandle.h"
+#include "../util/FFPPArgSchema.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/opt.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	/**
+	* @brief Accumulates the squared error of decoded pictures against the source.
+	*/
+	class PsnrAccumulator {
+	public:
+		void add(const AVFrame* src, const AVFrame* dec) {
+			for (int plane = 0; plane < 3; plane++) {
+				const int w = plane ? (src->width + 1) / 2 : src->width;
+				const int h = plane ? (src->height + 1) / 2 : src->height;
+				for (int y = 0; y < h; y++) {
+					const uint8_t* a = src->data[plane] + y * src->linesize[plane];
+					const uint8_t* b = dec->data[plane] + y * dec->linesize[plane];
+					uint64_t sse = 0;
+					for (int x = 0; x < w; x++) {
+						const int d = a[x] - b[x];
+						sse += d * d;
+					}
+					m_sse += sse;
+				}
+				m_samples += static_cast<uint64_t>(w) * h;
+			}
+		}
+
+		double psnr() const {
+			if (!m_samples) {
+				return std::numeric_limits<double>::quiet_NaN();
+			}
+			if (!m_sse) {
+				return 100.0;
+			}
+			const double mse = static_cast<double>(m_sse) / m_samples;
+			return 10.0 * std::log10(255.0 * 255.0 / mse);
+		}
+
+	private:
+		uint64_t m_sse = 0;
+		uint64_t m_samples = 0;
+	};
+
+	AVFrame* alloc_picture(int width, int height) {
+		AVFrame* frame = av_frame_alloc();
+		if (!frame) {
+			return nullptr;
+		}
+		frame->format = AV_PIX_FMT_YUV420P;
+		frame->width = width;
+		frame->height = height;
+		if (av_frame_get_buffer(frame, 0) < 0) {
+			av_frame_free(&frame);
+		}
+		return frame;
+	}
+}
+
+std::string
+Autotuner::Result::str() const
+{
+	std::stringstream s("");
+	s << std::fixed << std::setprecision(2)
+	  << std::setw(9) << fps << " fps "
+	  << std::setw(10) << bitrate / 1000.0 << " kb/s "
+	  << std::setw(7) << psnr << " dB ";
+	for (const auto& [name, value] : options) {
+		s << " " << name << "=" << value;
+	}
+	if (!valid) {
+		s << " (failed)";
+	}
+	return s.str();
+}
+
+Autotuner::Autotuner(const std::string& encoder_name)
+{
+	m_codec = encoder_name.empty()
+		? avcodec_find_encoder(AV_CODEC_ID_H264)
+		: avcodec_find_encoder_by_name(encoder_name.c_str());
+	if (!m_codec) {
+		LOG_ERROR("Autotuner: encoder '" + encoder_name + "' not found\n");
+	}
+}
+
+Autotuner::~Autotuner()
+{
+	free_clip();
+}
+
+void
+Autotuner::free_clip()
+{
+	for (AVFrame*& frame : m_clip) {
+		av_frame_free(&frame);
+	}
+	m_clip.clear();
+}
+
+bool
+Autotuner::generate_clip(int width, int height, int frame_count, int fps)
+{
+	free_clip();
+	m_fps = fps;
+
+	uint32_t seed = 0x2545F491u;
+	for (int n = 0; n < frame_count; n++) {
+		AVFrame* frame = alloc_picture(width, height);
+		if (!frame) {
+			LOG_ERROR("Autotuner: failed to allocate clip frame\n");
+			free_clip();
+			return false;
+		}
+
+		// Moving gradient with a sliding box and light noise, so that motion
+		// estimation and rate control have something to work on.
+		const int box_x = (n * 7) % std::max(1, width - width / 4);
+		const int box_y = (n * 3) % std::max(1, height - height / 4);
+		for (int y = 0; y < height; y++) {
+			uint8_t* row = frame->data[0] + y * frame->linesize[0];
+			for (int x = 0; x < width; x++) {
+				seed = seed * 1664525u + 1013904223u;
+				const bool in_box = x >= box_x && x < box_x + width / 4 && y >= box_y && y < box_y + height / 4;
+				const int value = in_box ? 235 - ((x ^ y) & 31) : ((x + y + 2 * n) & 0xff) / 2 + 32;
+				row[x] = static_cast<uint8_t>(std::clamp(value + static_cast<int>(seed >> 29) - 4, 16, 235));
+			}
+		}
+		for (int plane = 1; plane < 3; plane++) {
+			for (int y = 0; y < (height + 1) / 2; y++) {
+				uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+				for (int x = 0; x < (width + 1) / 2; x++) {
+					row[x] = static_cast<uint8_t>(128 + ((plane == 1 ? x + n : y - n) & 63) - 32);
+				}
+			}
+		}
+		frame->pts = n;
+		m_clip.push_back(frame);
+	}
+	return true;
+}
+
+bool
+Autotuner::load_clip(const std::string& yuv_path, int width, int height, int max_frames, int fps)
+{
+	free_clip();
+	m_fps = fps;
+
+	std::ifstream in(yuv_path, std::ios::binary);
+	if (!in.is_open()) {
+		LOG_ERROR("Autotuner: failed to open clip " + yuv_path + "\n");
+		return false;
+	}
+
+	for (int n = 0; n < max_frames; n++) {
+		AVFrame* frame = alloc_picture(width, height);
+		if (!frame) {
+			LOG_ERROR("Autotuner: failed to allocate clip frame\n");
+			free_clip();
+			return false;
+		}
+		bool complete = true;
+		for (int plane = 0; plane < 3 && complete; plane++) {
+			const int w = plane ? (width + 1) / 2 : width;
+			const int h = plane ? (height + 1) / 2 : height;
+			for (int y = 0; y < h && complete; y++) {
+				complete = static_cast<bool>(in.read(reinterpret_cast<char*>(frame->data[plane] + y * frame->linesize[plane]), w));
+			}
+		}
+		if (!complete) {
+			av_frame_free(&frame);
+			break;
+		}
+		frame->pts = n;
+		m_clip.push_back(frame);
+	}
+
+	if (m_clip.empty()) {
+		LOG_ERROR("Autotuner: clip " + yuv_path + " holds no complete frame\n");
+		return false;
+	}
+	return true;
+}
+
+const FFPPArgSchema*
+Autotuner::find_schema(const std::string& option) const
+{
+	const FFPPArgSchema& common = FFPPArgSchema::get(avcodec_get_class());
+	if (common.find(option)) {
+		return &common;
+	}
+	if (m_codec && m_codec->priv_class) {
+		const FFPPArgSchema& priv = FFPPArgSchema::get(m_codec->priv_class);
+		if (priv.find(option)) {
+			return &priv;
+		}
+	}
+	return nullptr;
+}
+
+bool
+Autotuner::in_range(const std::string& option, const std::string& value) const
+{
+	const FFPPArgSchema* schema = find_schema(option);
+	if (!schema) {
+		return false;
+	}
+
+	// Named constants ("medium", "slice", ...) are validated by av_opt_set().
+	char* end = nullptr;
+	const double number = std::strtod(value.c_str(), &end);
+	if (end == value.c_str() || *end != '\0') {
+		return true;
+	}
+
+	const auto index = *schema->find(option);
+	return number >= schema->min(index) && number <= schema->max(index);
+}
+
+bool
+Autotuner::set_fixed(const std::string& option, const std::string& value)
+{
+	if (!find_schema(option)) {
+		LOG_ERROR("Autotuner: unknown option '" + option + "'\n");
+		return false;
+	}
+	m_fixed.emplace_back(option, value);
+	return true;
+}
+
+bool
+Autotuner::add_dimension(const std::string& option, const std::vector<std::string>& values)
+{
+	if (!find_schema(option)) {
+		LOG_ERROR("Autotuner: unknown option '" + option + "'\n");
+		return false;
+	}
+
+	Dimension dimension{ option, {} };
+	for (const auto& value : values) {
+		if (in_range(option, value)) {
+			dimension.values.push_back(value);
+		}
+		else {
+			LOG_WARN("Autotuner: dropping " + option + "=" + value + " (out of range)\n");
+		}
+	}
+	if (dimension.values.empty()) {
+		return false;
+	}
+	m_dimensions.emplace_back(std::move(dimension));
+	return true;
+}
+
+bool
+Autotuner::add_range(const std::string& option, int64_t first, int64_t last, int64_t step)
+{
+	const FFPPArgSchema* schema = find_schema(option);
+	if (!schema || step <= 0) {
+		LOG_ERROR("Autotuner: invalid range for option '" + option + "'\n");
+		return false;
+	}
+
+	const auto index = *schema->find(option);
+	first = std::max<int64_t>(first, static_cast<int64_t>(std::ceil(schema->min(index))));
+	last = std::min<int64_t>(last, static_cast<int64_t>(std::floor(schema->max(index))));
+
+	std::vector<std::string> values;
+	for (int64_t value = first; value <= last; value += step) {
+		values.push_back(std::to_string(value));
+	}
+	return add_dimension(option, values);
+}
+
+const std::vector<Autotuner::Result>&
+Autotuner::run()
+{
+	m_results.clear();
+	if (!m_codec || m_clip.empty()) {
+		LOG_ERROR("Autotuner: no encoder or no clip\n");
+		return m_results;
+	}
+
+	size_t combinations = 1;
+	for (const auto& dimension : m_dimensions) {
+		combinations *= dimension.values.size();
+	}
+
+	std::vector<size_t> digits(m_dimensions.size(), 0);
+	for (size_t n = 0; n < combinations; n++) {
+		OptionSet options = m_fixed;
+		for (size_t d = 0; d < m_dimensions.size(); d++) {
+			options.emplace_back(m_dimensions[d].option, m_dimensions[d].values[digits[d]]);
+		}
+
+		Result result = measure(options);
+		LOG_INFO("Autotuner: " + result.str() + "\n");
+		m_results.emplace_back(std::move(result));
+
+		for (size_t d = 0; d < digits.size(); d++) {
+			if (++digits[d] < m_dimensions[d].values.size()) {
+				break;
+			}
+			digits[d] = 0;
+		}
+	}
+	return m_results;
+}
+
+Autotuner::Result
+Autotuner::measure(const OptionSet& options) const
+{
+	Result result;
+	result.options = options;
+	result.psnr = std::numeric_limits<double>::quiet_NaN();
+
+	const AVFrame* first = m_clip.front();
+	CodecContextHandle enc = make_codec_context(m_codec);
+	if (!enc) {
+		LOG_ERROR("Autotuner: failed to allocate encoder context\n");
+		return result;
+	}
+	enc->width = first->width;
+	enc->height = first->height;
+	enc->pix_fmt = AV_PIX_FMT_YUV420P;
+	enc->time_base = AVRational{ 1, m_fps };
+	enc->framerate = AVRational{ m_fps, 1 };
+
+	for (const auto& [name, value] : options) {
+		if (av_opt_set(enc.get(), name.c_str(), value.c_str(), AV_OPT_SEARCH_CHILDREN) < 0) {
+			LOG_WARN("Autotuner: encoder rejected " + name + "=" + value + "\n");
+			return result;
+		}
+	}
+	if (avcodec_open2(enc.get(), m_codec, nullptr) < 0) {
+		return result;
+	}
+
+	std::vector<PacketHandle> packets;
+	PacketHandle pkt = make_packet();
+	uint64_t bytes = 0;
+	bool ok = static_cast<bool>(pkt);
+
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t n = 0; ok && n <= m_clip.size(); n++) {
+		// The final iteration sends the flush request.
+		ok = avcodec_send_frame(enc.get(), n < m_clip.size() ? m_clip[n] : nullptr) >= 0;
+		while (ok) {
+			const int ret = avcodec_receive_packet(enc.get(), pkt.get());
+			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+				break;
+			}
+			ok = ret >= 0;
+			if (ok) {
+				bytes += pkt->size;
+				packets.emplace_back(av_packet_clone(pkt.get()));
+				av_packet_unref(pkt.get());
+			}
+		}
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	if (ok) {
+		result.valid = true;
+		result.fps = m_clip.size() / std::max(elapsed.count(), 1e-9);
+		result.bitrate = bytes * 8.0 * m_fps / m_clip.size();
+	}
+
+	// Decode outside of the timed section to measure the quality.
+	const AVCodec* decoder = avcodec_find_decoder(m_codec->id);
+	CodecContextHandle dec = decoder ? make_codec_context(decoder) : nullptr;
+	FrameHandle picture = make_frame();
+	if (ok && dec && picture) {
+		if (enc->extradata_size > 0) {
+			dec->extradata = static_cast<uint8_t*>(av_mallocz(enc->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE));
+			if (dec->extradata) {
+				std::copy_n(enc->extradata, enc->extradata_size, dec->extradata);
+				dec->extradata_size = enc->extradata_size;
+			}
+		}
+		if (avcodec_open2(dec.get(), decoder, nullptr) >= 0) {
+			PsnrAccumulator psnr;
+			int64_t index = 0;
+			for (size_t n = 0; n <= packets.size(); n++) {
+				if (avcodec_send_packet(dec.get(), n < packets.size() ? packets[n].get() : nullptr) < 0) {
+					break;
+				}
+				while (avcodec_receive_frame(dec.get(), picture.get()) >= 0) {
+					const int64_t pts = picture->pts != AV_NOPTS_VALUE ? picture->pts : index;
+					if (picture->format == AV_PIX_FMT_YUV420P && pts >= 0 && pts < static_cast<int64_t>(m_clip.size())) {
+						psnr.add(m_clip[pts], picture.get());
+					}
+					index++;
+					av_frame_unref(picture.get());
+				}
+			}
+			result.psnr = psnr.psnr();
+		}
+	}
+	else if (ok && !decoder) {
+		LOG_WARN("Autotuner: no decoder available, PSNR not measured\n");
+	}
+
+	return result;
+}
+
+std::vector<Autotuner::Result>
+Autotuner::pareto_front() const
+{
+	std::vector<Result> sorted;
+	for (const auto& result : m_results) {
+		if (result.valid && !std::isnan(result.psnr)) {
+			sorted.push_back(result);
+		}
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const Result& a, const Result& b) {
+		return a.fps != b.fps ? a.fps > b.fps : a.psnr > b.psnr;
+	});
+
+	// Walking from fastest to slowest, a result is optimal if it beats the
+	// quality of every faster one.
+	std::vector<Result> front;
+	double best_psnr = -std::numeric_limits<double>::infinity();
+	for (const auto& result : sorted) {
+		if (result.psnr > best_psnr) {
+			best_psnr = result.psnr;
+			front.push_back(result);
+		}
+	}
+	return front;
+}
+
+std::optional<Autotuner::Result>
+Autotuner::fastest_within(double min_psnr) const
+{
+	for (const auto& result : pareto_front()) {
+		if (result.psnr >= min_psnr) {
+			return result;
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<Autotuner::Result>
+Autotuner::best_within(double min_fps) const
+{
+	std::optional<Result> best;
+	for (const auto& result : pareto_front()) {
+		if (result.fps >= min_fps) {
+			best = result;
+		}
+	}
+	return best;
+}
+
+std::string
+Autotuner::report() const
+{
+	const auto front = pareto_front();
+	const auto is_optimal = [&front](const Result& result) {
+		return std::any_of(front.begin(), front.end(), [&result](const Result& other) {
+			return other.options == result.options;
+		});
+	};
+
+	std::stringstream s("");
+	s << "Autotuner results for " << (m_codec ? m_codec->name : "<none>")
+	  << " (" << m_clip.size() << " frames, " << m_results.size() << " configurations):\n";
+	for (const auto& result : m_results) {
+		s << (is_optimal(result) ? " * " : "   ") << result.str() << "\n";
+	}
+	return s.str();
+}
+
+bool
+Autotuner::write_preset(const Result& result, const std::string& path)
+{
+	std::ofstream out(path, std::ios::out | std::ios::trunc);
+	if (!out.is_open()) {
+		LOG_ERROR("Autotuner: failed to write preset " + path + "\n");
+		return false;
+	}
+	out << "# fps=" << result.fps << " bitrate=" << result.bitrate << " psnr=" << result.psnr << "\n";
+	for (const auto& [name, value] : result.options) {
+		out << name << "=" << value << "\n";
+	}
+	return out.good();
+}
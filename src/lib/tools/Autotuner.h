@@ -0,0 +1,130 @@
+/*
+ * Autotuner.h
+ *
+ * Searches encoder option sets for the best speed/quality trade-off.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_AUTOTUNER
+#define FFMPEG_PLUS_PLUS_AUTOTUNER
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct AVCodec;
+struct AVFrame;
+
+namespace FFPP {
+	class FFPPArgSchema;
+
+	/// <summary>
+	/// Autotuner encodes a fixed test clip once for every combination of the
+	/// swept encoder options and measures encoding speed, bitrate and PSNR
+	/// against the source. Option names and values are validated against the
+	/// FFPPArgSchema of AVCodecContext and of the encoder's private class.
+	/// </summary>
+	class Autotuner {
+	public:
+		typedef std::vector<std::pair<std::string, std::string>> OptionSet;
+
+		struct Result {
+			OptionSet options;
+			double fps = 0.0;      // Encoded frames per second (wall time)
+			double bitrate = 0.0;  // Bits per second at the clip frame rate
+			double psnr = 0.0;     // Global YUV PSNR in dB, NaN if not measured
+			bool valid = false;    // False if the encoder rejected the set
+
+			std::string str() const;
+		};
+
+		/// <summary>
+		/// Uses the named encoder, or the default H.264 encoder if empty.
+		/// </summary>
+		explicit Autotuner(const std::string& encoder_name = "");
+		~Autotuner();
+
+		Autotuner(const Autotuner&) = delete;
+		Autotuner& operator=(const Autotuner&) = delete;
+
+		/// <summary>
+		/// Generates a deterministic synthetic YUV420P clip.
+		/// </summary>
+		bool generate_clip(int width, int height, int frame_count, int fps = 25);
+
+		/// <summary>
+		/// Loads up to max_frames frames of a raw YUV420P file.
+		/// </summary>
+		bool load_clip(const std::string& yuv_path, int width, int height, int max_frames, int fps = 25);
+
+		/// <summary>
+		/// Option applied unchanged to every configuration, e.g. a target bitrate.
+		/// </summary>
+		bool set_fixed(const std::string& option, const std::string& value);
+
+		/// <summary>
+		/// Sweeps option over the given values. Values outside the option's
+		/// min/max are dropped.
+		/// </summary>
+		bool add_dimension(const std::string& option, const std::vector<std::string>& values);
+
+		/// <summary>
+		/// Sweeps a numeric option from first to last, clipped to its min/max.
+		/// </summary>
+		bool add_range(const std::string& option, int64_t first, int64_t last, int64_t step = 1);
+
+		/// <summary>
+		/// Encodes the clip with every combination of the swept options.
+		/// </summary>
+		const std::vector<Result>& run();
+
+		const std::vector<Result>& results() const { return m_results; }
+
+		/// <summary>
+		/// Results not dominated in both speed and quality, fastest first.
+		/// </summary>
+		std::vector<Result> pareto_front() const;
+
+		/// <summary>
+		/// Fastest result whose PSNR is at least min_psnr.
+		/// </summary>
+		std::optional<Result> fastest_within(double min_psnr) const;
+
+		/// <summary>
+		/// Highest quality result encoding at least min_fps frames per second.
+		/// </summary>
+		std::optional<Result> best_within(double min_fps) const;
+
+		/// <summary>
+		/// Table of all results, Pareto optimal ones are marked with '*'.
+		/// </summary>
+		std::string report() const;
+
+		/// <summary>
+		/// Writes the option set as an FFmpeg preset file (one key=value per line).
+		/// </summary>
+		static bool write_preset(const Result& result, const std::string& path);
+
+	private:
+		struct Dimension {
+			std::string option;
+			std::vector<std::string> values;
+		};
+
+		const FFPPArgSchema* find_schema(const std::string& option) const;
+		bool in_range(const std::string& option, const std::string& value) const;
+		Result measure(const OptionSet& options) const;
+		void free_clip();
+
+		const AVCodec* m_codec = nullptr;
+		std::vector<AVFrame*> m_clip;
+		int m_fps = 25;
+
+		OptionSet m_fixed;
+		std::vector<Dimension> m_dimensions;
+		std::vector<Result> m_results;
+	};
+}
+
+#endif
\ No newline at end of file
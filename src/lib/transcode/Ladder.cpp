@@ -0,0 +1,351 @@
+/*
+ * Ladder.cpp
+ *
+ * Decode-once, encode-many ABR ladder.
+ */
+
+#include "Ladder.h"
+
+#include <algorithm>
+
+#include "../codec/Decoder.h"
+#include "../format/Demuxer.h"
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/dict.h>
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+}
+
+using namespace FFPP;
+
+FFPP::Ladder::Ladder()
+	: Ladder(Config())
+{
+}
+
+FFPP::Ladder::Ladder(const Config& config)
+	: m_config(config)
+{
+}
+
+FFPP::Ladder::~Ladder()
+{
+	close_lanes();
+}
+
+int FFPP::Ladder::add_rendition(const Rendition& rendition)
+{
+	if (rendition.width <= 0 || rendition.height <= 0 || rendition.output.empty()) {
+		return AVERROR(EINVAL);
+	}
+	Scaler::Config scaler_config;
+	scaler_config.flags = m_config.sws_flags;
+	auto lane = std::make_unique<Lane>(std::max<size_t>(1, m_config.queue_capacity), scaler_config);
+	lane->rendition = rendition;
+	m_lanes.push_back(std::move(lane));
+	return static_cast<int>(m_lanes.size()) - 1;
+}
+
+int FFPP::Ladder::run(const std::string& input)
+{
+	if (m_lanes.empty()) {
+		return AVERROR(EINVAL);
+	}
+
+	Demuxer demuxer;
+	int ret = demuxer.open(input);
+	if (ret < 0) {
+		return ret;
+	}
+	const int stream_index = demuxer.select_best(AVMEDIA_TYPE_VIDEO);
+	if (stream_index < 0) {
+		LOG_ERROR("Ladder: no video stream\n");
+		return stream_index;
+	}
+	const AVStream* st = demuxer.stream(stream_index);
+	m_time_base = st->time_base;
+	const AVRational frame_rate = st->avg_frame_rate.num > 0 ? st->avg_frame_rate : st->r_frame_rate;
+
+	Decoder decoder(st->codecpar, Decoder::Config());
+	if (!decoder.get()) {
+		return AVERROR(EINVAL);
+	}
+	decoder->pkt_timebase = st->time_base;
+	ret = decoder.open();
+	if (ret < 0) {
+		return ret;
+	}
+
+	plan();
+	for (auto& lane : m_lanes) {
+		ret = open_lane(*lane, decoder.get(), frame_rate);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	for (auto& lane : m_lanes) {
+		lane->thread = std::thread(&Ladder::run_lane, this, std::ref(*lane));
+	}
+
+	ret = demuxer.start();
+
+	// Keyframes are decided once on the source frames, so every rendition
+	// starts its GOPs on the same pictures.
+	const int64_t gop = std::max<int64_t>(1, av_rescale_q(m_config.gop_duration, AV_TIME_BASE_Q, m_time_base));
+	int64_t next_keyframe = AV_NOPTS_VALUE;
+	bool fan_out_failed = false;
+	auto fan_out = [&](AVFrame* frame) {
+		const int64_t pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+		frame->pts = pts;
+		if (pts != AV_NOPTS_VALUE && (next_keyframe == AV_NOPTS_VALUE || pts >= next_keyframe)) {
+			frame->pict_type = AV_PICTURE_TYPE_I;
+			frame->flags |= AV_FRAME_FLAG_KEY;
+			next_keyframe = next_keyframe == AV_NOPTS_VALUE ? pts + gop : next_keyframe + gop;
+			while (next_keyframe <= pts) {
+				next_keyframe += gop;
+			}
+		}
+		else {
+			frame->pict_type = AV_PICTURE_TYPE_NONE;
+			frame->flags &= ~AV_FRAME_FLAG_KEY;
+		}
+
+		for (Lane* root : m_roots) {
+			PooledFrameHandle ref = make_pooled_frame();
+			if (!ref || av_frame_ref(ref.get(), frame) < 0 || !root->input.push(std::move(ref))) {
+				fan_out_failed = true;
+			}
+		}
+	};
+
+	PooledPacketHandle packet;
+	while (ret >= 0 && !fan_out_failed) {
+		ret = demuxer.read(stream_index, packet);
+		if (ret < 0) {
+			break;
+		}
+		ret = decoder.decode(packet.get(), fan_out);
+		packet.reset();
+		if (ret == AVERROR_INVALIDDATA) {
+			ret = 0;
+		}
+	}
+	if (ret == AVERROR_EOF) {
+		ret = decoder.decode(nullptr, fan_out);
+	}
+	if (ret >= 0 && fan_out_failed) {
+		ret = AVERROR(ENOMEM);
+	}
+	demuxer.stop();
+
+	// Lanes close their children and finish their outputs once their input ends.
+	for (Lane* root : m_roots) {
+		root->input.close();
+	}
+	for (auto& lane : m_lanes) {
+		lane->thread.join();
+		if (ret >= 0 && lane->error < 0) {
+			ret = lane->error;
+		}
+	}
+	return ret;
+}
+
+std::vector<Ladder::RenditionStats> FFPP::Ladder::stats() const
+{
+	std::vector<RenditionStats> stats;
+	for (const auto& lane : m_lanes) {
+		RenditionStats& s = stats.emplace_back();
+		s.parent = lane->parent;
+		if (lane->encoder) {
+			s.frames = lane->encoder->frames_in();
+			s.packets = lane->encoder->packets_out();
+		}
+	}
+	return stats;
+}
+
+void FFPP::Ladder::plan()
+{
+	m_roots.clear();
+	for (auto& lane : m_lanes) {
+		lane->parent = -1;
+		lane->children.clear();
+	}
+
+	// Largest first; each rendition scales from the smallest rendition that
+	// is still at least as large in both dimensions.
+	std::vector<int> order(m_lanes.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = static_cast<int>(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+		const Rendition& ra = m_lanes[a]->rendition;
+		const Rendition& rb = m_lanes[b]->rendition;
+		return static_cast<int64_t>(ra.width) * ra.height > static_cast<int64_t>(rb.width) * rb.height;
+	});
+
+	for (size_t i = 0; i < order.size(); i++) {
+		Lane& lane = *m_lanes[order[i]];
+		for (size_t j = i; j-- > 0;) {
+			const Rendition& candidate = m_lanes[order[j]]->rendition;
+			if (candidate.width >= lane.rendition.width && candidate.height >= lane.rendition.height) {
+				lane.parent = order[j];
+				break;
+			}
+		}
+		if (lane.parent < 0) {
+			m_roots.push_back(&lane);
+		}
+		else {
+			m_lanes[lane.parent]->children.push_back(&lane);
+		}
+	}
+}
+
+int FFPP::Ladder::open_lane(Lane& lane, const AVCodecContext* source, AVRational frame_rate)
+{
+	const Rendition& rendition = lane.rendition;
+	int ret = lane.muxer.open(rendition.output, rendition.format_name);
+	if (ret < 0) {
+		return ret;
+	}
+
+	Encoder::Config config;
+	config.codec_name = rendition.codec_name;
+	config.codec_id = rendition.codec_id;
+	config.thread_count = m_config.encoder_threads;
+	lane.encoder = std::make_unique<Encoder>(config);
+	Encoder& encoder = *lane.encoder;
+	if (!encoder.get()) {
+		return AVERROR_ENCODER_NOT_FOUND;
+	}
+
+	encoder->width = rendition.width;
+	encoder->height = rendition.height;
+	encoder->pix_fmt = source->pix_fmt;
+	encoder->sample_aspect_ratio = source->sample_aspect_ratio;
+	encoder->color_range = source->color_range;
+	encoder->color_primaries = source->color_primaries;
+	encoder->color_trc = source->color_trc;
+	encoder->colorspace = source->colorspace;
+	encoder->framerate = frame_rate;
+	encoder->time_base = frame_rate.num > 0 ? av_inv_q(frame_rate) : m_time_base;
+	encoder->bit_rate = rendition.bit_rate;
+	// Keyframes come from the forced GOP boundaries; keep the encoder from
+	// placing its own in between.
+	if (frame_rate.num > 0) {
+		encoder->gop_size = static_cast<int>(2 * av_rescale_q(m_config.gop_duration, AV_TIME_BASE_Q, av_inv_q(frame_rate)));
+	}
+	if (lane.muxer->oformat->flags & AVFMT_GLOBALHEADER) {
+		encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
+
+	encoder.set_packet_callback([&lane](PooledPacketHandle packet) {
+		lane.muxer.write(std::move(packet), lane.stream_index, lane.encoder->get()->time_base);
+	});
+	encoder.set_finished_callback([&lane](int) {
+		lane.encoded.store(true, std::memory_order_release);
+		lane.encoded.notify_all();
+	});
+
+	AVDictionary* options = nullptr;
+	ret = av_dict_parse_string(&options, rendition.encoder_options.c_str(), "=", ":", 0);
+	if (ret >= 0) {
+		ret = encoder.open(&options);
+	}
+	av_dict_free(&options);
+	if (ret < 0) {
+		return ret;
+	}
+
+	lane.stream_index = lane.muxer.add_stream(encoder.get());
+	if (lane.stream_index < 0) {
+		return lane.stream_index;
+	}
+	return lane.muxer.start();
+}
+
+void FFPP::Ladder::run_lane(Lane& lane)
+{
+	Encoder& encoder = *lane.encoder;
+	const AVRational encoder_time_base = encoder->time_base;
+
+	while (auto frame = lane.input.pop()) {
+		if (lane.error < 0) {
+			continue; // Keep draining so the parent never blocks on us
+		}
+
+		PooledFrameHandle scaled;
+		int ret = scale(lane, frame->get(), scaled);
+		if (ret < 0) {
+			lane.error = ret;
+			continue;
+		}
+
+		for (Lane* child : lane.children) {
+			PooledFrameHandle ref = make_pooled_frame();
+			if (ref && av_frame_ref(ref.get(), scaled.get()) >= 0) {
+				child->input.push(std::move(ref));
+			}
+		}
+
+		if (scaled->pts != AV_NOPTS_VALUE) {
+			scaled->pts = av_rescale_q(scaled->pts, m_time_base, encoder_time_base);
+		}
+		if (!encoder.submit(scaled.get())) {
+			lane.error = encoder.error() < 0 ? encoder.error() : AVERROR_EXTERNAL;
+		}
+	}
+
+	for (Lane* child : lane.children) {
+		child->input.close();
+	}
+
+	if (encoder.finish()) {
+		for (bool done = lane.encoded.load(std::memory_order_acquire); !done; done = lane.encoded.load(std::memory_order_acquire)) {
+			lane.encoded.wait(false, std::memory_order_acquire);
+		}
+	}
+	if (lane.error == 0 && encoder.error() < 0) {
+		lane.error = encoder.error();
+	}
+	encoder.stop();
+
+	lane.muxer.end_stream(lane.stream_index);
+	const int ret = lane.muxer.finish();
+	if (lane.error == 0 && ret < 0) {
+		lane.error = ret;
+	}
+}
+
+int FFPP::Ladder::scale(Lane& lane, const AVFrame* src, PooledFrameHandle& dst)
+{
+	const Rendition& rendition = lane.rendition;
+	dst = make_pooled_frame();
+	if (!dst) {
+		return AVERROR(ENOMEM);
+	}
+	if (src->width == rendition.width && src->height == rendition.height) {
+		return av_frame_ref(dst.get(), src);
+	}
+
+	dst->format = src->format;
+	dst->width = rendition.width;
+	dst->height = rendition.height;
+	return lane.scaler.scale(dst.get(), src);
+}
+
+void FFPP::Ladder::close_lanes()
+{
+	for (auto& lane : m_lanes) {
+		lane->input.close();
+	}
+	for (auto& lane : m_lanes) {
+		if (lane->thread.joinable()) {
+			lane->thread.join();
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,111 @@
+/*
+ * Ladder.h
+ *
+ * Decode-once, encode-many ABR ladder.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_LADDER
+#define FFMPEG_PLUS_PLUS_LADDER
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../FFPPHandle.h"
+#include "../codec/Encoder.h"
+#include "../filter/Scaler.h"
+#include "../format/Muxer.h"
+#include "../../utils/Concurrency/SpscQueue.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Ladder decodes the video stream of an input once and encodes it into
+	/// several renditions. Every rendition has a lane thread that scales the
+	/// frames of its parent, the source or the next larger rendition, so
+	/// downscales cascade (1080p feeds 720p, 720p feeds 480p). Frames are
+	/// handed on by reference, never copied, and each rendition encodes and
+	/// muxes in parallel with the others. Keyframes are forced on the same
+	/// source frames in every rendition so segment boundaries line up.
+	/// </summary>
+	class Ladder {
+	public:
+		struct Rendition {
+			std::string output;
+			std::string format_name = "";
+			int width = 0;
+			int height = 0;
+			std::string codec_name = "";          // Takes precedence over codec_id
+			AVCodecID codec_id = AV_CODEC_ID_H264;
+			int64_t bit_rate = 0;
+			std::string encoder_options = "";     // "key=value:key=value"
+		};
+
+		struct Config {
+			int64_t gop_duration = 2000000;       // AV_TIME_BASE units, shared by every rendition
+			int sws_flags = SWS_BICUBIC;
+			size_t queue_capacity = 8;            // Frames waiting per lane
+			int encoder_threads = 0;              // Per rendition, 0 lets FFmpeg decide
+		};
+
+		struct RenditionStats {
+			int parent = -1;                      // Rendition scaled from, -1 for the source
+			uint64_t frames = 0;
+			uint64_t packets = 0;
+		};
+
+		Ladder();
+		explicit Ladder(const Config& config);
+		~Ladder();
+
+		Ladder(const Ladder&) = delete;
+		Ladder& operator=(const Ladder&) = delete;
+
+		/// <summary>
+		/// Adds a rendition, returns its index.
+		/// </summary>
+		int add_rendition(const Rendition& rendition);
+
+		/// <summary>
+		/// Runs the whole ladder for input and returns once every output is
+		/// finished. A ladder runs once.
+		/// </summary>
+		int run(const std::string& input);
+
+		std::vector<RenditionStats> stats() const;
+
+	private:
+		struct Lane {
+			Lane(size_t capacity, const Scaler::Config& scaler_config) : input(capacity), scaler(scaler_config) {}
+
+			Rendition rendition;
+			int parent = -1;
+			std::vector<Lane*> children;
+
+			UTLX::SpscQueue<PooledFrameHandle> input;
+			Scaler scaler;
+			std::unique_ptr<Encoder> encoder;
+			Muxer muxer;
+			int stream_index = -1;
+
+			std::thread thread;
+			std::atomic<bool> encoded = false;
+			std::atomic<int> error = 0;
+		};
+
+		void plan();
+		int open_lane(Lane& lane, const AVCodecContext* source, AVRational frame_rate);
+		void run_lane(Lane& lane);
+		int scale(Lane& lane, const AVFrame* src, PooledFrameHandle& dst);
+		void close_lanes();
+
+		Config m_config;
+		std::vector<std::unique_ptr<Lane>> m_lanes;   // Indexed by rendition
+		std::vector<Lane*> m_roots;                   // Lanes fed by the decoder
+		AVRational m_time_base{ 0, 1 };               // Source stream
+	};
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,236 @@
+/*
+ * Remuxer.cpp
+ *
+ * Stream copy from one container to another.
+ */
+
+#include "Remuxer.h"
+
+#include <algorithm>
+#include <string_view>
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/dict.h>
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	bool is_any(std::string_view name, std::initializer_list<std::string_view> names) {
+		return std::find(names.begin(), names.end(), name) != names.end();
+	}
+}
+
+FFPP::Remuxer::Remuxer()
+	: Remuxer(Config())
+{
+}
+
+FFPP::Remuxer::Remuxer(const Config& config)
+	: m_config(config)
+{
+}
+
+std::string FFPP::Remuxer::required_bsf(const AVCodecParameters* par, const AVOutputFormat* format)
+{
+	const std::string_view name = format->name;
+	const bool annexb_output = is_any(name, { "mpegts", "hls", "h264", "hevc" });
+	const bool asc_output = is_any(name, { "mp4", "mov", "ipod", "ismv", "3gp", "3g2", "psp", "f4v", "matroska", "flv" });
+
+	// avcC/hvcC extradata starts with version 1, Annex B with a start code.
+	const bool length_prefixed = par->extradata_size > 0 && par->extradata[0] == 1;
+	switch (par->codec_id) {
+		case AV_CODEC_ID_H264:
+			return annexb_output && length_prefixed ? "h264_mp4toannexb" : "";
+		case AV_CODEC_ID_HEVC:
+			return annexb_output && length_prefixed ? "hevc_mp4toannexb" : "";
+		case AV_CODEC_ID_AAC:
+			// ADTS carries its configuration in every frame instead of extradata.
+			return asc_output && par->extradata_size == 0 ? "aac_adtstoasc" : "";
+		default:
+			return "";
+	}
+}
+
+int FFPP::Remuxer::run(const std::string& input, const std::string& output)
+{
+	const auto start = std::chrono::steady_clock::now();
+	m_stats = Stats();
+
+	Demuxer demuxer(m_config.demuxer);
+	int ret = demuxer.open(input);
+	if (ret < 0) {
+		return ret;
+	}
+	Muxer muxer(m_config.muxer);
+	ret = muxer.open(output, m_config.format_name);
+	if (ret < 0) {
+		return ret;
+	}
+
+	std::vector<Route> routes(demuxer->nb_streams);
+	std::vector<int> pending;
+	for (int i = 0; i < static_cast<int>(routes.size()); i++) {
+		const AVStream* in = demuxer.stream(i);
+		const AVMediaType type = in->codecpar->codec_type;
+		if (type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_SUBTITLE) {
+			continue;
+		}
+		if (avformat_query_codec(muxer->oformat, in->codecpar->codec_id, FF_COMPLIANCE_NORMAL) == 0) {
+			LOG_WARN("Remuxer: skipping stream " + std::to_string(i) + ", " + avcodec_get_name(in->codecpar->codec_id)
+				+ " is not supported by " + muxer->oformat->name + "\n");
+			continue;
+		}
+
+		Route& route = routes[i];
+		const AVCodecParameters* par = in->codecpar;
+		route.time_base = in->time_base;
+		const std::string bsf = m_config.auto_bsf ? required_bsf(in->codecpar, muxer->oformat) : "";
+		if (!bsf.empty()) {
+			route.bsf = std::make_unique<BitstreamFilter>();
+			ret = route.bsf->open(bsf, in->codecpar, in->time_base);
+			if (ret < 0) {
+				return ret;
+			}
+			par = route.bsf->parameters();
+			route.time_base = route.bsf->time_base();
+		}
+
+		route.output = muxer.add_stream(par, route.time_base);
+		if (route.output < 0) {
+			return route.output;
+		}
+		AVStream* out = muxer->streams[route.output];
+		out->sample_aspect_ratio = in->sample_aspect_ratio;
+		out->avg_frame_rate = in->avg_frame_rate;
+		out->disposition = in->disposition;
+		av_dict_copy(&out->metadata, in->metadata, 0);
+
+		if (!m_config.keep_timestamps && demuxer->start_time != AV_NOPTS_VALUE) {
+			route.offset = av_rescale_q(demuxer->start_time, AV_TIME_BASE_Q, route.time_base);
+		}
+		m_stats.streams.push_back(StreamStats{ i, bsf, 0, 0 });
+		demuxer.select(i);
+		pending.push_back(i);
+	}
+	if (pending.empty()) {
+		LOG_ERROR("Remuxer: no stream to copy\n");
+		return AVERROR_STREAM_NOT_FOUND;
+	}
+	av_dict_copy(&muxer->metadata, demuxer->metadata, 0);
+
+	ret = muxer.start();
+	if (ret < 0) {
+		return ret;
+	}
+	ret = demuxer.start();
+
+	// Queued packets of every stream are taken without waiting; only when
+	// all queues are dry do we wait for the reader, on any stream at once.
+	while (ret >= 0 && !pending.empty()) {
+		bool progressed = false;
+		for (size_t k = 0; ret >= 0 && k < pending.size();) {
+			const int index = pending[k];
+			PooledPacketHandle packet;
+			while ((ret = demuxer.poll(index, packet)) == 0) {
+				ret = copy(muxer, routes[index], std::move(packet));
+				progressed = true;
+				if (ret < 0) {
+					break;
+				}
+			}
+			if (ret == AVERROR_EOF) {
+				ret = end(muxer, routes[index]);
+				pending.erase(pending.begin() + k);
+				progressed = true;
+				continue;
+			}
+			if (ret == AVERROR(EAGAIN)) {
+				ret = 0;
+			}
+			k++;
+		}
+
+		if (ret >= 0 && !progressed && !pending.empty()) {
+			// The end of input comes out of poll() on the next pass.
+			ret = demuxer.wait_any();
+			if (ret == AVERROR_EOF) {
+				ret = 0;
+			}
+		}
+	}
+
+	demuxer.stop();
+	const int finished = muxer.finish();
+	m_stats.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	if (ret < 0) {
+		LOG_ERROR("Remuxer: copying " + input + " failed\n");
+		return ret;
+	}
+	return finished;
+}
+
+int FFPP::Remuxer::copy(Muxer& muxer, Route& route, PooledPacketHandle packet)
+{
+	m_stats.packets++;
+	m_stats.bytes += packet->size;
+	if (!route.bsf) {
+		return write(muxer, route, std::move(packet));
+	}
+
+	const int ret = route.bsf->send(packet.get());
+	return ret < 0 ? ret : drain(muxer, route);
+}
+
+int FFPP::Remuxer::drain(Muxer& muxer, Route& route)
+{
+	while (true) {
+		PooledPacketHandle packet = make_pooled_packet();
+		int ret = route.bsf->receive(packet.get());
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+			return 0;
+		}
+		if (ret >= 0) {
+			ret = write(muxer, route, std::move(packet));
+		}
+		if (ret < 0) {
+			return ret;
+		}
+	}
+}
+
+int FFPP::Remuxer::write(Muxer& muxer, Route& route, PooledPacketHandle packet)
+{
+	if (route.offset) {
+		if (packet->pts != AV_NOPTS_VALUE) {
+			packet->pts -= route.offset;
+		}
+		if (packet->dts != AV_NOPTS_VALUE) {
+			packet->dts -= route.offset;
+		}
+	}
+	packet->pos = -1;
+
+	StreamStats& stats = m_stats.streams[route.output];
+	stats.packets++;
+	stats.bytes += packet->size;
+	return muxer.write(std::move(packet), route.output, route.time_base);
+}
+
+int FFPP::Remuxer::end(Muxer& muxer, Route& route)
+{
+	int ret = 0;
+	if (route.bsf) {
+		ret = route.bsf->send(nullptr);
+		if (ret >= 0) {
+			ret = drain(muxer, route);
+		}
+	}
+	muxer.end_stream(route.output);
+	return ret;
+}
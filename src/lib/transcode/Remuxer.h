@@ -0,0 +1,96 @@
+/*
+ * Remuxer.h
+ *
+ * Stream copy from one container to another.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_REMUXER
+#define FFMPEG_PLUS_PLUS_REMUXER
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../FFPPHandle.h"
+#include "../codec/BitstreamFilter.h"
+#include "../format/Demuxer.h"
+#include "../format/Muxer.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Remuxer copies the audio, video and subtitle streams of an input into
+	/// another container without decoding. Packets go by reference from the
+	/// demuxer's read-ahead thread to the muxer's writer thread; only streams
+	/// whose bitstream format differs between the containers pass through a
+	/// bitstream filter, chosen automatically (h264_mp4toannexb and
+	/// hevc_mp4toannexb into MPEG-TS, aac_adtstoasc into MP4, Matroska and
+	/// FLV). The muxer rescales timestamps, payloads are left alone.
+	/// </summary>
+	class Remuxer {
+	public:
+		struct Config {
+			std::string format_name = "";         // Guessed from the output name if empty
+			bool auto_bsf = true;
+			bool keep_timestamps = false;         // Else the output starts where the input starts, at zero
+			Demuxer::Config demuxer;
+			Muxer::Config muxer;
+		};
+
+		struct StreamStats {
+			int input_index = -1;
+			std::string bsf;                      // Chain applied, empty if none
+			uint64_t packets = 0;
+			uint64_t bytes = 0;
+		};
+
+		struct Stats {
+			uint64_t packets = 0;
+			uint64_t bytes = 0;                   // Read from the input
+			std::chrono::nanoseconds time{ 0 };
+			std::vector<StreamStats> streams;     // Per output stream
+
+			double bytes_per_second() const {
+				return time.count() ? bytes * 1e9 / static_cast<double>(time.count()) : 0.0;
+			}
+		};
+
+		Remuxer();
+		explicit Remuxer(const Config& config);
+
+		Remuxer(const Remuxer&) = delete;
+		Remuxer& operator=(const Remuxer&) = delete;
+
+		/// <summary>
+		/// Copies input into output and returns once the output is finished.
+		/// Streams the output format cannot hold are skipped.
+		/// </summary>
+		int run(const std::string& input, const std::string& output);
+
+		Stats stats() const { return m_stats; }
+
+		/// <summary>
+		/// Bitstream filters packets of a stream with par need in format.
+		/// </summary>
+		static std::string required_bsf(const AVCodecParameters* par, const AVOutputFormat* format);
+
+	private:
+		struct Route {
+			int output = -1;
+			std::unique_ptr<BitstreamFilter> bsf;
+			AVRational time_base{ 0, 1 };
+			int64_t offset = 0;                   // Subtracted from timestamps, in time_base
+		};
+
+		int copy(Muxer& muxer, Route& route, PooledPacketHandle packet);
+		int drain(Muxer& muxer, Route& route);
+		int write(Muxer& muxer, Route& route, PooledPacketHandle packet);
+		int end(Muxer& muxer, Route& route);
+
+		Config m_config;
+		Stats m_stats;
+	};
+}
+
+#endif
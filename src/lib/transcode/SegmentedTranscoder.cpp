@@ -0,0 +1,472 @@
+/*
+ * SegmentedTranscoder.cpp
+ *
+ * Transcodes GOP-aligned segments of one input in parallel.
+ */
+
+#include "SegmentedTranscoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "../codec/Decoder.h"
+#include "../codec/Threading.h"
+#include "../../utils/Concurrency/Scheduler.h"
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/dict.h>
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	// Longest reorder delay covered when rewriting dts at the seams.
+	constexpr size_t MaxReorderDelay = 16;
+}
+
+FFPP::SegmentedTranscoder::SegmentedTranscoder()
+	: SegmentedTranscoder(Config())
+{
+}
+
+FFPP::SegmentedTranscoder::SegmentedTranscoder(const Config& config)
+	: m_config(config)
+{
+}
+
+void FFPP::SegmentedTranscoder::set_configure_callback(ConfigureCallback callback)
+{
+	m_configure = std::move(callback);
+}
+
+int FFPP::SegmentedTranscoder::transcode(const std::string& input, const std::string& output, const std::string& format_name)
+{
+	m_abort = false;
+	m_tail.clear();
+	m_last_dts = AV_NOPTS_VALUE;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats = Stats();
+	}
+
+	int ret = probe(input);
+	if (ret < 0) {
+		return ret;
+	}
+
+	KeyframeIndex index;
+	ret = m_config.keyframe_sidecar ? index.open(input) : index.build(input);
+	if (ret < 0) {
+		return ret;
+	}
+	const KeyframeIndex::Stream* indexed = index.stream(m_stream_index);
+	std::vector<Segment> segments = indexed ? plan(*indexed) : std::vector<Segment>();
+	if (segments.empty()) {
+		LOG_ERROR("SegmentedTranscoder: no keyframes in the video stream\n");
+		return AVERROR_INVALIDDATA;
+	}
+
+	Muxer muxer;
+	ret = muxer.open(output, format_name);
+	if (ret < 0) {
+		return ret;
+	}
+	m_global_header = (muxer->oformat->flags & AVFMT_GLOBALHEADER) != 0;
+
+	// The reference encoder defines the stream's parameters and extradata,
+	// every segment encoder has to agree with it.
+	CodecContextHandle reference;
+	ret = open_encoder(reference);
+	if (ret < 0) {
+		return ret;
+	}
+	m_extradata.assign(reference->extradata, reference->extradata + reference->extradata_size);
+	m_encoder_time_base = reference->time_base;
+
+	const int stream_index = muxer.add_stream(reference.get());
+	if (stream_index < 0) {
+		return stream_index;
+	}
+	reference.reset();
+	ret = muxer.start();
+	if (ret < 0) {
+		return ret;
+	}
+
+	UTLX::Scheduler& scheduler = UTLX::Scheduler::get_instance();
+	const unsigned parallelism = std::max(1u, m_config.parallelism ? m_config.parallelism : scheduler.worker_count());
+	const auto job = scheduler.create_job("segmented transcode", 1, parallelism);
+
+	// At most parallelism segments hold their packets; segment i + parallelism
+	// starts once segment i is muxed.
+	size_t submitted = 0;
+	for (size_t i = 0; i < segments.size() && ret >= 0; i++) {
+		for (; submitted < segments.size() && submitted < i + parallelism; submitted++) {
+			Segment* segment = &segments[submitted];
+			scheduler.submit(job, [this, segment] { run_segment(*segment); });
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_segment_done.wait(lock, [&] { return segments[i].done; });
+		}
+		ret = segments[i].error < 0 ? segments[i].error : commit(muxer, stream_index, segments[i]);
+	}
+
+	if (ret < 0) {
+		m_abort = true;
+		scheduler.wait(*job);
+		muxer.finish();
+		return ret;
+	}
+
+	muxer.end_stream(stream_index);
+	return muxer.finish();
+}
+
+FFPP::SegmentedTranscoder::Stats FFPP::SegmentedTranscoder::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+int FFPP::SegmentedTranscoder::default_configure(AVCodecContext* encoder, const AVCodecContext* source)
+{
+	encoder->width = source->width;
+	encoder->height = source->height;
+	encoder->pix_fmt = source->pix_fmt;
+	encoder->sample_aspect_ratio = source->sample_aspect_ratio;
+	encoder->color_range = source->color_range;
+	encoder->color_primaries = source->color_primaries;
+	encoder->color_trc = source->color_trc;
+	encoder->colorspace = source->colorspace;
+	encoder->chroma_sample_location = source->chroma_sample_location;
+	encoder->framerate = source->framerate;
+	encoder->time_base = source->framerate.num > 0 ? av_inv_q(source->framerate) : source->pkt_timebase;
+	return 0;
+}
+
+int FFPP::SegmentedTranscoder::probe(const std::string& input)
+{
+	FormatInputHandle ctx;
+	int ret = avformat_open_input(ctx.out(), input.c_str(), nullptr, nullptr);
+	if (ret < 0) {
+		LOG_ERROR("SegmentedTranscoder: could not open " + input + "\n");
+		return ret;
+	}
+	ret = avformat_find_stream_info(ctx.get(), nullptr);
+	if (ret < 0) {
+		LOG_ERROR("SegmentedTranscoder: could not find stream info\n");
+		return ret;
+	}
+	ret = av_find_best_stream(ctx.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (ret < 0) {
+		LOG_ERROR("SegmentedTranscoder: no video stream\n");
+		return ret;
+	}
+
+	const AVStream* st = ctx->streams[ret];
+	m_url = input;
+	m_stream_index = ret;
+	m_time_base = st->time_base;
+
+	m_par.reset(avcodec_parameters_alloc());
+	m_source = make_codec_context(nullptr);
+	if (!m_par || !m_source) {
+		return AVERROR(ENOMEM);
+	}
+	ret = avcodec_parameters_copy(m_par.get(), st->codecpar);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = avcodec_parameters_to_context(m_source.get(), st->codecpar);
+	if (ret < 0) {
+		return ret;
+	}
+	m_source->pkt_timebase = st->time_base;
+	m_source->framerate = st->avg_frame_rate.num > 0 ? st->avg_frame_rate : st->r_frame_rate;
+	return 0;
+}
+
+std::vector<SegmentedTranscoder::Segment> FFPP::SegmentedTranscoder::plan(const KeyframeIndex::Stream& stream) const
+{
+	const int64_t target = std::max<int64_t>(1, av_rescale_q(m_config.segment_duration, AV_TIME_BASE_Q, stream.time_base));
+
+	std::vector<Segment> segments;
+	for (const KeyframeIndex::Keyframe& keyframe : stream.keyframes) {
+		if (!segments.empty() && keyframe.pts - segments.back().start < target) {
+			continue;
+		}
+		if (!segments.empty()) {
+			segments.back().end = keyframe.pts;
+		}
+		Segment& segment = segments.emplace_back();
+		segment.start = keyframe.pts;
+		segment.seek_dts = keyframe.dts != AV_NOPTS_VALUE ? keyframe.dts : keyframe.pts;
+		segment.seek_pos = keyframe.pos;
+	}
+	return segments;
+}
+
+int FFPP::SegmentedTranscoder::open_encoder(CodecContextHandle& encoder) const
+{
+	const AVCodec* codec = !m_config.codec_name.empty()
+		? avcodec_find_encoder_by_name(m_config.codec_name.c_str())
+		: avcodec_find_encoder(m_config.codec_id);
+	if (!codec) {
+		LOG_ERROR("SegmentedTranscoder: encoder not found\n");
+		return AVERROR_ENCODER_NOT_FOUND;
+	}
+	encoder = make_codec_context(codec);
+	if (!encoder) {
+		return AVERROR(ENOMEM);
+	}
+
+	int ret = m_configure ? m_configure(encoder.get(), m_source.get()) : default_configure(encoder.get(), m_source.get());
+	if (ret < 0) {
+		return ret;
+	}
+	if (m_global_header) {
+		encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
+	apply_threading(encoder.get(), m_config.encoder_threads == 1 ? Threading::None : Threading::Auto, m_config.encoder_threads);
+
+	AVDictionary* options = nullptr;
+	ret = av_dict_parse_string(&options, m_config.encoder_options.c_str(), "=", ":", 0);
+	if (ret >= 0) {
+		ret = avcodec_open2(encoder.get(), codec, &options);
+	}
+	av_dict_free(&options);
+	if (ret < 0) {
+		LOG_ERROR("SegmentedTranscoder: could not open encoder\n");
+	}
+	return ret;
+}
+
+void FFPP::SegmentedTranscoder::run_segment(Segment& segment)
+{
+	const int ret = m_abort ? AVERROR_EXIT : transcode_segment(segment);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		segment.error = ret;
+		segment.done = true;
+	}
+	m_segment_done.notify_all();
+}
+
+int FFPP::SegmentedTranscoder::transcode_segment(Segment& segment)
+{
+	FormatInputHandle input;
+	int ret = avformat_open_input(input.out(), m_url.c_str(), nullptr, nullptr);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = avformat_find_stream_info(input.get(), nullptr);
+	if (ret < 0) {
+		return ret;
+	}
+	if (m_stream_index >= static_cast<int>(input->nb_streams)) {
+		return AVERROR_INVALIDDATA;
+	}
+	for (unsigned i = 0; i < input->nb_streams; i++) {
+		input->streams[i]->discard = static_cast<int>(i) == m_stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+	}
+	KeyframeIndex::Keyframe keyframe;
+	keyframe.pts = segment.start;
+	keyframe.dts = segment.seek_dts;
+	keyframe.pos = segment.seek_pos;
+	ret = KeyframeIndex::seek(input.get(), m_stream_index, keyframe);
+	if (ret < 0) {
+		return ret;
+	}
+
+	Decoder::Config decoder_config;
+	decoder_config.threading = m_config.decoder_threads == 1 ? Threading::None : Threading::Auto;
+	decoder_config.thread_count = m_config.decoder_threads;
+	Decoder decoder(m_par.get(), decoder_config);
+	if (!decoder.get()) {
+		return AVERROR(EINVAL);
+	}
+	decoder->pkt_timebase = m_time_base;
+	ret = decoder.open();
+	if (ret < 0) {
+		return ret;
+	}
+
+	CodecContextHandle encoder;
+	ret = open_encoder(encoder);
+	if (ret < 0) {
+		return ret;
+	}
+	if (encoder->extradata_size != static_cast<int>(m_extradata.size())
+		|| (encoder->extradata_size && std::memcmp(encoder->extradata, m_extradata.data(), m_extradata.size()))) {
+		LOG_ERROR("SegmentedTranscoder: segment encoder produced different extradata\n");
+		return AVERROR_INVALIDDATA;
+	}
+
+	PacketHandle packet = make_packet();
+	PooledFrameHandle frame = make_pooled_frame();
+	if (!packet || !frame) {
+		return AVERROR(ENOMEM);
+	}
+
+	bool started = false;
+	bool reached_end = false;
+	auto receive_frames = [&]() {
+		int status = 0;
+		while (!reached_end && (status = decoder.receive(frame.get())) >= 0) {
+			const int64_t pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : frame->pts;
+			// Leading pictures of an open GOP belong to the previous segment.
+			if (pts == AV_NOPTS_VALUE || pts < segment.start) {
+				av_frame_unref(frame.get());
+				continue;
+			}
+			if (pts >= segment.end) {
+				reached_end = true;
+				av_frame_unref(frame.get());
+				break;
+			}
+
+			frame->pts = av_rescale_q(pts, m_time_base, encoder->time_base);
+			frame->pict_type = segment.frames == 0 ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+			if (segment.frames == 0) {
+				frame->flags |= AV_FRAME_FLAG_KEY;
+			}
+			else {
+				frame->flags &= ~AV_FRAME_FLAG_KEY;
+			}
+			status = encode(encoder.get(), frame.get(), segment);
+			av_frame_unref(frame.get());
+			if (status < 0) {
+				return status;
+			}
+			segment.frames++;
+		}
+		return status == AVERROR(EAGAIN) || status == AVERROR_EOF ? 0 : status;
+	};
+
+	while (!reached_end && !m_abort) {
+		ret = av_read_frame(input.get(), packet.get());
+		if (ret == AVERROR_EOF) {
+			break;
+		}
+		if (ret < 0) {
+			return ret;
+		}
+		// The seek may land on an earlier keyframe; skip up to ours.
+		if (!started && (!(packet->flags & AV_PKT_FLAG_KEY)
+			|| (packet->dts != AV_NOPTS_VALUE && packet->dts < segment.seek_dts))) {
+			av_packet_unref(packet.get());
+			continue;
+		}
+		started = true;
+
+		ret = decoder.send(packet.get());
+		av_packet_unref(packet.get());
+		if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+			return ret;
+		}
+		ret = receive_frames();
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	if (m_abort) {
+		return AVERROR_EXIT;
+	}
+
+	if (!reached_end) {
+		ret = decoder.send(nullptr);
+		if (ret < 0) {
+			return ret;
+		}
+		ret = receive_frames();
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	return encode(encoder.get(), nullptr, segment);
+}
+
+int FFPP::SegmentedTranscoder::encode(AVCodecContext* encoder, const AVFrame* frame, Segment& segment) const
+{
+	int ret = avcodec_send_frame(encoder, frame);
+	if (ret < 0) {
+		return ret;
+	}
+	while (true) {
+		PooledPacketHandle packet = make_pooled_packet();
+		ret = avcodec_receive_packet(encoder, packet.get());
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+			return 0;
+		}
+		if (ret < 0) {
+			return ret;
+		}
+		segment.packets.push_back(std::move(packet));
+	}
+}
+
+int FFPP::SegmentedTranscoder::commit(Muxer& muxer, int stream_index, Segment& segment)
+{
+	std::vector<int64_t> sorted;
+	sorted.reserve(segment.packets.size());
+	for (const PooledPacketHandle& packet : segment.packets) {
+		sorted.push_back(packet->pts);
+	}
+	std::sort(sorted.begin(), sorted.end());
+
+	// A single encoder gives packet n the dts of the (n - delay)th smallest
+	// pts. A segment encoder extrapolates the first delay of them below its
+	// first pts instead, so those take the largest pts of the segment before.
+	size_t delay = 0;
+	if (!sorted.empty()) {
+		for (const PooledPacketHandle& packet : segment.packets) {
+			if (packet->dts != AV_NOPTS_VALUE && packet->dts < sorted.front()) {
+				delay++;
+			}
+		}
+	}
+	const bool rewrite = delay <= m_tail.size();
+
+	uint64_t rewritten = 0;
+	int ret = 0;
+	for (size_t n = 0; n < segment.packets.size() && ret >= 0; n++) {
+		PooledPacketHandle& packet = segment.packets[n];
+		if (rewrite && n < delay) {
+			packet->dts = m_tail[m_tail.size() - delay + n];
+			rewritten++;
+		}
+		if (packet->dts == AV_NOPTS_VALUE) {
+			packet->dts = packet->pts;
+		}
+		if (m_last_dts != AV_NOPTS_VALUE && packet->dts <= m_last_dts) {
+			packet->dts = m_last_dts + 1;
+			rewritten++;
+		}
+		m_last_dts = packet->dts;
+		ret = muxer.write(std::move(packet), stream_index, m_encoder_time_base);
+	}
+
+	for (int64_t pts : sorted) {
+		m_tail.push_back(pts);
+		if (m_tail.size() > MaxReorderDelay) {
+			m_tail.pop_front();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.segments++;
+		m_stats.frames += segment.frames;
+		m_stats.packets += segment.packets.size();
+		m_stats.rewritten_dts += rewritten;
+	}
+	segment.packets.clear();
+	segment.packets.shrink_to_fit();
+	return ret;
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+/*
+ * SegmentedTranscoder.h
+ *
+ * Transcodes GOP-aligned segments of one input in parallel.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_SEGMENTED_TRANSCODER
+#define FFMPEG_PLUS_PLUS_SEGMENTED_TRANSCODER
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../FFPPHandle.h"
+#include "../format/KeyframeIndex.h"
+#include "../format/Muxer.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// SegmentedTranscoder splits the video stream of an input at keyframes
+	/// into segments of about segment_duration and decodes and encodes them
+	/// concurrently, each on its own encoder instance, as tasks of the shared
+	/// UTLX::Scheduler. Every segment starts with a forced keyframe. Segments
+	/// are muxed in order as they complete, sharing the extradata of one
+	/// reference encoder; decode timestamps at the seams are rewritten to
+	/// what a single encoder would have produced.
+	/// </summary>
+	class SegmentedTranscoder {
+	public:
+		struct Config {
+			std::string codec_name = "";          // Takes precedence over codec_id
+			AVCodecID codec_id = AV_CODEC_ID_H264;
+			std::string encoder_options = "";     // "key=value:key=value", applied to every encoder
+			int64_t segment_duration = 10000000;  // AV_TIME_BASE units, segments end on keyframes
+			unsigned parallelism = 0;             // Segments in flight, 0 uses every scheduler worker
+			int encoder_threads = 1;              // Per segment, parallelism comes from the segments
+			int decoder_threads = 1;
+			bool keyframe_sidecar = false;        // Keep the keyframe index next to the input
+		};
+
+		struct Stats {
+			size_t segments = 0;
+			uint64_t frames = 0;
+			uint64_t packets = 0;
+			uint64_t rewritten_dts = 0;           // Seam packets whose dts was rewritten
+		};
+
+		/// <summary>
+		/// Sets up an encoder from the source decoder's parameters before it is
+		/// opened. Must configure every encoder identically.
+		/// </summary>
+		typedef std::function<int(AVCodecContext* encoder, const AVCodecContext* source)> ConfigureCallback;
+
+		SegmentedTranscoder();
+		explicit SegmentedTranscoder(const Config& config);
+
+		SegmentedTranscoder(const SegmentedTranscoder&) = delete;
+		SegmentedTranscoder& operator=(const SegmentedTranscoder&) = delete;
+
+		/// <summary>
+		/// Replaces the default configuration, which copies size, pixel format,
+		/// aspect ratio, colour properties and frame rate from the source.
+		/// </summary>
+		void set_configure_callback(ConfigureCallback callback);
+
+		/// <summary>
+		/// Transcodes the best video stream of input into output. Other streams
+		/// are not copied.
+		/// </summary>
+		int transcode(const std::string& input, const std::string& output, const std::string& format_name = "");
+
+		Stats stats() const;
+
+	private:
+		struct Segment {
+			int64_t start = 0;                    // First pts, source time base
+			int64_t end = INT64_MAX;              // Exclusive
+			int64_t seek_dts = AV_NOPTS_VALUE;    // dts of the starting keyframe
+			int64_t seek_pos = -1;                // Byte offset of the starting keyframe
+			std::vector<PooledPacketHandle> packets;  // Encoder time base
+			uint64_t frames = 0;
+			int error = 0;
+			bool done = false;
+		};
+
+		static int default_configure(AVCodecContext* encoder, const AVCodecContext* source);
+
+		int probe(const std::string& input);
+		std::vector<Segment> plan(const KeyframeIndex::Stream& stream) const;
+		int open_encoder(CodecContextHandle& encoder) const;
+		void run_segment(Segment& segment);
+		int transcode_segment(Segment& segment);
+		int encode(AVCodecContext* encoder, const AVFrame* frame, Segment& segment) const;
+		int commit(Muxer& muxer, int stream_index, Segment& segment);
+
+		Config m_config;
+		ConfigureCallback m_configure;
+
+		// Fixed once transcode() starts the segments.
+		std::string m_url;
+		int m_stream_index = -1;
+		AVRational m_time_base{ 0, 1 };
+		CodecParametersHandle m_par;
+		CodecContextHandle m_source;              // Unopened, carries the source parameters
+		bool m_global_header = false;
+		std::vector<uint8_t> m_extradata;
+		AVRational m_encoder_time_base{ 0, 1 };
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_segment_done;
+		std::atomic<bool> m_abort = false;
+
+		std::deque<int64_t> m_tail;               // Largest pts of the segments muxed so far
+		int64_t m_last_dts = AV_NOPTS_VALUE;
+		Stats m_stats;
+	};
+}
+
+#endif
\ No newline at end of file
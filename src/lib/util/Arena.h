@@ -0,0 +1,102 @@
+/*
+ * Arena.h
+ *
+ * Block allocator reusing freed chunks by size class.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_ARENA
+#define FFMPEG_PLUS_PLUS_ARENA
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace FFPP {
+
+	/// <summary>
+	/// Arena carves allocations out of large blocks and keeps freed chunks on
+	/// per size class free lists, so objects that come and go with a pipeline
+	/// (coroutine frames, mostly) reuse memory instead of calling the global
+	/// allocator. All memory is returned when the arena is destroyed, which
+	/// has to happen after every object allocated from it is gone.
+	/// </summary>
+	class Arena {
+	public:
+		explicit Arena(size_t block_size = 64 * 1024)
+			: m_block_size(block_size)
+		{
+		}
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		void* allocate(size_t size) {
+			const size_t cls = size_class(size);
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (cls < m_free.size() && m_free[cls]) {
+				FreeChunk* chunk = m_free[cls];
+				m_free[cls] = chunk->next;
+				return chunk;
+			}
+
+			const size_t bytes = (cls + 1) * Granularity;
+			if (m_used + bytes > m_capacity) {
+				const size_t block = std::max(bytes, m_block_size);
+				m_blocks.emplace_back(new (std::align_val_t(Granularity)) std::byte[block]);
+				m_used = 0;
+				m_capacity = block;
+			}
+			void* p = m_blocks.back().get() + m_used;
+			m_used += bytes;
+			m_allocated += bytes;
+			return p;
+		}
+
+		void deallocate(void* p, size_t size) noexcept {
+			const size_t cls = size_class(size);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_free.size() <= cls) {
+				m_free.resize(cls + 1, nullptr);
+			}
+			m_free[cls] = new (p) FreeChunk{ m_free[cls] };
+		}
+
+		/// <summary>
+		/// Bytes handed out from blocks so far, freed chunks included.
+		/// </summary>
+		size_t allocated() const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_allocated;
+		}
+
+	private:
+		static constexpr size_t Granularity = 16;
+
+		struct FreeChunk {
+			FreeChunk* next;
+		};
+
+		struct BlockDeleter {
+			void operator()(std::byte* p) const noexcept { ::operator delete[](p, std::align_val_t(Granularity)); }
+		};
+
+		static size_t size_class(size_t size) {
+			return (std::max(size, sizeof(FreeChunk)) + Granularity - 1) / Granularity - 1;
+		}
+
+		const size_t m_block_size;
+
+		mutable std::mutex m_mutex;
+		std::vector<std::unique_ptr<std::byte[], BlockDeleter>> m_blocks;
+		std::vector<FreeChunk*> m_free;           // Indexed by size class
+		size_t m_used = 0;                        // In the current block
+		size_t m_capacity = 0;
+		size_t m_allocated = 0;
+	};
+}
+
+#endif
\ No newline at end of file
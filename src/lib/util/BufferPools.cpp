@@ -0,0 +1,238 @@
+/*
+ * BufferPools.cpp
+ *
+ * Process-wide AVBufferPools grouped in size classes.
+ */
+
+#include "BufferPools.h"
+
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+extern "C" {
+#include <libavcodec/defs.h>
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	constexpr size_t MinSizeClass = 4096;
+	constexpr size_t Header = 64;             // Holds the size, keeps data 64 byte aligned
+	constexpr size_t PlanePadding = 64;       // Some SIMD code reads past the last row
+	constexpr int64_t TrimIdleMs = 1000;
+
+	int64_t now_ms() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+FFPP::BufferPools& FFPP::BufferPools::get_instance()
+{
+	static BufferPools instance;
+	return instance;
+}
+
+FFPP::BufferPools::~BufferPools()
+{
+	for (auto& [size, pool] : m_pools) {
+		av_buffer_pool_uninit(&pool->pool);
+	}
+}
+
+size_t FFPP::BufferPools::size_class(size_t size)
+{
+	if (size <= MinSizeClass) {
+		return MinSizeClass;
+	}
+	const size_t step = std::bit_ceil(size) / 8;
+	return (size + step - 1) / step * step;
+}
+
+AVBufferRef* FFPP::BufferPools::get(size_t size)
+{
+	const size_t cls = size_class(size);
+	AVBufferRef* buf = nullptr;
+	{
+		// Pools are only released under the exclusive lock, so getting from
+		// one under the shared lock is safe.
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		const auto it = m_pools.find(cls);
+		if (it != m_pools.end()) {
+			it->second->last_used.store(now_ms(), std::memory_order_relaxed);
+			buf = av_buffer_pool_get(it->second->pool);
+		}
+	}
+	if (!buf) {
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		std::unique_ptr<Pool>& pool = m_pools[cls];
+		if (!pool) {
+			pool = std::make_unique<Pool>();
+			pool->pool = av_buffer_pool_init2(cls, this, &BufferPools::alloc, nullptr);
+		}
+		pool->last_used.store(now_ms(), std::memory_order_relaxed);
+		buf = pool->pool ? av_buffer_pool_get(pool->pool) : nullptr;
+	}
+
+	if (m_trim_pending.exchange(false, std::memory_order_relaxed)) {
+		trim(TrimIdleMs);
+		if (m_held.load(std::memory_order_relaxed) > m_high_water.load(std::memory_order_relaxed)) {
+			// Pools in use are released too and recreated on demand; only their
+			// idle buffers are freed now, the others once they come back.
+			trim(0);
+		}
+	}
+	return buf;
+}
+
+int FFPP::BufferPools::get_video_buffer(AVFrame* frame, int align)
+{
+	Layout layout;
+	int ret = layout_for(frame, align, layout);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (int i = 0; i < 4 && layout.sizes[i]; i++) {
+		frame->buf[i] = get(layout.sizes[i] + PlanePadding);
+		if (!frame->buf[i]) {
+			for (int j = 0; j < i; j++) {
+				av_buffer_unref(&frame->buf[j]);
+			}
+			return AVERROR(ENOMEM);
+		}
+		frame->data[i] = frame->buf[i]->data;
+		frame->linesize[i] = layout.linesize[i];
+	}
+	frame->extended_data = frame->data;
+	return 0;
+}
+
+int FFPP::BufferPools::get_packet_buffer(AVPacket* packet, int size)
+{
+	if (size < 0) {
+		return AVERROR(EINVAL);
+	}
+	AVBufferRef* buf = get(static_cast<size_t>(size) + AV_INPUT_BUFFER_PADDING_SIZE);
+	if (!buf) {
+		return AVERROR(ENOMEM);
+	}
+	std::memset(buf->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+	av_buffer_unref(&packet->buf);
+	packet->buf = buf;
+	packet->data = buf->data;
+	packet->size = size;
+	return 0;
+}
+
+void FFPP::BufferPools::trim(int64_t idle_ms)
+{
+	const int64_t cutoff = now_ms() - idle_ms;
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	for (auto it = m_pools.begin(); it != m_pools.end();) {
+		if (it->second->last_used.load(std::memory_order_relaxed) <= cutoff) {
+			// Buffers still in use keep the pool alive until they are returned.
+			av_buffer_pool_uninit(&it->second->pool);
+			it = m_pools.erase(it);
+			m_trimmed++;
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+FFPP::BufferPools::Stats FFPP::BufferPools::stats() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	Stats stats;
+	stats.held_bytes = m_held.load(std::memory_order_relaxed);
+	stats.peak_bytes = m_peak.load(std::memory_order_relaxed);
+	stats.pools = m_pools.size();
+	stats.trimmed_pools = m_trimmed;
+	return stats;
+}
+
+AVBufferRef* FFPP::BufferPools::alloc(void* opaque, size_t size)
+{
+	auto* self = static_cast<BufferPools*>(opaque);
+	auto* base = static_cast<uint8_t*>(av_malloc(size + Header));
+	if (!base) {
+		return nullptr;
+	}
+	std::memcpy(base, &size, sizeof(size));
+
+	AVBufferRef* buf = av_buffer_create(base + Header, size, &BufferPools::free_data, self, 0);
+	if (!buf) {
+		av_free(base);
+		return nullptr;
+	}
+
+	const size_t held = self->m_held.fetch_add(size, std::memory_order_relaxed) + size;
+	size_t peak = self->m_peak.load(std::memory_order_relaxed);
+	while (held > peak && !self->m_peak.compare_exchange_weak(peak, held, std::memory_order_relaxed)) {
+	}
+	// Called with the pool's lock held, so the trim itself happens in get().
+	if (held > self->m_high_water.load(std::memory_order_relaxed)) {
+		self->m_trim_pending.store(true, std::memory_order_relaxed);
+	}
+	return buf;
+}
+
+void FFPP::BufferPools::free_data(void* opaque, uint8_t* data)
+{
+	auto* self = static_cast<BufferPools*>(opaque);
+	uint8_t* base = data - Header;
+	size_t size = 0;
+	std::memcpy(&size, base, sizeof(size));
+	self->m_held.fetch_sub(size, std::memory_order_relaxed);
+	av_free(base);
+}
+
+int FFPP::BufferPools::layout_for(const AVFrame* frame, int align, Layout& layout)
+{
+	const auto format = static_cast<AVPixelFormat>(frame->format);
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+	if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL))) {
+		return AVERROR(ENOSYS);
+	}
+	if (frame->width <= 0 || frame->height <= 0 || align <= 0) {
+		return AVERROR(EINVAL);
+	}
+
+	const LayoutKey key(frame->format, frame->width, frame->height, align);
+	{
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		const auto it = m_layouts.find(key);
+		if (it != m_layouts.end()) {
+			layout = it->second;
+			return 0;
+		}
+	}
+
+	int ret = av_image_fill_linesizes(layout.linesize, format, frame->width);
+	if (ret < 0) {
+		return ret;
+	}
+	ptrdiff_t linesize[4] = { 0 };
+	for (int i = 0; i < 4; i++) {
+		layout.linesize[i] = (layout.linesize[i] + align - 1) / align * align;
+		linesize[i] = layout.linesize[i];
+	}
+	ret = av_image_fill_plane_sizes(layout.sizes, format, frame->height, linesize);
+	if (ret < 0) {
+		return ret;
+	}
+
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	m_layouts.emplace(key, layout);
+	return 0;
+}
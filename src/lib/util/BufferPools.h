@@ -0,0 +1,115 @@
+/*
+ * BufferPools.h
+ *
+ * Process-wide AVBufferPools grouped in size classes.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_BUFFER_POOLS
+#define FFMPEG_PLUS_PLUS_BUFFER_POOLS
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <tuple>
+
+extern "C" {
+#include <libavcodec/packet.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+}
+
+namespace FFPP {
+
+	/// <summary>
+	/// BufferPools hands out AVBufferRefs from one AVBufferPool per size
+	/// class, shared by every stage in the process. All pool memory is
+	/// accounted for; once it exceeds the high-water mark, pools that were
+	/// idle for a while are released so their buffers go back to the OS.
+	/// </summary>
+	class BufferPools {
+	public:
+		struct Stats {
+			size_t held_bytes = 0;                // Allocated by the pools, in use or idle
+			size_t peak_bytes = 0;
+			size_t pools = 0;
+			uint64_t trimmed_pools = 0;
+		};
+
+		static BufferPools& get_instance();
+
+		/// <summary>
+		/// Rounds size up to the next eighth of its power of two, so that
+		/// flapping sizes share pools while wasting at most 12.5%.
+		/// </summary>
+		static size_t size_class(size_t size);
+
+		/// <summary>
+		/// Returns a buffer of at least size bytes.
+		/// </summary>
+		AVBufferRef* get(size_t size);
+
+		/// <summary>
+		/// Allocates the planes of a video frame whose format, width and height
+		/// are set. Every linesize is a multiple of align. Returns
+		/// AVERROR(ENOSYS) for hardware and palette formats.
+		/// </summary>
+		int get_video_buffer(AVFrame* frame, int align = 64);
+
+		/// <summary>
+		/// Gives packet size bytes of data followed by zeroed padding.
+		/// </summary>
+		int get_packet_buffer(AVPacket* packet, int size);
+
+		/// <summary>
+		/// Held bytes above which idle pools are released, and if that is not
+		/// enough, the idle buffers of pools still in use.
+		/// </summary>
+		void set_high_water(size_t bytes) { m_high_water.store(bytes, std::memory_order_relaxed); }
+
+		/// <summary>
+		/// Releases the pools unused for at least idle_ms milliseconds.
+		/// </summary>
+		void trim(int64_t idle_ms = 0);
+
+		Stats stats() const;
+
+	private:
+		struct Pool {
+			AVBufferPool* pool = nullptr;
+			std::atomic<int64_t> last_used = 0;   // Milliseconds, steady clock
+		};
+
+		struct Layout {
+			int linesize[4] = { 0 };
+			size_t sizes[4] = { 0 };
+		};
+
+		typedef std::tuple<int, int, int, int> LayoutKey;  // Format, width, height, align
+
+		BufferPools() = default;
+		~BufferPools();
+
+		BufferPools(const BufferPools&) = delete;
+		BufferPools& operator=(const BufferPools&) = delete;
+
+		static AVBufferRef* alloc(void* opaque, size_t size);
+		static void free_data(void* opaque, uint8_t* data);
+
+		int layout_for(const AVFrame* frame, int align, Layout& layout);
+
+		mutable std::shared_mutex m_mutex;
+		std::map<size_t, std::unique_ptr<Pool>> m_pools;  // Keyed by size class
+		std::map<LayoutKey, Layout> m_layouts;
+
+		std::atomic<size_t> m_held = 0;
+		std::atomic<size_t> m_peak = 0;
+		std::atomic<size_t> m_high_water = 1024 * 1024 * 1024;
+		std::atomic<bool> m_trim_pending = false;
+		uint64_t m_trimmed = 0;
+	};
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,182 @@
+/*
+ * FFPPArgSchema.cpp
+ *
+ * Compact struct-of-arrays description of the AVOptions of an AVClass.
+ */
+
+#include "FFPPArgSchema.h"
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/opt.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	/**
+	* @brief Appends strings to the arena once and hands out their offset.
+	*/
+	class StringInterner {
+	public:
+		explicit StringInterner(std::vector<char>& arena)
+			: m_arena(arena)
+		{
+			m_arena.assign(1, '\0');
+			m_known.emplace("", FFPPArgSchema::NoStr);
+		}
+
+		FFPPArgSchema::StrRef intern(const char* s) {
+			if (!s || !*s) {
+				return FFPPArgSchema::NoStr;
+			}
+			const auto [it, inserted] = m_known.try_emplace(s, static_cast<FFPPArgSchema::StrRef>(m_arena.size()));
+			if (inserted) {
+				const std::string_view view(s);
+				m_arena.insert(m_arena.end(), view.begin(), view.end());
+				m_arena.push_back('\0');
+			}
+			return it->second;
+		}
+
+	private:
+		std::vector<char>& m_arena;
+		std::unordered_map<std::string, FFPPArgSchema::StrRef> m_known;
+	};
+}
+
+const FFPPArgSchema&
+FFPPArgSchema::get(const AVClass* cls)
+{
+	static std::mutex registry_mutex;
+	static std::unordered_map<const AVClass*, std::unique_ptr<FFPPArgSchema>> registry;
+
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	auto& schema = registry[cls];
+	if (!schema) {
+		schema = std::make_unique<FFPPArgSchema>(cls);
+	}
+	return *schema;
+}
+
+FFPPArgSchema::FFPPArgSchema(const AVClass* cls)
+	: m_class(cls)
+{
+	StringInterner interner(m_arena);
+	if (!cls) {
+		return;
+	}
+
+	// av_opt_next() only dereferences the AVClass pointer of the object,
+	// so the address of the class pointer serves as a fake object.
+	const void* fake_obj = &m_class;
+	const AVOption* option = nullptr;
+	while ((option = av_opt_next(fake_obj, option)) != nullptr) {
+		m_name.push_back(interner.intern(option->name));
+		m_help.push_back(interner.intern(option->help));
+		m_unit.push_back(interner.intern(option->unit));
+		m_offset.push_back(option->offset);
+		m_type.push_back(option->type);
+		m_min.push_back(option->min);
+		m_max.push_back(option->max);
+		m_flags.push_back(option->flags);
+
+		uint64_t default_bits = 0;
+		StrRef default_str = NoStr;
+		if (!(option->type & AV_OPT_TYPE_FLAG_ARRAY)) {
+			switch (option->type) {
+				case AV_OPT_TYPE_STRING:
+				case AV_OPT_TYPE_BINARY:
+				case AV_OPT_TYPE_DICT:
+				case AV_OPT_TYPE_IMAGE_SIZE:
+				case AV_OPT_TYPE_VIDEO_RATE:
+				case AV_OPT_TYPE_COLOR:
+				case AV_OPT_TYPE_CHLAYOUT:
+					default_str = interner.intern(option->default_val.str);
+					break;
+				default:
+					static_assert(sizeof(option->default_val.i64) == sizeof(default_bits));
+					std::memcpy(&default_bits, &option->default_val.i64, sizeof(default_bits));
+					break;
+			}
+		}
+		m_default.push_back(default_bits);
+		m_default_str.push_back(default_str);
+	}
+	m_arena.shrink_to_fit();
+}
+
+int64_t
+FFPPArgSchema::default_i64(Index i) const
+{
+	int64_t value;
+	std::memcpy(&value, &m_default[i], sizeof(value));
+	return value;
+}
+
+double
+FFPPArgSchema::default_dbl(Index i) const
+{
+	double value;
+	std::memcpy(&value, &m_default[i], sizeof(value));
+	return value;
+}
+
+std::optional<FFPPArgSchema::Index>
+FFPPArgSchema::find(std::string_view name) const
+{
+	for (Index i = 0; i < m_name.size(); i++) {
+		if (str(m_name[i]) == name) {
+			return i;
+		}
+	}
+	return std::nullopt;
+}
+
+size_t
+FFPPArgSchema::select(int required, std::vector<Index>& out, int excluded) const
+{
+	const Index n = static_cast<Index>(m_flags.size());
+	const int* flags = m_flags.data();
+
+	// Branchless compaction: every index is written, only matches advance.
+	out.resize(n);
+	Index* dst = out.data();
+	Index found = 0;
+	for (Index i = 0; i < n; i++) {
+		dst[found] = i;
+		found += ((flags[i] & required) == required) & ((flags[i] & excluded) == 0);
+	}
+	out.resize(found);
+	return found;
+}
+
+size_t
+FFPPArgSchema::count(int required, int excluded) const
+{
+	const size_t n = m_flags.size();
+	const int* flags = m_flags.data();
+
+	size_t found = 0;
+	for (size_t i = 0; i < n; i++) {
+		found += ((flags[i] & required) == required) & ((flags[i] & excluded) == 0);
+	}
+	return found;
+}
+
+size_t
+FFPPArgSchema::memory_usage() const
+{
+	return sizeof(*this)
+		+ (m_name.capacity() + m_help.capacity() + m_unit.capacity() + m_default_str.capacity()) * sizeof(StrRef)
+		+ (m_offset.capacity() + m_type.capacity() + m_flags.capacity()) * sizeof(int)
+		+ (m_min.capacity() + m_max.capacity()) * sizeof(double)
+		+ m_default.capacity() * sizeof(uint64_t)
+		+ m_arena.capacity();
+}
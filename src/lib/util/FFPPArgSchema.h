@@ -0,0 +1,106 @@
+/*
+ * FFPPArgSchema.h
+ *
+ * Compact struct-of-arrays description of the AVOptions of an AVClass.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_ARG_SCHEMA
+#define FFMPEG_PLUS_PLUS_ARG_SCHEMA
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct AVClass;
+
+namespace FFPP {
+
+	/// <summary>
+	/// FFPPArgSchema stores the option metadata of one AVClass as contiguous
+	/// columns. All strings live in a single interned arena and are referenced
+	/// by offset. A schema is built once per AVClass and shared by every
+	/// FFPPArgs instance wrapping an object of that class.
+	/// </summary>
+	class FFPPArgSchema {
+	public:
+		typedef uint32_t Index;
+		typedef uint32_t StrRef;
+
+		static constexpr StrRef NoStr = 0; // Offset of the empty string in the arena
+
+		/// <summary>
+		/// Returns the shared schema for the given class, building it on first use.
+		/// </summary>
+		static const FFPPArgSchema& get(const AVClass* cls);
+
+		explicit FFPPArgSchema(const AVClass* cls);
+		~FFPPArgSchema() = default;
+
+		FFPPArgSchema(const FFPPArgSchema&) = delete;
+		FFPPArgSchema& operator=(const FFPPArgSchema&) = delete;
+
+		size_t size() const { return m_offset.size(); }
+		const AVClass* av_class() const { return m_class; }
+
+		std::string_view name(Index i) const { return str(m_name[i]); }
+		std::string_view help(Index i) const { return str(m_help[i]); }
+		std::string_view unit(Index i) const { return str(m_unit[i]); }
+		int offset(Index i) const { return m_offset[i]; }
+		int type(Index i) const { return m_type[i]; }
+		double min(Index i) const { return m_min[i]; }
+		double max(Index i) const { return m_max[i]; }
+		int flags(Index i) const { return m_flags[i]; }
+
+		/// <summary>
+		/// Default value of the option. Which accessor applies depends on the
+		/// option type, mirroring the default_val union of AVOption.
+		/// </summary>
+		int64_t default_i64(Index i) const;
+		double default_dbl(Index i) const;
+		std::string_view default_str(Index i) const { return str(m_default_str[i]); }
+
+		/// <summary>
+		/// Returns the index of the option called name, if any.
+		/// </summary>
+		std::optional<Index> find(std::string_view name) const;
+
+		/// <summary>
+		/// Collects the indices of all options having every bit of required and
+		/// no bit of excluded set in their AV_OPT_FLAG_* mask. Returns the
+		/// number of matches written to out.
+		/// </summary>
+		size_t select(int required, std::vector<Index>& out, int excluded = 0) const;
+
+		/// <summary>
+		/// Counts the options matching the same predicate as select().
+		/// </summary>
+		size_t count(int required, int excluded = 0) const;
+
+		/// <summary>
+		/// Size in bytes of the columns and the string arena.
+		/// </summary>
+		size_t memory_usage() const;
+
+	private:
+		std::string_view str(StrRef ref) const { return m_arena.data() + ref; }
+
+		const AVClass* m_class = nullptr;
+
+		std::vector<StrRef> m_name;
+		std::vector<StrRef> m_help;
+		std::vector<StrRef> m_unit;
+		std::vector<int> m_offset;
+		std::vector<int> m_type;
+		std::vector<double> m_min;
+		std::vector<double> m_max;
+		std::vector<int> m_flags;
+		std::vector<uint64_t> m_default;    // Bits of default_val.i64 or default_val.dbl
+		std::vector<StrRef> m_default_str;  // default_val.str for string-like types
+
+		std::vector<char> m_arena; // NUL separated strings, starts with ""
+	};
+}
+
+#endif
\ No newline at end of file
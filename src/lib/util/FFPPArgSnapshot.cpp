@@ -0,0 +1,571 @@
+/*
+ * FFPPArgSnapshot.cpp
+ *
+ * Capture and restore of all option values of an FFmpeg object.
+ */
+
+#include "FFPPArgSnapshot.h"
+
+#include <array>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "../../utils/Logging/Logger.h"
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/dict.h>
+#include <libavutil/mem.h>
+#include <libavutil/opt.h>
+#include <libavutil/parseutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+}
+
+using namespace FFPP;
+
+namespace {
+
+	constexpr char SnapshotMagic[4] = { 'F', 'F', 'P', 'S' };
+	constexpr uint32_t SnapshotVersion = 1;
+
+	/**
+	* @brief Number of bytes a scalar option occupies at its offset, 0 if the
+	* value is variable sized or has no storage.
+	*/
+	size_t scalar_size(int type) {
+		switch (type) {
+			case AV_OPT_TYPE_FLAGS:
+			case AV_OPT_TYPE_INT:
+			case AV_OPT_TYPE_BOOL:
+			case AV_OPT_TYPE_PIXEL_FMT:
+			case AV_OPT_TYPE_SAMPLE_FMT:
+			case AV_OPT_TYPE_UINT:
+			case AV_OPT_TYPE_FLOAT:
+			case AV_OPT_TYPE_COLOR:
+				return 4;
+			case AV_OPT_TYPE_INT64:
+			case AV_OPT_TYPE_UINT64:
+			case AV_OPT_TYPE_DURATION:
+			case AV_OPT_TYPE_DOUBLE:
+			case AV_OPT_TYPE_RATIONAL:
+			case AV_OPT_TYPE_VIDEO_RATE:
+			case AV_OPT_TYPE_IMAGE_SIZE:
+				return 8;
+			default:
+				return 0;
+		}
+	}
+
+	bool is_variable(int type) {
+		switch (type) {
+			case AV_OPT_TYPE_STRING:
+			case AV_OPT_TYPE_BINARY:
+			case AV_OPT_TYPE_DICT:
+			case AV_OPT_TYPE_CHLAYOUT:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	uint64_t hash_payload(std::string_view value) {
+		uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+		for (const char c : value) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 0x100000001b3ull;
+		}
+		return hash ? hash : 1; // 0 is reserved for NULL
+	}
+
+	template <typename T>
+	uint64_t to_slot(const T& value) {
+		static_assert(sizeof(T) <= sizeof(uint64_t));
+		uint64_t slot = 0;
+		std::memcpy(&slot, &value, sizeof(T));
+		return slot;
+	}
+
+	template <typename T>
+	T from_slot(uint64_t slot) {
+		T value;
+		std::memcpy(&value, &slot, sizeof(T));
+		return value;
+	}
+
+	template <typename T>
+	void put(std::vector<uint8_t>& out, const T& value) {
+		const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+		out.insert(out.end(), bytes, bytes + sizeof(T));
+	}
+
+	template <typename T>
+	bool get(const std::vector<uint8_t>& in, size_t& pos, T& value) {
+		if (in.size() - pos < sizeof(T)) {
+			return false;
+		}
+		std::memcpy(&value, in.data() + pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	void write_json_string(std::ostream& s, std::string_view value) {
+		s << '"';
+		for (const char c : value) {
+			switch (c) {
+				case '"' : s << "\\\""; break;
+				case '\\': s << "\\\\"; break;
+				case '\n': s << "\\n"; break;
+				case '\r': s << "\\r"; break;
+				case '\t': s << "\\t"; break;
+				default:
+					if (static_cast<uint8_t>(c) < 0x20) {
+						s << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+					}
+					else {
+						s << c;
+					}
+			}
+		}
+		s << '"';
+	}
+
+	void write_json_double(std::ostream& s, double value) {
+		if (std::isfinite(value)) {
+			s << std::setprecision(17) << value;
+		}
+		else {
+			write_json_string(s, std::isnan(value) ? "nan" : (value > 0 ? "inf" : "-inf"));
+		}
+	}
+}
+
+FFPPArgSnapshot::FFPPArgSnapshot(const FFPPArgSchema& schema)
+	: m_schema(&schema)
+{
+	m_slots.reserve(schema.size());
+	m_ends.reserve(schema.size());
+}
+
+std::string_view
+FFPPArgSnapshot::payload(Index i) const
+{
+	const uint32_t begin = i ? m_ends[i - 1] : 0;
+	return std::string_view(m_payload).substr(begin, m_ends[i] - begin);
+}
+
+void
+FFPPArgSnapshot::append_payload(Index i, std::string_view value, bool is_null)
+{
+	m_payload.append(value);
+	m_slots[i] = is_null ? 0 : hash_payload(value);
+	m_ends[i] = static_cast<uint32_t>(m_payload.size());
+}
+
+FFPPArgSnapshot
+FFPPArgSnapshot::capture(const FFPPArgSchema& schema, const void* obj)
+{
+	FFPPArgSnapshot snap(schema);
+	const auto* base = static_cast<const uint8_t*>(obj);
+
+	for (Index i = 0; i < schema.size(); i++) {
+		const int type = schema.type(i);
+		const uint8_t* field = base + schema.offset(i);
+		snap.m_slots.push_back(0);
+		snap.m_ends.push_back(static_cast<uint32_t>(snap.m_payload.size()));
+
+		if (const size_t size = scalar_size(type)) {
+			std::memcpy(&snap.m_slots[i], field, size);
+			continue;
+		}
+		if (!is_variable(type)) {
+			continue;
+		}
+
+		switch (type) {
+			case AV_OPT_TYPE_STRING: {
+				const char* value = *reinterpret_cast<const char* const*>(field);
+				snap.append_payload(i, value ? value : "", !value);
+				break;
+			}
+			case AV_OPT_TYPE_BINARY: {
+				const uint8_t* data = *reinterpret_cast<const uint8_t* const*>(field);
+				const int len = *reinterpret_cast<const int*>(field + sizeof(uint8_t*));
+				snap.append_payload(i, std::string_view(reinterpret_cast<const char*>(data), data ? len : 0), !data);
+				break;
+			}
+			case AV_OPT_TYPE_DICT: {
+				const AVDictionary* dict = *reinterpret_cast<const AVDictionary* const*>(field);
+				char* buffer = nullptr;
+				if (dict && av_dict_get_string(dict, &buffer, '=', ':') >= 0 && buffer) {
+					snap.append_payload(i, buffer);
+				}
+				else {
+					snap.append_payload(i, "", true);
+				}
+				av_free(buffer);
+				break;
+			}
+			case AV_OPT_TYPE_CHLAYOUT: {
+				const auto* layout = reinterpret_cast<const AVChannelLayout*>(field);
+				char buffer[128];
+				const int needed = av_channel_layout_describe(layout, buffer, sizeof(buffer));
+				if (needed < 0) {
+					snap.append_payload(i, "", true);
+				}
+				else if (static_cast<size_t>(needed) > sizeof(buffer)) {
+					std::string large(needed, '\0');
+					av_channel_layout_describe(layout, large.data(), large.size());
+					large.resize(std::strlen(large.c_str()));
+					snap.append_payload(i, large);
+				}
+				else {
+					snap.append_payload(i, buffer);
+				}
+				break;
+			}
+		}
+	}
+	return snap;
+}
+
+FFPPArgSnapshot
+FFPPArgSnapshot::defaults(const FFPPArgSchema& schema)
+{
+	FFPPArgSnapshot snap(schema);
+
+	for (Index i = 0; i < schema.size(); i++) {
+		const int type = schema.type(i);
+		const std::string default_str(schema.default_str(i));
+		snap.m_slots.push_back(0);
+		snap.m_ends.push_back(static_cast<uint32_t>(snap.m_payload.size()));
+
+		switch (type) {
+			case AV_OPT_TYPE_FLAGS:
+			case AV_OPT_TYPE_INT:
+			case AV_OPT_TYPE_BOOL:
+			case AV_OPT_TYPE_PIXEL_FMT:
+			case AV_OPT_TYPE_SAMPLE_FMT:
+				snap.m_slots[i] = to_slot(static_cast<int>(schema.default_i64(i)));
+				break;
+			case AV_OPT_TYPE_UINT:
+				snap.m_slots[i] = to_slot(static_cast<unsigned>(schema.default_i64(i)));
+				break;
+			case AV_OPT_TYPE_INT64:
+			case AV_OPT_TYPE_UINT64:
+			case AV_OPT_TYPE_DURATION:
+				snap.m_slots[i] = to_slot(schema.default_i64(i));
+				break;
+			case AV_OPT_TYPE_DOUBLE:
+				snap.m_slots[i] = to_slot(schema.default_dbl(i));
+				break;
+			case AV_OPT_TYPE_FLOAT:
+				snap.m_slots[i] = to_slot(static_cast<float>(schema.default_dbl(i)));
+				break;
+			case AV_OPT_TYPE_RATIONAL:
+				snap.m_slots[i] = to_slot(av_d2q(schema.default_dbl(i), INT_MAX));
+				break;
+			case AV_OPT_TYPE_VIDEO_RATE: {
+				AVRational rate{ 0, 0 };
+				if (!default_str.empty()) {
+					av_parse_video_rate(&rate, default_str.c_str());
+				}
+				snap.m_slots[i] = to_slot(rate);
+				break;
+			}
+			case AV_OPT_TYPE_IMAGE_SIZE: {
+				int size[2] = { 0, 0 };
+				if (!default_str.empty() && default_str != "none") {
+					av_parse_video_size(&size[0], &size[1], default_str.c_str());
+				}
+				snap.m_slots[i] = to_slot(size);
+				break;
+			}
+			case AV_OPT_TYPE_COLOR: {
+				uint8_t rgba[4] = { 0, 0, 0, 0 };
+				if (!default_str.empty()) {
+					av_parse_color(rgba, default_str.c_str(), -1, nullptr);
+				}
+				snap.m_slots[i] = to_slot(rgba);
+				break;
+			}
+			case AV_OPT_TYPE_STRING:
+			case AV_OPT_TYPE_DICT:
+			case AV_OPT_TYPE_CHLAYOUT:
+				// The arena does not distinguish a NULL default from "".
+				snap.append_payload(i, default_str, default_str.empty());
+				break;
+			case AV_OPT_TYPE_BINARY:
+				// Binary defaults are hex strings, FFmpeg leaves them unset in practice.
+				snap.append_payload(i, "", true);
+				break;
+		}
+	}
+	return snap;
+}
+
+int
+FFPPArgSnapshot::restore(void* obj) const
+{
+	if (!m_schema) {
+		return 0;
+	}
+
+	const FFPPArgSnapshot current = capture(*m_schema, obj);
+	auto* base = static_cast<uint8_t*>(obj);
+	int failed = 0;
+
+	for (const Index i : diff(current)) {
+		const int type = m_schema->type(i);
+		if (m_schema->flags(i) & AV_OPT_FLAG_READONLY) {
+			continue;
+		}
+
+		if (const size_t size = scalar_size(type)) {
+			std::memcpy(base + m_schema->offset(i), &m_slots[i], size);
+			continue;
+		}
+
+		const std::string name(m_schema->name(i));
+		const std::string value(payload(i));
+		int ret = 0;
+		switch (type) {
+			case AV_OPT_TYPE_BINARY:
+				ret = av_opt_set_bin(obj, name.c_str(), reinterpret_cast<const uint8_t*>(value.data()), static_cast<int>(value.size()), 0);
+				break;
+			case AV_OPT_TYPE_STRING:
+				ret = av_opt_set(obj, name.c_str(), m_slots[i] ? value.c_str() : nullptr, 0);
+				break;
+			default:
+				ret = av_opt_set(obj, name.c_str(), value.c_str(), 0);
+				break;
+		}
+		if (ret < 0) {
+			LOG_WARN("Failed to restore option '" + name + "'\n");
+			failed++;
+		}
+	}
+	return failed;
+}
+
+std::vector<FFPPArgSnapshot::Index>
+FFPPArgSnapshot::diff(const FFPPArgSnapshot& other) const
+{
+	std::vector<Index> changed;
+	if (m_schema != other.m_schema || m_slots.size() != other.m_slots.size()) {
+		LOG_ERROR("Cannot diff snapshots of different classes\n");
+		return changed;
+	}
+
+	const Index n = static_cast<Index>(m_slots.size());
+	const uint64_t* a = m_slots.data();
+	const uint64_t* b = other.m_slots.data();
+
+	changed.resize(n);
+	Index found = 0;
+	for (Index i = 0; i < n; i++) {
+		changed[found] = i;
+		found += a[i] != b[i];
+	}
+	changed.resize(found);
+	return changed;
+}
+
+std::vector<uint8_t>
+FFPPArgSnapshot::serialize() const
+{
+	std::vector<uint8_t> blob;
+	if (!m_schema) {
+		return blob;
+	}
+
+	const AVClass* cls = m_schema->av_class();
+	const std::string_view class_name = cls ? cls->class_name : "";
+
+	// Native byte order, the blob is meant for the machine that created it.
+	blob.reserve(24 + class_name.size() + m_slots.size() * 12 + m_payload.size());
+	blob.insert(blob.end(), std::begin(SnapshotMagic), std::end(SnapshotMagic));
+	put(blob, SnapshotVersion);
+	put(blob, static_cast<uint32_t>(m_slots.size()));
+	put(blob, static_cast<uint32_t>(m_payload.size()));
+	put(blob, static_cast<uint32_t>(class_name.size()));
+	blob.insert(blob.end(), class_name.begin(), class_name.end());
+	for (const uint64_t slot : m_slots) {
+		put(blob, slot);
+	}
+	for (const uint32_t end : m_ends) {
+		put(blob, end);
+	}
+	blob.insert(blob.end(), m_payload.begin(), m_payload.end());
+	return blob;
+}
+
+std::optional<FFPPArgSnapshot>
+FFPPArgSnapshot::deserialize(const FFPPArgSchema& schema, const std::vector<uint8_t>& blob)
+{
+	size_t pos = sizeof(SnapshotMagic);
+	uint32_t version = 0, count = 0, payload_size = 0, name_size = 0;
+	if (blob.size() < pos || std::memcmp(blob.data(), SnapshotMagic, sizeof(SnapshotMagic)) != 0
+		|| !get(blob, pos, version) || !get(blob, pos, count)
+		|| !get(blob, pos, payload_size) || !get(blob, pos, name_size)
+		|| version != SnapshotVersion) {
+		LOG_ERROR("Invalid option snapshot header\n");
+		return std::nullopt;
+	}
+
+	const AVClass* cls = schema.av_class();
+	const std::string_view class_name = cls ? cls->class_name : "";
+	if (blob.size() - pos < name_size
+		|| std::string_view(reinterpret_cast<const char*>(blob.data() + pos), name_size) != class_name
+		|| count != schema.size()) {
+		LOG_ERROR("Option snapshot was created for another class\n");
+		return std::nullopt;
+	}
+	pos += name_size;
+
+	if ((blob.size() - pos) != static_cast<size_t>(count) * 12 + payload_size) {
+		LOG_ERROR("Option snapshot has an unexpected size\n");
+		return std::nullopt;
+	}
+
+	FFPPArgSnapshot snap(schema);
+	snap.m_slots.resize(count);
+	snap.m_ends.resize(count);
+	std::memcpy(snap.m_slots.data(), blob.data() + pos, count * sizeof(uint64_t));
+	pos += count * sizeof(uint64_t);
+	std::memcpy(snap.m_ends.data(), blob.data() + pos, count * sizeof(uint32_t));
+	pos += count * sizeof(uint32_t);
+	snap.m_payload.assign(reinterpret_cast<const char*>(blob.data() + pos), payload_size);
+
+	uint32_t previous = 0;
+	for (const uint32_t end : snap.m_ends) {
+		if (end < previous || end > payload_size) {
+			LOG_ERROR("Option snapshot has corrupt payload offsets\n");
+			return std::nullopt;
+		}
+		previous = end;
+	}
+	return snap;
+}
+
+std::string
+FFPPArgSnapshot::to_json(const FFPPArgSnapshot* baseline) const
+{
+	std::stringstream s("");
+	if (!m_schema) {
+		return "{}";
+	}
+
+	std::vector<Index> indices;
+	if (baseline) {
+		indices = diff(*baseline);
+	}
+	else {
+		indices.resize(m_slots.size());
+		for (Index i = 0; i < indices.size(); i++) {
+			indices[i] = i;
+		}
+	}
+
+	const AVClass* cls = m_schema->av_class();
+	s << "{\n  \"class\": ";
+	write_json_string(s, cls ? cls->class_name : "");
+	s << ",\n  \"options\": {";
+
+	bool first = true;
+	for (const Index i : indices) {
+		const int type = m_schema->type(i);
+		if (!scalar_size(type) && !is_variable(type)) {
+			continue;
+		}
+
+		s << (first ? "\n    " : ",\n    ");
+		first = false;
+		write_json_string(s, m_schema->name(i));
+		s << ": ";
+
+		const uint64_t slot = m_slots[i];
+		switch (type) {
+			case AV_OPT_TYPE_FLAGS:
+			case AV_OPT_TYPE_INT:
+				s << from_slot<int>(slot);
+				break;
+			case AV_OPT_TYPE_UINT:
+				s << from_slot<unsigned>(slot);
+				break;
+			case AV_OPT_TYPE_BOOL: {
+				const int value = from_slot<int>(slot);
+				s << (value < 0 ? "\"auto\"" : (value ? "true" : "false"));
+				break;
+			}
+			case AV_OPT_TYPE_INT64:
+			case AV_OPT_TYPE_DURATION:
+				s << from_slot<int64_t>(slot);
+				break;
+			case AV_OPT_TYPE_UINT64:
+				s << from_slot<uint64_t>(slot);
+				break;
+			case AV_OPT_TYPE_DOUBLE:
+				write_json_double(s, from_slot<double>(slot));
+				break;
+			case AV_OPT_TYPE_FLOAT:
+				write_json_double(s, from_slot<float>(slot));
+				break;
+			case AV_OPT_TYPE_PIXEL_FMT: {
+				const char* name = av_get_pix_fmt_name(static_cast<AVPixelFormat>(from_slot<int>(slot)));
+				write_json_string(s, name ? name : "none");
+				break;
+			}
+			case AV_OPT_TYPE_SAMPLE_FMT: {
+				const char* name = av_get_sample_fmt_name(static_cast<AVSampleFormat>(from_slot<int>(slot)));
+				write_json_string(s, name ? name : "none");
+				break;
+			}
+			case AV_OPT_TYPE_RATIONAL:
+			case AV_OPT_TYPE_VIDEO_RATE: {
+				const AVRational q = from_slot<AVRational>(slot);
+				write_json_string(s, std::to_string(q.num) + "/" + std::to_string(q.den));
+				break;
+			}
+			case AV_OPT_TYPE_IMAGE_SIZE: {
+				const auto size = from_slot<std::array<int, 2>>(slot);
+				write_json_string(s, std::to_string(size[0]) + "x" + std::to_string(size[1]));
+				break;
+			}
+			case AV_OPT_TYPE_COLOR: {
+				const auto rgba = from_slot<std::array<uint8_t, 4>>(slot);
+				char color[10];
+				std::snprintf(color, sizeof(color), "#%02x%02x%02x%02x", rgba[0], rgba[1], rgba[2], rgba[3]);
+				write_json_string(s, color);
+				break;
+			}
+			case AV_OPT_TYPE_BINARY: {
+				if (!slot) {
+					s << "null";
+					break;
+				}
+				std::stringstream hex("");
+				for (const char c : payload(i)) {
+					hex << std::hex << std::setw(2) << std::setfill('0') << int(static_cast<uint8_t>(c));
+				}
+				write_json_string(s, hex.str());
+				break;
+			}
+			default:
+				if (slot) {
+					write_json_string(s, payload(i));
+				}
+				else {
+					s << "null";
+				}
+				break;
+		}
+	}
+	s << (first ? "}\n}" : "\n  }\n}");
+	return s.str();
+}
@@ -0,0 +1,90 @@
+/*
+ * FFPPArgSnapshot.h
+ *
+ * Capture and restore of all option values of an FFmpeg object.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_ARG_SNAPSHOT
+#define FFMPEG_PLUS_PLUS_ARG_SNAPSHOT
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FFPPArgSchema.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// FFPPArgSnapshot holds the value of every option described by a schema.
+	/// Scalar values are copied bit for bit from their offset into one 8 byte
+	/// slot per option. Strings, binaries, dictionaries and channel layouts are
+	/// stored in a shared payload and their slot holds a hash of the payload,
+	/// so comparing two snapshots only compares the slot column.
+	/// Array options (AV_OPT_TYPE_FLAG_ARRAY) are not captured.
+	/// </summary>
+	class FFPPArgSnapshot {
+	public:
+		typedef FFPPArgSchema::Index Index;
+
+		FFPPArgSnapshot() = default;
+
+		/// <summary>
+		/// Reads all option values of obj by offset.
+		/// </summary>
+		static FFPPArgSnapshot capture(const FFPPArgSchema& schema, const void* obj);
+
+		/// <summary>
+		/// Builds the snapshot of a freshly defaulted object of the schema's class.
+		/// </summary>
+		static FFPPArgSnapshot defaults(const FFPPArgSchema& schema);
+
+		/// <summary>
+		/// Parses a blob created by serialize(). Returns std::nullopt if the blob
+		/// is malformed or was created for another class.
+		/// </summary>
+		static std::optional<FFPPArgSnapshot> deserialize(const FFPPArgSchema& schema, const std::vector<uint8_t>& blob);
+
+		/// <summary>
+		/// Writes all values that differ from the current state of obj back.
+		/// Read-only options are skipped. Returns the number of options that
+		/// could not be written.
+		/// </summary>
+		int restore(void* obj) const;
+
+		/// <summary>
+		/// Indices of the options whose value differs between both snapshots.
+		/// </summary>
+		std::vector<Index> diff(const FFPPArgSnapshot& other) const;
+
+		/// <summary>
+		/// Compact binary form, only valid for the same build of FFmpeg.
+		/// </summary>
+		std::vector<uint8_t> serialize() const;
+
+		/// <summary>
+		/// Human-readable form. If baseline is given only options differing
+		/// from it are written.
+		/// </summary>
+		std::string to_json(const FFPPArgSnapshot* baseline = nullptr) const;
+
+		const FFPPArgSchema* schema() const { return m_schema; }
+		size_t size() const { return m_slots.size(); }
+
+	private:
+		explicit FFPPArgSnapshot(const FFPPArgSchema& schema);
+
+		std::string_view payload(Index i) const;
+		void append_payload(Index i, std::string_view value, bool is_null = false);
+
+		const FFPPArgSchema* m_schema = nullptr;
+
+		std::vector<uint64_t> m_slots;   // Scalar bits or payload hash, 0 for NULL
+		std::vector<uint32_t> m_ends;    // End of each option's payload
+		std::string m_payload;
+	};
+}
+
+#endif
\ No newline at end of file
@@ -4,8 +4,6 @@
  * Control the logging functionality provide by FFmpeg.
  */
 
-// Todo: Add support for default values
-
 #include "FFPPArgs.h"
 
 #include <numeric>
@@ -85,8 +83,8 @@ av_opt_type_ctype(const AVOptionType& type) {
 	};
 }
 
-FFPPArgs::FFPPArgs(FFPPBase& base)
-	: m_obj(base.get())
+FFPPArgs::FFPPArgs(void* obj)
+	: m_obj(obj)
 {
 	if (m_obj) {
 		initialize();
@@ -95,53 +93,92 @@ FFPPArgs::FFPPArgs(FFPPBase& base)
 
 void FFPPArgs::initialize()
 {
-	const AVOption* option = nullptr;
+	// The first member of every AVOptions enabled struct is its AVClass*.
+	const AVClass* cls = *reinterpret_cast<const AVClass* const*>(m_obj);
+	m_schema = &FFPPArgSchema::get(cls);
 
-	LOG_DEBUG("Listing all options for AVCodecContext:\n");
-	while ((option = av_opt_next(m_obj, option)) != nullptr) {
-		
-		FFPPArg new_param;
+	std::stringstream s("");
+	s << "Using " << m_schema->size() << " options of " << (cls ? cls->class_name : "<none>")
+	  << " (" << m_schema->memory_usage() << " bytes shared)\n";
+	LOG_DEBUG(s.str());
+}
 
-		if (option->name) {
-			new_param.name = option->name;
-		}
-		
-		if (option->help) {
-			new_param.help = option->help;
-		}
+size_t FFPPArgs::size() const
+{
+	return m_schema ? m_schema->size() : 0;
+}
 
-		new_param.offset = option->offset;
-		
-		if (option->help) {
-			new_param.help = option->help;
-		}
+const FFPPArgSchema& FFPPArgs::schema() const
+{
+	return m_schema ? *m_schema : FFPPArgSchema::get(nullptr);
+}
 
-		new_param.type = av_opt_type_name(option->type);
-		new_param.ctype = av_opt_type_ctype(option->type);
+FFPPArg FFPPArgs::at(FFPPArgSchema::Index i) const
+{
+	const FFPPArgSchema& sc = schema();
+	const AVOptionType type = static_cast<AVOptionType>(sc.type(i));
+
+	FFPPArg arg;
+	arg.name = sc.name(i);
+	arg.help = sc.help(i);
+	arg.offset = sc.offset(i);
+	arg.type = av_opt_type_name(type);
+	arg.ctype = av_opt_type_ctype(type);
+	switch (type) {
+		case AVOptionType::AV_OPT_TYPE_DOUBLE:
+		case AVOptionType::AV_OPT_TYPE_FLOAT:
+		case AVOptionType::AV_OPT_TYPE_RATIONAL:
+			arg.default_val = sc.default_dbl(i);
+			break;
+		case AVOptionType::AV_OPT_TYPE_STRING:
+		case AVOptionType::AV_OPT_TYPE_BINARY:
+		case AVOptionType::AV_OPT_TYPE_DICT:
+		case AVOptionType::AV_OPT_TYPE_IMAGE_SIZE:
+		case AVOptionType::AV_OPT_TYPE_VIDEO_RATE:
+		case AVOptionType::AV_OPT_TYPE_COLOR:
+		case AVOptionType::AV_OPT_TYPE_CHLAYOUT:
+			arg.default_val = std::string(sc.default_str(i));
+			break;
+		default:
+			arg.default_val = sc.default_i64(i);
+			break;
+	}
+	arg.min = sc.min(i);
+	arg.max = sc.max(i);
+	arg.flags = sc.flags(i);
+	arg.unit = sc.unit(i);
 
-		/*if (option->default_val) {
-			new_param.default_val = option->default_val;
-		}*/
-		
-		new_param.min = option->min;
-		new_param.max = option->max;
-		new_param.flags = option->flags;
+	if (sc.flags(i) & AV_OPT_FLAG_READONLY) {
+		arg.name.append(" (Read-only)");
+	}
+	if (sc.flags(i) & AV_OPT_FLAG_DEPRECATED) {
+		arg.name.append(" (Deprecated)");
+	}
+	return arg;
+}
 
-		if (option->unit) {
-			new_param.unit = option->unit;
-		}
+std::vector<FFPPArgSchema::Index> FFPPArgs::select(int required, int excluded) const
+{
+	std::vector<FFPPArgSchema::Index> indices;
+	schema().select(required, indices, excluded);
+	return indices;
+}
 
-		if (option->flags & AV_OPT_FLAG_READONLY) {
-			new_param.name = new_param.name.append(" (Read-only)");
-		}
-		if (option->flags & AV_OPT_FLAG_DEPRECATED) {
-			new_param.name = new_param.name.append(" (Read-only)");
-		}
+FFPPArgSnapshot FFPPArgs::snapshot() const
+{
+	if (!m_obj) {
+		return FFPPArgSnapshot();
+	}
+	return FFPPArgSnapshot::capture(schema(), m_obj);
+}
 
-		auto msg = new_param.str();
-		LOG_INFO(msg);
-		m_params.emplace_back(new_param);
+int FFPPArgs::restore(const FFPPArgSnapshot& snapshot)
+{
+	if (!m_obj || snapshot.schema() != m_schema) {
+		LOG_ERROR("Snapshot does not match the wrapped object\n");
+		return -1;
 	}
+	return snapshot.restore(m_obj);
 }
 
 std::string FFPPArg::str()
@@ -153,7 +190,8 @@ std::string FFPPArg::str()
 	s << "\n    offset     : " << offset.value();
 	s << "\n    type       : " << type;
 	s << "\n    ctype      : " << ctype;
-	//s << "\n    default_val: " << std::get_if<int64_t>(default_val);
+	s << "\n    default_val: ";
+	std::visit([&s](const auto& value) { s << value; }, default_val);
 	s << "\n    min        : " << min.value();
 	s << "\n    max        : " << max.value();
 	s << "\n    flags      : " << flags.value();
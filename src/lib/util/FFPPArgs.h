@@ -12,11 +12,14 @@
 #include <variant>
 #include <vector>
 
-#include "../FFPPBase.h"
+#include "FFPPArgSchema.h"
+#include "FFPPArgSnapshot.h"
 
 namespace FFPP {
-	struct AVClass;
-
+	/// <summary>
+	/// FFPPArg is a self-contained copy of a single option description.
+	/// It is materialized on demand from the FFPPArgSchema for display.
+	/// </summary>
 	class FFPPArg {
 	public:
 		std::string name = "";
@@ -35,16 +38,49 @@ namespace FFPP {
 		std::string str();
 	};
 
+	/// <summary>
+	/// FFPPArgs gives access to the options of a wrapped FFmpeg object.
+	/// The option metadata is shared per AVClass, an instance only holds
+	/// the object and a pointer to the schema.
+	/// </summary>
 	class FFPPArgs {
 	public:
-		explicit FFPPArgs(FFPPBase& base);
+		/// <summary>
+		/// Wraps obj, any struct whose first member is an AVClass pointer.
+		/// </summary>
+		explicit FFPPArgs(void* obj);
 		~FFPPArgs() = default;
 
+		size_t size() const;
+		const FFPPArgSchema& schema() const;
+
+		/// <summary>
+		/// Materializes the description of the option at index i.
+		/// </summary>
+		FFPPArg at(FFPPArgSchema::Index i) const;
+
+		/// <summary>
+		/// Indices of the options matching the given AV_OPT_FLAG_* masks.
+		/// </summary>
+		std::vector<FFPPArgSchema::Index> select(int required, int excluded = 0) const;
+
+		/// <summary>
+		/// Captures the current value of every option of the wrapped object.
+		/// </summary>
+		FFPPArgSnapshot snapshot() const;
+
+		/// <summary>
+		/// Writes the values of snapshot back to the wrapped object.
+		/// Returns the number of options that could not be restored, or -1 if
+		/// the snapshot was taken from another class.
+		/// </summary>
+		int restore(const FFPPArgSnapshot& snapshot);
+
 	private:
-		std::vector<FFPPArg> m_params;
 		void initialize();
 
-		AVClass* m_obj = nullptr;
+		void* m_obj = nullptr;
+		const FFPPArgSchema* m_schema = nullptr;
 	};
 }
 #endif
\ No newline at end of file
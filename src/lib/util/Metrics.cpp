@@ -0,0 +1,33 @@
+/*
+ * Metrics.cpp
+ *
+ * Process-wide registry of counters tagged by the object they describe.
+ */
+
+#include "Metrics.h"
+
+using namespace FFPP;
+
+FFPP::Metrics& FFPP::Metrics::get_instance()
+{
+	static Metrics instance;
+	return instance;
+}
+
+Metrics::Counter& FFPP::Metrics::counter(const MetricTags& tags, std::string_view metric)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_counters.try_emplace(Key(tags.kind, tags.name ? tags.name : "", metric)).first->second;
+}
+
+std::vector<Metrics::Sample> FFPP::Metrics::snapshot() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<Sample> samples;
+	samples.reserve(m_counters.size());
+	for (const auto& [key, counter] : m_counters) {
+		const auto& [kind, name, metric] = key;
+		samples.push_back(Sample{ kind, name, metric, counter.value.load(std::memory_order_relaxed) });
+	}
+	return samples;
+}
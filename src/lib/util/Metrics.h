@@ -0,0 +1,66 @@
+/*
+ * Metrics.h
+ *
+ * Process-wide registry of counters tagged by the object they describe.
+ */
+
+#ifndef FFMPEG_PLUS_PLUS_METRICS
+#define FFMPEG_PLUS_PLUS_METRICS
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "../FFPPBase.h"
+
+namespace FFPP {
+
+	/// <summary>
+	/// Metrics holds named counters per MetricTags. A counter is looked up
+	/// once and then updated without locking; counters live as long as the
+	/// process, so objects with the same tags add up.
+	/// </summary>
+	class Metrics {
+	public:
+		struct Counter {
+			std::atomic<uint64_t> value = 0;
+
+			void add(uint64_t n) { value.fetch_add(n, std::memory_order_relaxed); }
+		};
+
+		struct Sample {
+			std::string kind;
+			std::string name;
+			std::string metric;
+			uint64_t value = 0;
+		};
+
+		static Metrics& get_instance();
+
+		/// <summary>
+		/// Counter metric of the object tagged tags, created at zero. The
+		/// reference stays valid.
+		/// </summary>
+		Counter& counter(const MetricTags& tags, std::string_view metric);
+
+		/// <summary>
+		/// Current value of every counter.
+		/// </summary>
+		std::vector<Sample> snapshot() const;
+
+	private:
+		typedef std::tuple<std::string, std::string, std::string> Key;
+
+		Metrics() = default;
+
+		mutable std::mutex m_mutex;
+		std::map<Key, Counter> m_counters;
+	};
+}
+
+#endif
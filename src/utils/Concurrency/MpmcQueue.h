@@ -0,0 +1,203 @@
+/*
+ * MpmcQueue.h
+ *
+ * Bounded lock-free multi producer, multi consumer queue.
+ */
+
+#ifndef UTILIX_MPMC_QUEUE
+#define UTILIX_MPMC_QUEUE
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "QueueWait.h"
+
+namespace UTLX {
+
+	/**
+	* MpmcQueue is a bounded array queue in which every cell carries a sequence
+	* number telling producers and consumers whose turn it is (D. Vyukov's
+	* design). Producers and consumers only contend on their own index, each
+	* on its own cache line. The capacity is rounded up to a power of two.
+	* T has to be default constructible and move assignable.
+	*/
+	template <typename T>
+	class MpmcQueue {
+	public:
+		explicit MpmcQueue(size_t capacity, WaitMode mode = WaitMode::Futex)
+			: m_capacity(std::bit_ceil(capacity ? capacity : 1))
+			, m_mask(m_capacity - 1)
+			, m_cells(std::make_unique<Cell[]>(m_capacity))
+			, m_not_empty(mode)
+			, m_not_full(mode)
+		{
+			for (size_t i = 0; i < m_capacity; i++) {
+				m_cells[i].seq.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		MpmcQueue(const MpmcQueue&) = delete;
+		MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+		/**
+		* Moves value in if there is room. value is untouched on failure.
+		*/
+		bool try_push(T& value) {
+			if (m_closed.load(std::memory_order_acquire)) {
+				return false;
+			}
+
+			size_t pos = m_enqueue.load(std::memory_order_relaxed);
+			Cell* cell = nullptr;
+			while (true) {
+				cell = &m_cells[pos & m_mask];
+				const size_t seq = cell->seq.load(std::memory_order_acquire);
+				const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+				if (diff == 0) {
+					if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				}
+				else if (diff < 0) {
+					return false;
+				}
+				else {
+					pos = m_enqueue.load(std::memory_order_relaxed);
+				}
+			}
+
+			cell->value = std::move(value);
+			cell->seq.store(pos + 1, std::memory_order_release);
+			const size_t dequeue = m_dequeue.load(std::memory_order_relaxed);
+			if (pos + 1 > dequeue) {
+				raise_high_water(m_high_water, pos + 1 - dequeue);
+			}
+			m_not_empty.notify();
+			return true;
+		}
+
+		/**
+		* Waits for room. Returns false if the queue was closed.
+		*/
+		bool push(T value) {
+			while (!try_push(value)) {
+				if (m_closed.load(std::memory_order_acquire)) {
+					return false;
+				}
+				m_not_full.wait([this] { return m_closed.load(std::memory_order_acquire) || !full(); });
+			}
+			return true;
+		}
+
+		std::optional<T> try_pop() {
+			std::optional<T> value;
+			size_t pos = m_dequeue.load(std::memory_order_relaxed);
+			Cell* cell = nullptr;
+			while (true) {
+				cell = &m_cells[pos & m_mask];
+				const size_t seq = cell->seq.load(std::memory_order_acquire);
+				const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+				if (diff == 0) {
+					if (m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				}
+				else if (diff < 0) {
+					return value;
+				}
+				else {
+					pos = m_dequeue.load(std::memory_order_relaxed);
+				}
+			}
+
+			value.emplace(std::move(cell->value));
+			cell->value = T();
+			cell->seq.store(pos + m_capacity, std::memory_order_release);
+			m_not_full.notify();
+			return value;
+		}
+
+		/**
+		* Waits for an item. Returns std::nullopt once closed and drained.
+		*/
+		std::optional<T> pop() {
+			while (true) {
+				std::optional<T> value = try_pop();
+				if (value || (m_closed.load(std::memory_order_acquire) && empty())) {
+					return value;
+				}
+				m_not_empty.wait([this] { return m_closed.load(std::memory_order_acquire) || !empty(); });
+			}
+		}
+
+		/**
+		* Fails further pushes and wakes up all waiters. Queued items can still be popped.
+		*/
+		void close() {
+			m_closed.store(true, std::memory_order_release);
+			m_not_empty.notify();
+			m_not_full.notify();
+		}
+
+		/**
+		* Drops all queued items and reopens the queue.
+		*/
+		void clear() {
+			while (try_pop()) {
+			}
+			m_closed.store(false, std::memory_order_release);
+		}
+
+		/**
+		* Number of claimed cells, includes items still being written or read.
+		*/
+		size_t size() const {
+			const size_t dequeue = m_dequeue.load(std::memory_order_acquire);
+			const size_t enqueue = m_enqueue.load(std::memory_order_acquire);
+			return enqueue > dequeue ? enqueue - dequeue : 0;
+		}
+
+		bool empty() const { return size() == 0; }
+		bool full() const { return size() >= m_capacity; }
+		bool closed() const { return m_closed.load(std::memory_order_acquire); }
+		size_t capacity() const { return m_capacity; }
+
+		QueueStats stats() const {
+			QueueStats stats;
+			stats.popped = m_dequeue.load(std::memory_order_acquire);
+			stats.pushed = m_enqueue.load(std::memory_order_acquire);
+			stats.depth = size();
+			stats.capacity = m_capacity;
+			stats.high_water = m_high_water.load(std::memory_order_relaxed);
+			stats.blocked_pushes = m_not_full.waits();
+			stats.blocked_pops = m_not_empty.waits();
+			stats.push_blocked_time = m_not_full.waited();
+			stats.pop_blocked_time = m_not_empty.waited();
+			return stats;
+		}
+
+	private:
+		struct Cell {
+			std::atomic<size_t> seq = 0;
+			T value = T();
+		};
+
+		const size_t m_capacity;
+		const size_t m_mask;
+		std::unique_ptr<Cell[]> m_cells;
+
+		alignas(CacheLineSize) std::atomic<size_t> m_enqueue = 0;
+		alignas(CacheLineSize) std::atomic<size_t> m_dequeue = 0;
+
+		alignas(CacheLineSize) std::atomic<bool> m_closed = false;
+		std::atomic<size_t> m_high_water = 0;
+		Waiter m_not_empty;
+		Waiter m_not_full;
+	};
+}
+
+#endif
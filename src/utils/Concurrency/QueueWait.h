@@ -0,0 +1,176 @@
+/*
+ * QueueWait.h
+ *
+ * Waiting strategies and metrics shared by the Utilix queues.
+ */
+
+#ifndef UTILIX_QUEUE_WAIT
+#define UTILIX_QUEUE_WAIT
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace UTLX {
+
+	/**
+	* Size used to keep producer and consumer state on separate cache lines.
+	*/
+	constexpr size_t CacheLineSize = 64;
+
+	/**
+	* How a blocking queue operation waits for the other side.
+	*/
+	enum class WaitMode {
+		Block,  // Mutex and condition variable
+		Spin,   // Busy wait, yields the time slice after a while
+		Futex,  // Short spin, then std::atomic::wait (futex / WaitOnAddress)
+	};
+
+	/**
+	* Counters describing how a queue is used. Blocked times are summed over
+	* all waiting threads.
+	*/
+	struct QueueStats {
+		size_t depth = 0;
+		size_t capacity = 0;
+		size_t high_water = 0;
+		uint64_t pushed = 0;
+		uint64_t popped = 0;
+		uint64_t blocked_pushes = 0;
+		uint64_t blocked_pops = 0;
+		std::chrono::nanoseconds push_blocked_time{ 0 };
+		std::chrono::nanoseconds pop_blocked_time{ 0 };
+	};
+
+	inline void cpu_relax() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+	/**
+	* Waiter parks threads until a condition, changed by another thread, holds.
+	* The changing thread calls notify() afterwards; it is cheap when nobody
+	* waits. Also measures how long threads were parked.
+	*/
+	class Waiter {
+	public:
+		explicit Waiter(WaitMode mode) : m_mode(mode) {}
+
+		Waiter(const Waiter&) = delete;
+		Waiter& operator=(const Waiter&) = delete;
+
+		template <typename Ready>
+		void wait(Ready ready) {
+			if (ready()) {
+				return;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			switch (m_mode) {
+			case WaitMode::Spin:
+				for (uint32_t i = 0; !ready(); i++) {
+					if (i < SpinLimit) {
+						cpu_relax();
+					}
+					else {
+						std::this_thread::yield();
+					}
+				}
+				break;
+			case WaitMode::Futex:
+				for (uint32_t i = 0; i < SpinLimit && !ready(); i++) {
+					cpu_relax();
+				}
+				while (true) {
+					const uint32_t seq = m_seq.load();
+					if (ready()) {
+						break;
+					}
+					m_waiters.fetch_add(1);
+					if (!ready()) {
+						m_seq.wait(seq);
+					}
+					m_waiters.fetch_sub(1);
+				}
+				break;
+			case WaitMode::Block: {
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_waiters.fetch_add(1);
+				// Pairs with the fence in notify(): either it sees the waiter or we see its change.
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				m_cv.wait(lock, ready);
+				m_waiters.fetch_sub(1);
+				break;
+			}
+			}
+			m_waits.fetch_add(1, std::memory_order_relaxed);
+			m_waited.fetch_add((std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+		}
+
+		void notify() {
+			switch (m_mode) {
+			case WaitMode::Spin:
+				break;
+			case WaitMode::Futex:
+				m_seq.fetch_add(1);
+				if (m_waiters.load()) {
+					m_seq.notify_all();
+				}
+				break;
+			case WaitMode::Block:
+				// The condition was published with a release store, which a
+				// later load may overtake without a full fence.
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (m_waiters.load()) {
+					// Taking the lock orders us after a waiter's last check.
+					{ std::lock_guard<std::mutex> lock(m_mutex); }
+					m_cv.notify_all();
+				}
+				break;
+			}
+		}
+
+		uint64_t waits() const { return m_waits.load(std::memory_order_relaxed); }
+
+		std::chrono::nanoseconds waited() const {
+			return std::chrono::steady_clock::duration(m_waited.load(std::memory_order_relaxed));
+		}
+
+	private:
+		static constexpr uint32_t SpinLimit = 128;
+
+		const WaitMode m_mode;
+		std::atomic<uint32_t> m_seq = 0;
+		std::atomic<uint32_t> m_waiters = 0;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+
+		std::atomic<uint64_t> m_waits = 0;
+		std::atomic<int64_t> m_waited = 0;  // steady_clock ticks
+	};
+
+	/**
+	* Raises a high-water counter to value if it is larger.
+	*/
+	inline void raise_high_water(std::atomic<size_t>& high_water, size_t value) {
+		size_t current = high_water.load(std::memory_order_relaxed);
+		while (value > current && !high_water.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,316 @@
+/*
+ * Scheduler.cpp
+ *
+ * Work-stealing task scheduler shared by all pipelines in the process.
+ */
+
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace UTLX;
+
+namespace {
+
+	struct WorkerContext {
+		const Scheduler* scheduler = nullptr;
+		int index = -1;
+	};
+
+	thread_local WorkerContext t_worker;
+}
+
+UTLX::Job::Stats UTLX::Job::stats() const
+{
+	Stats stats;
+	stats.tasks = m_tasks.load(std::memory_order_relaxed);
+	stats.cpu_time = std::chrono::nanoseconds(m_cpu_ns.load(std::memory_order_relaxed));
+	stats.running = m_running.load(std::memory_order_relaxed);
+	stats.queued = static_cast<size_t>(m_outstanding.load(std::memory_order_relaxed)) - stats.running;
+	return stats;
+}
+
+UTLX::Scheduler& UTLX::Scheduler::get_instance()
+{
+	static Scheduler instance{ Config() };
+	return instance;
+}
+
+UTLX::Scheduler::Scheduler(const Config& config)
+	: m_io_queue(config.io_capacity, WaitMode::Block)
+{
+	const unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+	const unsigned workers = config.workers ? config.workers : hardware;
+
+	for (unsigned i = 0; i < workers; i++) {
+		m_workers.emplace_back(std::make_unique<Worker>());
+	}
+	for (unsigned i = 0; i < workers; i++) {
+		m_workers[i]->thread = std::thread(&Scheduler::run, this, i);
+	}
+	for (unsigned i = 0; i < config.io_threads; i++) {
+		m_io_threads.emplace_back(&Scheduler::run_io, this);
+	}
+}
+
+UTLX::Scheduler::~Scheduler()
+{
+	m_stop = true;
+	wake(true);
+	for (auto& worker : m_workers) {
+		worker->thread.join();
+	}
+	m_io_queue.close();
+	for (auto& thread : m_io_threads) {
+		thread.join();
+	}
+}
+
+std::shared_ptr<Job> UTLX::Scheduler::create_job(const std::string& name, unsigned weight, unsigned cpu_budget)
+{
+	std::shared_ptr<Job> job(new Job(name, weight, cpu_budget));
+
+	std::lock_guard<std::mutex> lock(m_jobs_mutex);
+	// Start level with the others instead of owning the CPU until caught up.
+	int64_t vruntime = std::numeric_limits<int64_t>::max();
+	for (const auto& other : m_jobs) {
+		vruntime = std::min(vruntime, other->m_vruntime);
+	}
+	job->m_vruntime = m_jobs.empty() ? 0 : vruntime;
+	m_jobs.push_back(job);
+	return job;
+}
+
+void UTLX::Scheduler::submit(const std::shared_ptr<Job>& job, Task task)
+{
+	job->m_outstanding.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(m_jobs_mutex);
+		if (std::find(m_jobs.begin(), m_jobs.end(), job) == m_jobs.end()) {
+			m_jobs.push_back(job);
+		}
+		job->m_queue.push_back(std::move(task));
+	}
+	wake(false);
+}
+
+void UTLX::Scheduler::spawn(const std::shared_ptr<Job>& job, Task task)
+{
+	const int index = worker_index();
+	if (index < 0) {
+		submit(job, std::move(task));
+		return;
+	}
+
+	job->m_outstanding.fetch_add(1, std::memory_order_relaxed);
+	{
+		Worker& worker = *m_workers[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.items.push_back(Item{ std::move(task), job });
+	}
+	wake(false);
+}
+
+void UTLX::Scheduler::parallel_for(const std::shared_ptr<Job>& job, int count, unsigned max_runners,
+	const std::function<void(int index, unsigned runner)>& fn)
+{
+	if (count <= 0) {
+		return;
+	}
+
+	// Runners that start late find no index left; the shared state outlives the call for them.
+	struct State {
+		std::function<void(int, unsigned)> fn;
+		int count = 0;
+		std::atomic<int> next = 0;
+		std::atomic<int> done = 0;
+	};
+	auto state = std::make_shared<State>();
+	state->fn = fn;
+	state->count = count;
+
+	auto run_indices = [](State& state, unsigned runner) {
+		for (int i = state.next.fetch_add(1); i < state.count; i = state.next.fetch_add(1)) {
+			state.fn(i, runner);
+			if (state.done.fetch_add(1, std::memory_order_acq_rel) + 1 == state.count) {
+				state.done.notify_all();
+			}
+		}
+	};
+
+	const unsigned limit = max_runners ? max_runners : worker_count();
+	const unsigned runners = std::min(static_cast<unsigned>(count), std::max(limit, 1u));
+	for (unsigned r = 1; r < runners; r++) {
+		spawn(job, [state, run_indices, r] { run_indices(*state, r); });
+	}
+	run_indices(*state, 0);
+
+	for (int done = state->done.load(std::memory_order_acquire); done < count; done = state->done.load(std::memory_order_acquire)) {
+		state->done.wait(done, std::memory_order_acquire);
+	}
+}
+
+bool UTLX::Scheduler::submit_io(Task task)
+{
+	return m_io_queue.push(std::move(task));
+}
+
+void UTLX::Scheduler::wait(const Job& job)
+{
+	const int index = worker_index();
+	while (true) {
+		const uint64_t outstanding = job.m_outstanding.load(std::memory_order_acquire);
+		if (outstanding == 0) {
+			return;
+		}
+		Item item;
+		if (index >= 0 && find(static_cast<unsigned>(index), item)) {
+			execute(item);
+			continue;
+		}
+		job.m_outstanding.wait(outstanding, std::memory_order_acquire);
+	}
+}
+
+int UTLX::Scheduler::worker_index() const
+{
+	return t_worker.scheduler == this ? t_worker.index : -1;
+}
+
+void UTLX::Scheduler::run(unsigned index)
+{
+	t_worker.scheduler = this;
+	t_worker.index = static_cast<int>(index);
+
+	while (!m_stop.load(std::memory_order_acquire)) {
+		const uint32_t seq = m_seq.load();
+		Item item;
+		if (find(index, item)) {
+			execute(item);
+			continue;
+		}
+
+		m_sleepers.fetch_add(1);
+		if (!m_stop.load() && m_seq.load() == seq) {
+			m_seq.wait(seq);
+		}
+		m_sleepers.fetch_sub(1);
+	}
+}
+
+void UTLX::Scheduler::run_io()
+{
+	while (auto task = m_io_queue.pop()) {
+		(*task)();
+	}
+}
+
+bool UTLX::Scheduler::find(unsigned index, Item& item)
+{
+	return pop_local(index, item) || take_from_jobs(item) || steal(index, item);
+}
+
+bool UTLX::Scheduler::pop_local(unsigned index, Item& item)
+{
+	Worker& worker = *m_workers[index];
+	std::lock_guard<std::mutex> lock(worker.mutex);
+	if (worker.items.empty()) {
+		return false;
+	}
+	item = std::move(worker.items.back());
+	worker.items.pop_back();
+	item.job->m_running.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool UTLX::Scheduler::take_from_jobs(Item& item)
+{
+	std::lock_guard<std::mutex> lock(m_jobs_mutex);
+	Job* best = nullptr;
+	size_t best_index = 0;
+	for (size_t i = 0; i < m_jobs.size();) {
+		Job* job = m_jobs[i].get();
+		if (job->m_queue.empty()) {
+			// Forget finished jobs nobody refers to anymore.
+			if (m_jobs[i].use_count() == 1 && job->m_outstanding.load(std::memory_order_relaxed) == 0) {
+				m_jobs[i] = std::move(m_jobs.back());
+				m_jobs.pop_back();
+				continue;
+			}
+		}
+		else if (job->has_capacity() && (!best || job->m_vruntime < best->m_vruntime)) {
+			best = job;
+			best_index = i;
+		}
+		i++;
+	}
+	if (!best) {
+		return false;
+	}
+
+	item.task = std::move(best->m_queue.front());
+	item.job = m_jobs[best_index];
+	best->m_queue.pop_front();
+	best->m_running.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool UTLX::Scheduler::steal(unsigned index, Item& item)
+{
+	const size_t count = m_workers.size();
+	for (size_t i = 1; i < count; i++) {
+		Worker& victim = *m_workers[(index + i) % count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.items.empty() || !victim.items.front().job->has_capacity()) {
+			continue;
+		}
+		item = std::move(victim.items.front());
+		victim.items.pop_front();
+		item.job->m_running.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void UTLX::Scheduler::execute(Item& item)
+{
+	Job& job = *item.job;
+	const auto start = std::chrono::steady_clock::now();
+	item.task();
+	const int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	item.task = nullptr;
+
+	job.m_cpu_ns.fetch_add(elapsed, std::memory_order_relaxed);
+	job.m_tasks.fetch_add(1, std::memory_order_relaxed);
+	bool backlog = false;
+	{
+		std::lock_guard<std::mutex> lock(m_jobs_mutex);
+		job.m_vruntime += elapsed / job.m_weight;
+		backlog = job.m_cpu_budget != 0 && !job.m_queue.empty();
+	}
+	job.m_running.fetch_sub(1, std::memory_order_relaxed);
+
+	if (job.m_outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		job.m_outstanding.notify_all();
+	}
+	// A budget slot opened up for tasks that were held back.
+	if (backlog) {
+		wake(false);
+	}
+	item.job.reset();
+}
+
+void UTLX::Scheduler::wake(bool all)
+{
+	m_seq.fetch_add(1);
+	if (m_sleepers.load()) {
+		if (all) {
+			m_seq.notify_all();
+		}
+		else {
+			m_seq.notify_one();
+		}
+	}
+}
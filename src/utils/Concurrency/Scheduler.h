@@ -0,0 +1,181 @@
+/*
+ * Scheduler.h
+ *
+ * Work-stealing task scheduler shared by all pipelines in the process.
+ */
+
+#ifndef UTILIX_SCHEDULER
+#define UTILIX_SCHEDULER
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MpmcQueue.h"
+
+namespace UTLX {
+
+	class Scheduler;
+
+	/**
+	* A Job groups the tasks of one pipeline, e.g. one transcode. Jobs are
+	* served in proportion to their weight, and a job never occupies more
+	* workers than its CPU budget.
+	*/
+	class Job {
+	public:
+		struct Stats {
+			uint64_t tasks = 0;
+			std::chrono::nanoseconds cpu_time{ 0 };
+			size_t queued = 0;
+			unsigned running = 0;
+		};
+
+		const std::string& name() const { return m_name; }
+		unsigned weight() const { return m_weight; }
+		unsigned cpu_budget() const { return m_cpu_budget; }
+
+		/**
+		* Number of tasks submitted or spawned and not yet finished.
+		*/
+		uint64_t outstanding() const { return m_outstanding.load(std::memory_order_acquire); }
+
+		Stats stats() const;
+
+	private:
+		friend class Scheduler;
+
+		Job(std::string name, unsigned weight, unsigned cpu_budget)
+			: m_name(std::move(name)), m_weight(weight ? weight : 1), m_cpu_budget(cpu_budget) {}
+
+		bool has_capacity() const {
+			return m_cpu_budget == 0 || m_running.load(std::memory_order_relaxed) < m_cpu_budget;
+		}
+
+		const std::string m_name;
+		const unsigned m_weight;
+		const unsigned m_cpu_budget;              // Max concurrent workers, 0 is unlimited
+
+		std::deque<std::function<void()>> m_queue;  // Guarded by the scheduler's job mutex
+		int64_t m_vruntime = 0;                   // cpu time / weight, guarded likewise
+
+		std::atomic<unsigned> m_running = 0;
+		std::atomic<uint64_t> m_outstanding = 0;
+		std::atomic<uint64_t> m_tasks = 0;
+		std::atomic<int64_t> m_cpu_ns = 0;
+	};
+
+	/**
+	* Scheduler runs tasks on one worker per core. Tasks submitted to a job
+	* wait in the job's queue and are picked by the job with the least weighted
+	* CPU time that is within its budget. Tasks spawned from a running task go
+	* to the worker's own deque, are run newest first by that worker and are
+	* stolen oldest first by idle workers. Blocking I/O runs on a few separate
+	* threads so it never occupies a compute worker.
+	*/
+	class Scheduler {
+	public:
+		typedef std::function<void()> Task;
+
+		struct Config {
+			unsigned workers = 0;                 // 0 uses every hardware thread
+			unsigned io_threads = 2;
+			size_t io_capacity = 1024;
+		};
+
+		/**
+		* The process-wide scheduler with the default configuration.
+		*/
+		static Scheduler& get_instance();
+
+		explicit Scheduler(const Config& config);
+		~Scheduler();
+
+		Scheduler(const Scheduler&) = delete;
+		Scheduler& operator=(const Scheduler&) = delete;
+
+		/**
+		* Creates a job. The scheduler keeps it alive while it has tasks.
+		*/
+		std::shared_ptr<Job> create_job(const std::string& name, unsigned weight = 1, unsigned cpu_budget = 0);
+
+		void submit(const std::shared_ptr<Job>& job, Task task);
+
+		/**
+		* Queues a subtask of the running task on this worker's deque. Outside a
+		* worker it is submitted to job instead.
+		*/
+		void spawn(const std::shared_ptr<Job>& job, Task task);
+
+		/**
+		* Calls fn(index, runner) for every index below count and returns when
+		* all calls are done. Up to max_runners threads take part, the caller
+		* being runner 0; runner numbers are unique among concurrent calls.
+		* 0 allows one runner per worker.
+		*/
+		void parallel_for(const std::shared_ptr<Job>& job, int count, unsigned max_runners,
+			const std::function<void(int index, unsigned runner)>& fn);
+
+		/**
+		* Runs a blocking task on an I/O thread.
+		*/
+		bool submit_io(Task task);
+
+		/**
+		* Waits until job has no outstanding tasks. On a worker the calling
+		* thread runs other tasks meanwhile instead of blocking. A task must not
+		* wait for its own job, it counts as outstanding itself.
+		*/
+		void wait(const Job& job);
+
+		unsigned worker_count() const { return static_cast<unsigned>(m_workers.size()); }
+
+		/**
+		* Index of the calling worker of this scheduler, -1 on other threads.
+		*/
+		int worker_index() const;
+
+	private:
+		struct Item {
+			Task task;
+			std::shared_ptr<Job> job;
+		};
+
+		struct Worker {
+			std::mutex mutex;
+			std::deque<Item> items;               // Owner takes the back, thieves the front
+			std::thread thread;
+		};
+
+		void run(unsigned index);
+		void run_io();
+
+		bool find(unsigned index, Item& item);
+		bool pop_local(unsigned index, Item& item);
+		bool take_from_jobs(Item& item);
+		bool steal(unsigned index, Item& item);
+		void execute(Item& item);
+		void wake(bool all);
+
+		std::vector<std::unique_ptr<Worker>> m_workers;
+
+		std::mutex m_jobs_mutex;
+		std::vector<std::shared_ptr<Job>> m_jobs;
+
+		std::atomic<uint32_t> m_seq = 0;          // Bumped whenever work may have appeared
+		std::atomic<uint32_t> m_sleepers = 0;
+		std::atomic<bool> m_stop = false;
+
+		MpmcQueue<Task> m_io_queue;
+		std::vector<std::thread> m_io_threads;
+	};
+}
+
+#endif
\ No newline at end of file
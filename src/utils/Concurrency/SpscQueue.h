@@ -0,0 +1,166 @@
+/*
+ * SpscQueue.h
+ *
+ * Lock-free single producer, single consumer ring buffer.
+ */
+
+#ifndef UTILIX_SPSC_QUEUE
+#define UTILIX_SPSC_QUEUE
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "QueueWait.h"
+
+namespace UTLX {
+
+	/**
+	* SpscQueue is a bounded ring for exactly one producer and one consumer
+	* thread. The capacity is rounded up to a power of two and the head and
+	* tail indices live on separate cache lines, each side caching the other's
+	* index so that the shared lines are only read when the cached value is
+	* exhausted. T has to be default constructible and move assignable.
+	*/
+	template <typename T>
+	class SpscQueue {
+	public:
+		explicit SpscQueue(size_t capacity, WaitMode mode = WaitMode::Futex)
+			: m_items(std::bit_ceil(capacity ? capacity : 1))
+			, m_mask(m_items.size() - 1)
+			, m_not_empty(mode)
+			, m_not_full(mode)
+		{
+		}
+
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+
+		/**
+		* Moves value in if there is room. value is untouched on failure.
+		*/
+		bool try_push(T& value) {
+			if (m_closed.load(std::memory_order_acquire)) {
+				return false;
+			}
+			const size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_head_cache > m_mask) {
+				m_head_cache = m_head.load(std::memory_order_acquire);
+				if (tail - m_head_cache > m_mask) {
+					return false;
+				}
+			}
+			m_items[tail & m_mask] = std::move(value);
+			m_tail.store(tail + 1, std::memory_order_release);
+			if (tail + 1 - m_head_cache > m_high_water.load(std::memory_order_relaxed)) {
+				// The cached head may be stale, confirm before raising the mark.
+				raise_high_water(m_high_water, tail + 1 - m_head.load(std::memory_order_acquire));
+			}
+			m_not_empty.notify();
+			return true;
+		}
+
+		/**
+		* Waits for room. Returns false if the queue was closed.
+		*/
+		bool push(T value) {
+			while (!try_push(value)) {
+				if (m_closed.load(std::memory_order_acquire)) {
+					return false;
+				}
+				m_not_full.wait([this] { return m_closed.load(std::memory_order_acquire) || !full(); });
+			}
+			return true;
+		}
+
+		std::optional<T> try_pop() {
+			std::optional<T> value;
+			const size_t head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail_cache) {
+				m_tail_cache = m_tail.load(std::memory_order_acquire);
+				if (head == m_tail_cache) {
+					return value;
+				}
+			}
+			value.emplace(std::move(m_items[head & m_mask]));
+			m_items[head & m_mask] = T();
+			m_head.store(head + 1, std::memory_order_release);
+			m_not_full.notify();
+			return value;
+		}
+
+		/**
+		* Waits for an item. Returns std::nullopt once closed and drained.
+		*/
+		std::optional<T> pop() {
+			while (true) {
+				std::optional<T> value = try_pop();
+				if (value || (m_closed.load(std::memory_order_acquire) && empty())) {
+					return value;
+				}
+				m_not_empty.wait([this] { return m_closed.load(std::memory_order_acquire) || !empty(); });
+			}
+		}
+
+		/**
+		* Fails further pushes and wakes up all waiters. Queued items can still be popped.
+		*/
+		void close() {
+			m_closed.store(true, std::memory_order_release);
+			m_not_empty.notify();
+			m_not_full.notify();
+		}
+
+		/**
+		* Drops all queued items and reopens the queue. Call from the consumer.
+		*/
+		void clear() {
+			while (try_pop()) {
+			}
+			m_closed.store(false, std::memory_order_release);
+		}
+
+		size_t size() const {
+			const size_t head = m_head.load(std::memory_order_acquire);
+			return m_tail.load(std::memory_order_acquire) - head;
+		}
+
+		bool empty() const { return size() == 0; }
+		bool full() const { return size() > m_mask; }
+		bool closed() const { return m_closed.load(std::memory_order_acquire); }
+		size_t capacity() const { return m_items.size(); }
+
+		QueueStats stats() const {
+			QueueStats stats;
+			stats.popped = m_head.load(std::memory_order_acquire);
+			stats.pushed = m_tail.load(std::memory_order_acquire);
+			stats.depth = static_cast<size_t>(stats.pushed - stats.popped);
+			stats.capacity = capacity();
+			stats.high_water = m_high_water.load(std::memory_order_relaxed);
+			stats.blocked_pushes = m_not_full.waits();
+			stats.blocked_pops = m_not_empty.waits();
+			stats.push_blocked_time = m_not_full.waited();
+			stats.pop_blocked_time = m_not_empty.waited();
+			return stats;
+		}
+
+	private:
+		std::vector<T> m_items;
+		const size_t m_mask;
+
+		alignas(CacheLineSize) std::atomic<size_t> m_head = 0;
+		size_t m_tail_cache = 0;                  // Consumer's view of m_tail
+
+		alignas(CacheLineSize) std::atomic<size_t> m_tail = 0;
+		size_t m_head_cache = 0;                  // Producer's view of m_head
+
+		alignas(CacheLineSize) std::atomic<bool> m_closed = false;
+		std::atomic<size_t> m_high_water = 0;
+		Waiter m_not_empty;
+		Waiter m_not_full;
+	};
+}
+
+#endif